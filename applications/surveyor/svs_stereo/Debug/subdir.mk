@@ -5,24 +5,36 @@
 # Add inputs and outputs from these tool invocations to the build variables 
 CPP_SRCS += \
 ../bitmap.cpp \
+../checks.cpp \
 ../drawing.cpp \
 ../fileio.cpp \
 ../main.cpp \
-../stereo.cpp 
+../stereo.cpp \
+../stereo_calibration.cpp \
+../stereo_simd.cpp \
+../stereo_threads.cpp 
 
 OBJS += \
 ./bitmap.o \
+./checks.o \
 ./drawing.o \
 ./fileio.o \
 ./main.o \
-./stereo.o 
+./stereo.o \
+./stereo_calibration.o \
+./stereo_simd.o \
+./stereo_threads.o 
 
 CPP_DEPS += \
 ./bitmap.d \
+./checks.d \
 ./drawing.d \
 ./fileio.d \
 ./main.d \
-./stereo.d 
+./stereo.d \
+./stereo_calibration.d \
+./stereo_simd.d \
+./stereo_threads.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
@@ -0,0 +1,1335 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *  checks.cpp - checks of the optional modes and SIMD kernels of svs_stereo
+ *    Copyright (C) 2009  Surveyor Corporation
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details (www.gnu.org/licenses)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stereo.h"
+#include "checks.h"
+
+/* Dimensions of the synthetic images used by the checks, which are not
+ * multiples of the widths of the SIMD kernels, so that the scalar code
+ * handling the ends of each row is also checked */
+#define CHECK_WIDTH              317
+#define CHECK_HEIGHT             241
+
+/* thresholds used to detect features within the synthetic images */
+#define CHECK_RADIUS             16
+#define CHECK_RESPONSE           180
+
+/*---------------------------------------------------------------------*/
+/* synthetic images */
+/*---------------------------------------------------------------------*/
+
+/* Fills an RGB image with rectangles of random colours and sizes over
+ * a background of noise, giving plenty of edges to be detected.  The
+ * same seed always gives the same image */
+static void SyntheticImage(
+    unsigned char* img,
+    int imgWidth,
+    int imgHeight,
+    unsigned int seed)
+{
+    srand(seed);
+    for (int i = 0; i < imgWidth * imgHeight * 3; i++)
+        img[i] = (unsigned char)(96 + rand() % 64);
+
+    for (int r = 0; r < imgWidth * imgHeight / 200; r++)
+    {
+        int w = 3 + rand() % 24, h = 3 + rand() % 24;
+        int x0 = rand() % imgWidth, y0 = rand() % imgHeight;
+        unsigned char colour[3];
+        for (int c = 0; c < 3; c++)
+            colour[c] = (unsigned char)(rand() % 256);
+        for (int y = y0; (y < y0 + h) && (y < imgHeight); y++)
+        {
+            for (int x = x0; (x < x0 + w) && (x < imgWidth); x++)
+                memcpy(&img[pixindex(x, y, imgWidth)], colour, 3);
+        }
+    }
+}
+
+/* Sets the right image of a stereo pair from the left one, in which
+ * each pixel of the left image appears disparity pixels further left,
+ * with a disparity of 6 pixels in the upper half of the image and 14
+ * in the lower half.  Pixels which are not visible in the left image
+ * are left unchanged */
+static void SyntheticPair(
+    const unsigned char* left,
+    unsigned char* right,
+    int imgWidth,
+    int imgHeight)
+{
+    for (int y = 0; y < imgHeight; y++)
+    {
+        int disparity = (y < imgHeight / 2) ? 6 : 14;
+        for (int x = 0; x + disparity < imgWidth; x++)
+            memcpy(&right[pixindex(x, y, imgWidth)], &left[pixindex(x + disparity, y, imgWidth)], 3);
+    }
+}
+
+/*---------------------------------------------------------------------*/
+/* checks */
+/*---------------------------------------------------------------------*/
+
+/* prints the result of a check, returning one if it failed */
+static int CheckResult(
+    const char* name,
+    bool passed)
+{
+    printf("%-48s %s\n", name, passed ? "passed" : "FAILED");
+    return(passed ? 0 : 1);
+}
+
+/* returns the number of features held by a context */
+static int FeatureCount(
+    struct svs_context* ctx)
+{
+    int no_of_features = 0;
+    for (int row = 0; row < ctx->feature_rows; row++)
+        no_of_features += ctx->svs_data.features_per_row[row];
+    return(no_of_features);
+}
+
+/* returns true if two contexts hold the same features.  Sub-pixel
+ * offsets are only compared if compare_subx is set */
+static bool SameFeatures(
+    struct svs_context* a,
+    struct svs_context* b,
+    bool compare_subx)
+{
+    int no_of_a = FeatureCount(a);
+    if ((no_of_a != FeatureCount(b)) ||
+            (memcmp(a->svs_data.features_per_row, b->svs_data.features_per_row, a->feature_rows * sizeof(unsigned short int)) != 0) ||
+            (memcmp(a->svs_data.feature_x, b->svs_data.feature_x, no_of_a * sizeof(short int)) != 0) ||
+            (memcmp(a->svs_data.descriptor, b->svs_data.descriptor, no_of_a * SVS_DESCRIPTOR_WORDS * sizeof(unsigned int)) != 0) ||
+            (memcmp(a->svs_data.mean, b->svs_data.mean, no_of_a * sizeof(unsigned char)) != 0))
+        return(false);
+    if (compare_subx)
+        return(memcmp(a->svs_data.feature_subx, b->svs_data.feature_subx, no_of_a * sizeof(signed char)) == 0);
+    return(true);
+}
+
+/* Detects features within the given images using two contexts which
+ * have been set up differently, returning true if both found the same
+ * features, and found some */
+static bool SameDetection(
+    struct svs_context* a,
+    unsigned char* img_a,
+    struct svs_context* b,
+    unsigned char* img_b,
+    bool compare_subx)
+{
+    int no_of_a = svs_get_features(a, img_a, CHECK_RADIUS, CHECK_RESPONSE, 0, 0);
+    svs_get_features(b, img_b, CHECK_RADIUS, CHECK_RESPONSE, 0, 0);
+    return((no_of_a > 0) && SameFeatures(a, b, compare_subx));
+}
+
+/* Returns the response left at x by SVS_NON_MAX_WINDOW, from its
+ * definition: after thresholding, a response survives if it is no smaller
+ * than every response up to radius-1 pixels to its left, and greater than
+ * every response up to radius-1 pixels to its right, within the part of
+ * the row from 4 to imgWidth-4 */
+static unsigned int WindowSurvivor(
+    const unsigned int* peaks,
+    int imgWidth,
+    int x,
+    int radius,
+    unsigned int threshold)
+{
+    unsigned int v = (peaks[x] < threshold) ? 0 : peaks[x];
+    for (int r = 1; r < radius; r++)
+    {
+        if ((x - r >= 4) && (peaks[x - r] >= threshold) && (peaks[x - r] > v))
+            return(0);
+        if ((x + r < imgWidth - 4) && (peaks[x + r] >= threshold) && (peaks[x + r] >= v))
+            return(0);
+    }
+    return(v);
+}
+
+/* Checks the window method of non-maximal suppression, and its SIMD kernel,
+ * against its definition on rows with many equal responses, with radii up
+ * to beyond the length of the row and a threshold of zero among others.
+ * On rows of plateaus of equal responses, separated by more than the
+ * radius, it should also leave the same responses as the scan */
+static int CheckNonMax()
+{
+    int widths[] = { 13, 37, 100, CHECK_WIDTH };
+    unsigned int min_response[] = { 0, 100, CHECK_RESPONSE };
+    int simd_levels = svs_simd_detect() + 1;
+    bool same = true, defined = true, plateaus = true;
+
+    srand(5);
+    for (int w = 0; w < (int)(sizeof(widths) / sizeof(int)); w++)
+    {
+        int imgWidth = widths[w];
+        unsigned int* peaks = new unsigned int[imgWidth];
+        unsigned int* scalar = new unsigned int[imgWidth];
+        struct svs_context* ctx = svs_create(imgWidth, 16, SVS_MAX_FEATURES);
+
+        for (int trial = 0; trial < 60; trial++)
+        {
+            int radius = 1 + rand() % (imgWidth + 10);
+            unsigned int response = min_response[trial % 3];
+
+            /* responses from a few values, often equal to their neighbours */
+            memset(peaks, 0, imgWidth * sizeof(unsigned int));
+            for (int x = 4; x < imgWidth - 4; x++)
+                peaks[x] = ((x > 4) && (rand() % 3 == 0)) ? peaks[x - 1] : (unsigned int)(rand() % 4) * 100;
+
+            ctx->non_max = SVS_NON_MAX_WINDOW;
+            ctx->simd = SVS_SIMD_NONE;
+            memcpy(ctx->row_peaks, peaks, imgWidth * sizeof(unsigned int));
+            svs_non_max(ctx, radius, response);
+            memcpy(scalar, ctx->row_peaks, imgWidth * sizeof(unsigned int));
+            for (int simd = SVS_SIMD_NONE + 1; simd < simd_levels; simd++)
+            {
+                ctx->simd = simd;
+                memcpy(ctx->row_peaks, peaks, imgWidth * sizeof(unsigned int));
+                svs_non_max(ctx, radius, response);
+                if (memcmp(scalar, ctx->row_peaks, imgWidth * sizeof(unsigned int)) != 0)
+                    same = false;
+            }
+
+            /* the threshold is a percentage of the average response, and at least one */
+            unsigned int threshold = 0;
+            for (int x = 4; x < imgWidth - 4; x++)
+                threshold += peaks[x];
+            threshold = threshold / (imgWidth - 8) * response / 100;
+            if (threshold < 1)
+                threshold = 1;
+            for (int x = 4; x < imgWidth - 4; x++)
+            {
+                if (scalar[x] != WindowSurvivor(peaks, imgWidth, x, radius, threshold))
+                    defined = false;
+            }
+
+            /* plateaus separated by more than the radius, ending before
+             * the part of the row which the scan leaves unchanged */
+            radius = 1 + rand() % 8;
+            memset(peaks, 0, imgWidth * sizeof(unsigned int));
+            for (int x = 4 + rand() % radius; x + 4 < imgWidth - radius; x += radius + rand() % 4)
+            {
+                unsigned int v = 1 + rand() % 1000;
+                for (int n = 1 + rand() % 4; (n > 0) && (x + 4 < imgWidth - radius); n--, x++)
+                    peaks[x] = v;
+            }
+            for (int method = SVS_NON_MAX_SCAN; method <= SVS_NON_MAX_WINDOW; method++)
+            {
+                ctx->non_max = method;
+                memcpy(ctx->row_peaks, peaks, imgWidth * sizeof(unsigned int));
+                svs_non_max(ctx, radius, 0);
+                if (method == SVS_NON_MAX_SCAN)
+                    memcpy(scalar, ctx->row_peaks, imgWidth * sizeof(unsigned int));
+                else if (memcmp(scalar, ctx->row_peaks, imgWidth * sizeof(unsigned int)) != 0)
+                    plateaus = false;
+            }
+        }
+
+        svs_free(ctx);
+        delete[] peaks;
+        delete[] scalar;
+    }
+
+    int failures = 0;
+    failures += CheckResult("non-max: SIMD window matches the scalar code", same);
+    failures += CheckResult("non-max: window keeps only the window maxima", defined);
+    failures += CheckResult("non-max: window matches the scan on plateaus", plateaus);
+    return(failures);
+}
+
+/* Checks that features detected and matched with several threads, each
+ * working on a band of rows with its own buffers, are the same as those
+ * of a single thread, with each matcher and with the consistency check.
+ * Most of the possible matches are only compared when they are left
+ * unfiltered.  Each pair of contexts is used for two frames, so that the
+ * threads and band buffers are also reused */
+static int CheckThreads(
+    unsigned char* left,
+    unsigned char* right)
+{
+    int matchers[] = { SVS_MATCHER_GREEDY, SVS_MATCHER_GREEDY, SVS_MATCHER_GREEDY, SVS_MATCHER_SCANLINE };
+    int consistency[] = { 0, 0, 1, 0 };
+    int filters[] = { SVS_FILTER_HISTOGRAM, SVS_FILTER_NONE, SVS_FILTER_NONE, SVS_FILTER_NONE };
+    bool features = true, matched = true;
+
+    for (int m = 0; m < 4; m++)
+    {
+        struct svs_context* ctx[2][2];
+        int matches[2] = { 0, 0 };
+        for (int t = 0; t < 2; t++)
+        {
+            for (int cam = 0; cam < 2; cam++)
+            {
+                ctx[t][cam] = svs_create(CHECK_WIDTH, CHECK_HEIGHT, SVS_MAX_FEATURES);
+                ctx[t][cam]->threads = (t == 0) ? 1 : 4;
+            }
+            ctx[t][0]->matcher = matchers[m];
+            ctx[t][0]->consistency = consistency[m];
+            ctx[t][0]->filter = filters[m];
+            ctx[t][0]->match_rows = 1;
+        }
+
+        for (int frame = 0; frame < 2; frame++)
+        {
+            if (!SameDetection(ctx[0][1], right, ctx[1][1], right, true) ||
+                    !SameDetection(ctx[0][0], left, ctx[1][0], left, true))
+                features = false;
+            for (int t = 0; t < 2; t++)
+            {
+                svs_receive(ctx[t][0], &ctx[t][1]->svs_data);
+                matches[t] = svs_match(ctx[t][0], 200, 20, 2, 18, 7, 3);
+            }
+            if ((matches[0] == 0) || (matches[0] != matches[1]) ||
+                    (memcmp(ctx[0][0]->svs_matches, ctx[1][0]->svs_matches, matches[0] * 4 * sizeof(unsigned int)) != 0))
+                matched = false;
+        }
+
+        for (int t = 0; t < 2; t++)
+        {
+            svs_free(ctx[t][0]);
+            svs_free(ctx[t][1]);
+        }
+    }
+
+    int failures = 0;
+    failures += CheckResult("threads: same features", features);
+    failures += CheckResult("threads: same matches", matched);
+    return(failures);
+}
+
+/* Checks that the feature budget controller starts from the given
+ * thresholds, and that once it is switched off the thresholds which
+ * it learnt have no effect */
+static int CheckFeatureBudget(
+    unsigned char* img)
+{
+    int failures = 0;
+    struct svs_context* fixed = svs_create(CHECK_WIDTH, CHECK_HEIGHT, SVS_MAX_FEATURES);
+    struct svs_context* adapted = svs_create(CHECK_WIDTH, CHECK_HEIGHT, SVS_MAX_FEATURES);
+    adapted->target_features = 100;
+    adapted->adapt_radius = 1;
+
+    failures += CheckResult("budget: first frame uses the given thresholds",
+                            SameDetection(fixed, img, adapted, img, true));
+
+    for (int frame = 0; frame < 4; frame++)
+        svs_get_features(adapted, img, CHECK_RADIUS, CHECK_RESPONSE, 0, 0);
+    adapted->target_features = 0;
+    failures += CheckResult("budget: no effect once switched off",
+                            SameDetection(fixed, img, adapted, img, true));
+
+    svs_free(fixed);
+    svs_free(adapted);
+    return(failures);
+}
+
+/* Checks that sub-pixel localisation only adds offsets within half a
+ * pixel to the features, which are otherwise unchanged, and that the
+ * offsets are zero when it is off */
+static int CheckSubpixel(
+    unsigned char* img)
+{
+    int failures = 0;
+    struct svs_context* whole = svs_create(CHECK_WIDTH, CHECK_HEIGHT, SVS_MAX_FEATURES);
+    struct svs_context* fraction = svs_create(CHECK_WIDTH, CHECK_HEIGHT, SVS_MAX_FEATURES);
+    fraction->subpixel = 1;
+
+    failures += CheckResult("subpixel: features otherwise unchanged",
+                            SameDetection(whole, img, fraction, img, false));
+
+    bool zero = true, within = true, nonzero = false;
+    for (int f = 0; f < FeatureCount(whole); f++)
+    {
+        if (whole->svs_data.feature_subx[f] != 0)
+            zero = false;
+    }
+    for (int f = 0; f < FeatureCount(fraction); f++)
+    {
+        int subx = fraction->svs_data.feature_subx[f];
+        if ((subx < -SVS_SUBPIXEL/2) || (subx > SVS_SUBPIXEL/2))
+            within = false;
+        if (subx != 0)
+            nonzero = true;
+    }
+    failures += CheckResult("subpixel: no offsets when off", zero);
+    failures += CheckResult("subpixel: offsets within half a pixel", within && nonzero);
+
+    svs_free(whole);
+    svs_free(fraction);
+    return(failures);
+}
+
+/* Checks that the descriptors gathered by the SIMD code for several
+ * features at once are the same as those of svs_feature_descriptor, for
+ * each image format and so each number of bytes per sample, including
+ * the features near the bottom of the image which are left to the
+ * scalar code.  The descriptor width is that which the checks were
+ * built with (see SVS_DESCRIPTOR_PIXELS in makefile.targets) */
+static int CheckDescriptors(
+    unsigned char* img)
+{
+    int formats[] = { SVS_FORMAT_RGB, SVS_FORMAT_LUMA8, SVS_FORMAT_LUMA16 };
+    const char* names[] = { "descriptors: SIMD RGB", "descriptors: SIMD 8 bit luma", "descriptors: SIMD 16 bit luma" };
+    unsigned char* luma = new unsigned char[CHECK_WIDTH * CHECK_HEIGHT * 2];
+    int failures = 0;
+
+    for (int f = 0; f < 3; f++)
+    {
+        struct svs_context* scalar = svs_create(CHECK_WIDTH, CHECK_HEIGHT, SVS_MAX_FEATURES);
+        struct svs_context* simd = svs_create(CHECK_WIDTH, CHECK_HEIGHT, SVS_MAX_FEATURES);
+        unsigned char* frame = img;
+        scalar->format = formats[f];
+        simd->format = formats[f];
+        scalar->simd = SVS_SIMD_NONE;
+        if (formats[f] != SVS_FORMAT_RGB)
+        {
+            svs_luma(scalar, img, 3, luma);
+            frame = luma;
+        }
+
+        failures += CheckResult(names[f], SameDetection(scalar, frame, simd, frame, true));
+        svs_free(scalar);
+        svs_free(simd);
+    }
+
+    delete[] luma;
+    return(failures);
+}
+
+/* Checks that each SIMD kernel used by svs_update_sums and svs_non_max
+ * gives the same sliding sums, edge responses and surviving responses as
+ * the scalar code, with every image format, on rows whose lengths are
+ * not multiples of the SIMD widths.  svs_luma is checked on the way */
+static int CheckRowSums()
+{
+    int widths[] = { 9, 15, 23, 33, 47, 71, CHECK_WIDTH };
+    int formats[] = { SVS_FORMAT_RGB, SVS_FORMAT_LUMA8, SVS_FORMAT_LUMA16 };
+    int bytes[] = { 3, 1, 2 };
+    int imgHeight = 24;
+    int simd_levels = svs_simd_detect() + 1;
+    bool luma = true, sums = true, peaks = true, non_max = true;
+
+    for (int w = 0; w < (int)(sizeof(widths) / sizeof(int)); w++)
+    {
+        int imgWidth = widths[w];
+        unsigned char* img = new unsigned char[imgWidth * imgHeight * 3];
+        unsigned char* scalar = new unsigned char[imgWidth * imgHeight * 2];
+        unsigned char* converted = new unsigned char[imgWidth * imgHeight * 2];
+        int* row_sum = new int[imgWidth];
+        unsigned int* row_peaks = new unsigned int[imgWidth];
+        unsigned int* survivors = new unsigned int[imgWidth];
+        struct svs_context* ctx = svs_create(imgWidth, imgHeight, SVS_MAX_FEATURES);
+        SyntheticImage(img, imgWidth, imgHeight, 4 + w);
+
+        for (int f = 0; f < 3; f++)
+        {
+            unsigned char* frame = img;
+            ctx->format = formats[f];
+            if (formats[f] != SVS_FORMAT_RGB)
+            {
+                ctx->simd = SVS_SIMD_NONE;
+                svs_luma(ctx, img, 3, scalar);
+                for (int simd = SVS_SIMD_NONE + 1; simd < simd_levels; simd++)
+                {
+                    ctx->simd = simd;
+                    svs_luma(ctx, img, 3, converted);
+                    if (memcmp(scalar, converted, imgWidth * imgHeight * bytes[f]) != 0)
+                        luma = false;
+                }
+                frame = scalar;
+            }
+
+            for (int y = 0; y < imgHeight; y++)
+            {
+                ctx->simd = SVS_SIMD_NONE;
+                int mean = svs_update_sums(ctx, y, frame);
+                memcpy(row_sum, ctx->row_sum, imgWidth * sizeof(int));
+                memcpy(row_peaks, ctx->row_peaks, imgWidth * sizeof(unsigned int));
+                for (int simd = SVS_SIMD_NONE + 1; simd < simd_levels; simd++)
+                {
+                    ctx->simd = simd;
+                    if ((svs_update_sums(ctx, y, frame) != mean) ||
+                            (memcmp(row_sum, ctx->row_sum, imgWidth * sizeof(int)) != 0))
+                        sums = false;
+                    if (memcmp(&row_peaks[4], &ctx->row_peaks[4], (imgWidth - 8) * sizeof(unsigned int)) != 0)
+                        peaks = false;
+                }
+
+                /* the threshold is a percentage of the average response */
+                ctx->simd = SVS_SIMD_NONE;
+                memcpy(ctx->row_peaks, row_peaks, imgWidth * sizeof(unsigned int));
+                svs_non_max(ctx, 4, CHECK_RESPONSE);
+                memcpy(survivors, ctx->row_peaks, imgWidth * sizeof(unsigned int));
+                for (int simd = SVS_SIMD_NONE + 1; simd < simd_levels; simd++)
+                {
+                    ctx->simd = simd;
+                    memcpy(ctx->row_peaks, row_peaks, imgWidth * sizeof(unsigned int));
+                    svs_non_max(ctx, 4, CHECK_RESPONSE);
+                    if (memcmp(survivors, ctx->row_peaks, imgWidth * sizeof(unsigned int)) != 0)
+                        non_max = false;
+                }
+            }
+        }
+
+        svs_free(ctx);
+        delete[] img;
+        delete[] scalar;
+        delete[] converted;
+        delete[] row_sum;
+        delete[] row_peaks;
+        delete[] survivors;
+    }
+
+    int failures = 0;
+    failures += CheckResult("row sums: SIMD luma conversion", luma);
+    failures += CheckResult("row sums: SIMD sliding sums", sums);
+    failures += CheckResult("row sums: SIMD edge responses", peaks);
+    failures += CheckResult("row sums: SIMD average response", non_max);
+    return(failures);
+}
+
+/* Returns the highest total probability of any matches between the left
+ * camera features from L onwards and the right camera features from R
+ * onwards, such that no two matches cross and no feature is matched
+ * twice, by trying every choice for each left camera feature in turn */
+static int BestOrderedMatches(
+    const int* prob,       /* probability of each pair, or zero */
+    int no_of_left,
+    int no_of_right,
+    int L,
+    int R)
+{
+    if (L == no_of_left)
+        return(0);
+    int best = BestOrderedMatches(prob, no_of_left, no_of_right, L + 1, R);
+    for (int r = R; r < no_of_right; r++)
+    {
+        if (prob[L*no_of_right + r] > 0)
+        {
+            int total = prob[L*no_of_right + r] +
+                        BestOrderedMatches(prob, no_of_left, no_of_right, L + 1, r + 1);
+            if (total > best)
+                best = total;
+        }
+    }
+    return(best);
+}
+
+/* Checks that on every row the scanline matcher finds matches with the
+ * highest total probability of any which do not cross, by comparing it
+ * with a search of every combination on rows of a few random features.
+ * Only the mean luminance and disparity are weighted, so that the
+ * matching probability of each pair of features is known */
+static int CheckScanline()
+{
+    int imgWidth = 64, rows = 24, max_features = 8;
+    int max_disp = imgWidth / 4, learnLuma = 40, learnDisp = 30;
+    struct svs_context* ctx = svs_create(imgWidth, 4 + rows * SVS_VERTICAL_SAMPLING + 4, SVS_MAX_FEATURES);
+    int* prob = new int[max_features * max_features];
+    int* best = new int[rows];
+    bool optimal = true;
+
+    ctx->matcher = SVS_MATCHER_SCANLINE;
+    ctx->filter = SVS_FILTER_NONE;
+    ctx->match_output = SVS_MATCHES_THRESHOLD;
+    ctx->match_threshold = 0;
+    memset(ctx->svs_data.descriptor, 0, ctx->max_features * SVS_DESCRIPTOR_WORDS * sizeof(unsigned int));
+    memset(ctx->svs_data_received.descriptor, 0, ctx->max_features * SVS_DESCRIPTOR_WORDS * sizeof(unsigned int));
+
+    /* features at different positions along each row, in order of decreasing x */
+    srand(3);
+    int fL = 0, fR = 0;
+    for (int row = 0; row < rows; row++)
+    {
+        struct svs_data_struct* data[2] = { &ctx->svs_data, &ctx->svs_data_received };
+        int first[2] = { fL, fR };
+        for (int cam = 0; cam < 2; cam++)
+        {
+            int n = 1 + rand() % max_features;
+            int f = first[cam];
+            for (int x = imgWidth - 1; (x >= 0) && (f < first[cam] + n); x--)
+            {
+                if (rand() % (x + 1) < first[cam] + n - f)
+                {
+                    data[cam]->feature_x[f] = (short int)x;
+                    data[cam]->mean[f] = (unsigned char)(rand() % 256);
+                    f++;
+                }
+            }
+            data[cam]->features_per_row[row] = (unsigned short int)(f - first[cam]);
+        }
+        int no_of_left = ctx->svs_data.features_per_row[row];
+        int no_of_right = ctx->svs_data_received.features_per_row[row];
+
+        /* probability of each pair, as scored by svs_match */
+        for (int L = 0; L < no_of_left; L++)
+        {
+            int total = 0;
+            for (int R = 0; R < no_of_right; R++)
+            {
+                int disp = ctx->svs_data.feature_x[fL + L] - ctx->svs_data_received.feature_x[fR + R];
+                int luma_diff = abs(ctx->svs_data.mean[fL + L] - ctx->svs_data_received.mean[fR + R]);
+                int score = 0;
+                if ((disp >= -10) && (disp < max_disp))
+                    score = 10000 + (max_disp - ((disp < 0) ? 0 : disp)) * learnDisp - luma_diff * learnLuma;
+                prob[L*no_of_right + R] = (score > 0) ? score : 0;
+                total += prob[L*no_of_right + R];
+            }
+            for (int R = 0; R < no_of_right; R++)
+            {
+                int p = (total > 0) ? (int)((unsigned int)prob[L*no_of_right + R] * 1000 / (unsigned int)total) : 0;
+                prob[L*no_of_right + R] = (p < 1000) ? p : 0;
+            }
+        }
+        best[row] = BestOrderedMatches(prob, no_of_left, no_of_right, 0, 0);
+        fL += no_of_left;
+        fR += no_of_right;
+    }
+
+    /* every possible match is returned in order of increasing y */
+    int matches = svs_match(ctx, 0, max_disp * 100 / imgWidth, -1, 0, learnLuma, learnDisp);
+    int i = 0;
+    for (int row = 0; row < rows; row++)
+    {
+        int total = 0;
+        int y = 4 + row * SVS_VERTICAL_SAMPLING;
+        for (; (i < matches) && ((int)ctx->svs_matches[i*4 + 2] == y); i++)
+            total += ctx->svs_matches[i*4];
+        if (total != best[row])
+            optimal = false;
+    }
+    if (i != matches)
+        optimal = false;
+
+    delete[] prob;
+    delete[] best;
+    svs_free(ctx);
+    return(CheckResult("scanline: highest total probability", optimal));
+}
+
+/* Fills the left and right camera features of a context with random
+ * positions, descriptors and mean luminances, with from one to
+ * max_per_row features on each row in order of decreasing x */
+static void RandomFeatures(
+    struct svs_context* ctx,
+    int rows,
+    int max_per_row,
+    int seed)
+{
+    struct svs_data_struct* data[2] = { &ctx->svs_data, &ctx->svs_data_received };
+    int imgWidth = (int)ctx->imgWidth;
+
+    srand(seed);
+    for (int cam = 0; cam < 2; cam++)
+    {
+        int f = 0;
+        memset(data[cam]->features_per_row, 0, ctx->feature_rows * sizeof(unsigned short int));
+        for (int row = 0; row < rows; row++)
+        {
+            int n = 1 + rand() % max_per_row;
+            int first = f;
+            for (int x = imgWidth - 1; (x >= 0) && (f < first + n); x--)
+            {
+                if (rand() % (x + 1) < first + n - f)
+                {
+                    data[cam]->feature_x[f] = (short int)x;
+                    data[cam]->mean[f] = (unsigned char)(rand() % 256);
+                    for (int w = 0; w < SVS_DESCRIPTOR_WORDS; w++)
+                        data[cam]->descriptor[f*SVS_DESCRIPTOR_WORDS + w] = ((unsigned int)rand() << 16) ^ (unsigned int)rand();
+                    if (SVS_DESCRIPTOR_PIXELS % 32 != 0)
+                        data[cam]->descriptor[f*SVS_DESCRIPTOR_WORDS + SVS_DESCRIPTOR_WORDS - 1] &= (1u << (SVS_DESCRIPTOR_PIXELS % 32)) - 1;
+                    f++;
+                }
+            }
+            data[cam]->features_per_row[row] = (unsigned short int)(f - first);
+        }
+    }
+}
+
+/* Checks that the matching scores computed by the SIMD code for several
+ * right camera features at once are the same as those of the scalar
+ * code, by comparing all of the matches found by each.  Rows hold
+ * numbers of features which are not multiples of the SIMD width, the
+ * disparities cover both negative ranges scored by svs_match_scores,
+ * and matching between rows reduces the scores by a penalty which is
+ * large enough for some of them to reach zero */
+static int CheckMatchScores()
+{
+    int imgWidth = 128, rows = 16;
+    int thresholds[] = { -1, SVS_DESCRIPTOR_PIXELS / 8 };
+    int matches[2];
+    struct svs_context* ctx[2];
+    bool same = true;
+
+    for (int c = 0; c < 2; c++)
+    {
+        ctx[c] = svs_create(imgWidth, 4 + rows * SVS_VERTICAL_SAMPLING + 4, SVS_MAX_FEATURES);
+        ctx[c]->filter = SVS_FILTER_NONE;
+        ctx[c]->match_output = SVS_MATCHES_THRESHOLD;
+        ctx[c]->match_threshold = 0;
+        ctx[c]->match_rows = 1;
+        ctx[c]->row_penalty = 2000;
+        RandomFeatures(ctx[c], rows, 21, 5);
+    }
+    ctx[0]->simd = SVS_SIMD_NONE;
+
+    /* a disparity of up to 40% of the width, so that the weighted
+     * disparities of negative matches are close to the penalty.  With
+     * no descriptor threshold every feature within range is scored,
+     * while the other threshold rejects some of them but leaves matches
+     * at every descriptor width */
+    for (int t = 0; t < 2; t++)
+    {
+        for (int c = 0; c < 2; c++)
+            matches[c] = svs_match(ctx[c], 0, 40, thresholds[t], 7, 3, 30);
+
+        if ((matches[0] == 0) || (matches[0] != matches[1]) ||
+                (memcmp(ctx[0]->svs_matches, ctx[1]->svs_matches, matches[0] * 4 * sizeof(unsigned int)) != 0))
+            same = false;
+    }
+
+    svs_free(ctx[0]);
+    svs_free(ctx[1]);
+    return(CheckResult("match scores: SIMD matches the scalar code", same));
+}
+
+/* Places features every 8 pixels along each row of the left camera, and
+ * the same features in the right camera at the given disparity, except
+ * for one feature on one row which is placed at another disparity.  The
+ * mean luminance of each feature differs from those of its neighbours,
+ * so that the features it is paired with are its best matches */
+static void ShiftedFeatures(
+    struct svs_context* ctx,
+    int rows,
+    int disp,
+    int moved_row,
+    int moved_feature,
+    int moved_disp)
+{
+    struct svs_data_struct* data[2] = { &ctx->svs_data, &ctx->svs_data_received };
+    int per_row = ((int)ctx->imgWidth - 16) / 8;
+
+    memset(ctx->svs_data.descriptor, 0, ctx->max_features * SVS_DESCRIPTOR_WORDS * sizeof(unsigned int));
+    memset(ctx->svs_data_received.descriptor, 0, ctx->max_features * SVS_DESCRIPTOR_WORDS * sizeof(unsigned int));
+    for (int cam = 0; cam < 2; cam++)
+    {
+        memset(data[cam]->features_per_row, 0, ctx->feature_rows * sizeof(unsigned short int));
+        for (int row = 0; row < rows; row++)
+        {
+            int f = row * per_row;
+            for (int i = 0; i < per_row; i++)
+            {
+                int x = (int)ctx->imgWidth - 16 - i*8;
+                if (cam == 1)
+                    x -= ((row == moved_row) && (i == moved_feature)) ? moved_disp : disp;
+                data[cam]->feature_x[f + i] = (short int)x;
+                data[cam]->mean[f + i] = (unsigned char)(20 + 45 * (i % 5));
+            }
+
+            /* features are stored in order of decreasing x */
+            for (int i = f + 1; i < f + per_row; i++)
+            {
+                for (int j = i; (j > f) && (data[cam]->feature_x[j] > data[cam]->feature_x[j-1]); j--)
+                {
+                    short int x = data[cam]->feature_x[j];
+                    unsigned char mean = data[cam]->mean[j];
+                    data[cam]->feature_x[j] = data[cam]->feature_x[j-1];
+                    data[cam]->mean[j] = data[cam]->mean[j-1];
+                    data[cam]->feature_x[j-1] = x;
+                    data[cam]->mean[j-1] = mean;
+                }
+            }
+            data[cam]->features_per_row[row] = (unsigned short int)per_row;
+        }
+    }
+}
+
+/* Checks that in the temporal mode a feature whose disparity has moved
+ * beyond the range predicted from the previous frame is still matched,
+ * while the rest of its row is matched within the predicted range.  The
+ * features it could be paired with inside the predicted range are the
+ * best matches of other features, so the consistency check rejects them
+ * and the feature is searched for again over the full range */
+static int CheckTemporal()
+{
+    int imgWidth = 256, rows = 12, moved_row = 5, moved_feature = 10;
+    struct svs_context* ctx = svs_create(imgWidth, 4 + rows * SVS_VERTICAL_SAMPLING + 4, SVS_MAX_FEATURES);
+    ctx->temporal = 1;
+    ctx->prior_keyframe = 0;
+    ctx->consistency = 1;
+    ctx->filter = SVS_FILTER_NONE;
+    ctx->match_output = SVS_MATCHES_THRESHOLD;
+    ctx->match_threshold = 0;
+
+    /* the first frame gives a predicted range around a disparity of 5 */
+    ShiftedFeatures(ctx, rows, 5, -1, -1, 0);
+    svs_match(ctx, 0, 40, -1, 0, 40, 1);
+
+    ShiftedFeatures(ctx, rows, 5, moved_row, moved_feature, 30);
+    int matches = svs_match(ctx, 0, 40, -1, 0, 40, 1);
+    int xL = ctx->svs_data.feature_x[moved_row * ((imgWidth - 16) / 8) + moved_feature];
+    bool moved = false, others = false;
+    for (int i = 0; i < matches; i++)
+    {
+        unsigned int* match = &ctx->svs_matches[i*4];
+        if ((int)match[2] != 4 + moved_row * SVS_VERTICAL_SAMPLING)
+            continue;
+        if (((int)match[1] == xL) && (match[3] == 30))
+            moved = true;
+        if (((int)match[1] != xL) && (match[3] == 5))
+            others = true;
+    }
+
+    svs_free(ctx);
+    return(CheckResult("temporal: feature beyond the predicted range", moved && others));
+}
+
+/* Checks that the histogram filter keeps only the matches close to the
+ * most common disparity within each zone of a grid, where each zone has
+ * a different one.  Each zone also holds many matches at zero disparity,
+ * so that it is classed as near, scattered matches, and matches whose
+ * disparities lie beyond the end of the histograms */
+static int CheckZoneFilter()
+{
+    int columns = 3, rows = 2, max_disp = 64, no_of_matches = 0;
+    struct svs_context* ctx = svs_create(CHECK_WIDTH, CHECK_HEIGHT, SVS_MAX_FEATURES);
+    bool* expected = new bool[SVS_MAX_FEATURES];
+    bool kept = true;
+
+    ctx->filter_grids = 1;
+    ctx->filter_grid[0] = columns;
+    ctx->filter_grid[1] = rows;
+
+    srand(6);
+    for (int zone = 0; zone < columns * rows; zone++)
+    {
+        int x0 = CHECK_WIDTH * (zone % columns) / columns + 1;
+        int x1 = CHECK_WIDTH * (zone % columns + 1) / columns;
+        int y0 = CHECK_HEIGHT * (zone / columns) / rows + 1;
+        int y1 = CHECK_HEIGHT * (zone / columns + 1) / rows;
+        int peak = 8 + zone * 9;
+        int disparities[116];
+        int n = 0;
+        for (int i = 0; i < 40; i++)
+            disparities[n++] = peak;
+        for (int i = 0; i < 3; i++)
+        {
+            disparities[n++] = peak - 1;
+            disparities[n++] = peak + 1;
+        }
+        for (int i = 0; i < 8; i++)
+            disparities[n++] = (peak + 6 + i * 6) % (max_disp - 6) + 3;
+        disparities[n++] = max_disp + 6;
+        disparities[n++] = CHECK_WIDTH + 100;
+        for (int i = 0; i < 60; i++)
+            disparities[n++] = 0;
+
+        for (int i = 0; i < n; i++)
+        {
+            unsigned int* match = &ctx->svs_matches[no_of_matches*4];
+            match[0] = 500;
+            match[1] = (unsigned int)(x0 + rand() % (x1 - x0));
+            match[2] = (unsigned int)(y0 + rand() % (y1 - y0));
+            match[3] = (unsigned int)disparities[i];
+            expected[no_of_matches] = (abs(disparities[i] - peak) <= 3);
+            no_of_matches++;
+        }
+    }
+
+    svs_filter(ctx, no_of_matches, max_disp, 3);
+    for (int i = 0; i < no_of_matches; i++)
+    {
+        if ((ctx->svs_matches[i*4] != 0) != expected[i])
+            kept = false;
+    }
+
+    delete[] expected;
+    svs_free(ctx);
+    return(CheckResult("zone filter: peak of each zone", kept));
+}
+
+/* Checks that the plane filter recovers a plane from matches of which
+ * 30% are outliers, keeping every match close to the plane, and only
+ * those outliers which happen to lie close to it */
+static int CheckPlanes()
+{
+    int max_disp = 64, tolerance = 3, no_of_matches = 1000;
+    float a = 0.05f, b = 0.1f, c = 10;
+    struct svs_context* ctx = svs_create(CHECK_WIDTH, CHECK_HEIGHT, SVS_MAX_FEATURES);
+    bool* inlier = new bool[no_of_matches];
+    bool recovered = true;
+
+    ctx->filter = SVS_FILTER_PLANES;
+    ctx->filter_planes = 1;
+
+    /* matches in order of increasing y, as returned by svs_match_row */
+    srand(7);
+    for (int i = 0; i < no_of_matches; i++)
+    {
+        unsigned int* match = &ctx->svs_matches[i*4];
+        int x = rand() % CHECK_WIDTH;
+        int y = i * CHECK_HEIGHT / no_of_matches;
+        int disp = (int)(a * x + b * y + c + 0.5f) + rand() % 3 - 1;
+        inlier[i] = (rand() % 10 >= 3);
+        if (!inlier[i])
+            disp = rand() % max_disp;
+        match[0] = 500;
+        match[1] = (unsigned int)x;
+        match[2] = (unsigned int)y;
+        match[3] = (unsigned int)disp;
+    }
+
+    svs_filter(ctx, no_of_matches, max_disp, tolerance);
+    for (int i = 0; i < no_of_matches; i++)
+    {
+        unsigned int* match = &ctx->svs_matches[i*4];
+        float r = a * match[1] + b * match[2] + c - match[3];
+        if ((inlier[i]) && (match[0] == 0))
+            recovered = false;
+        if ((match[0] != 0) && ((r > tolerance + 1) || (r < -tolerance - 1)))
+            recovered = false;
+    }
+
+    delete[] inlier;
+    svs_free(ctx);
+    return(CheckResult("planes: recovered with 30% outliers", recovered));
+}
+
+/* Checks that the SIMD count of the points close to a plane is the same
+ * as a count of each point in turn, for numbers of points which are not
+ * multiples of the SIMD width, and with points exactly at the tolerance */
+static int CheckPlaneInliers()
+{
+    bool same = true;
+#ifdef SVS_SIMD_X86
+    if (svs_simd_detect() == SVS_SIMD_AVX2)
+    {
+        int max_points = 45;
+        float plane[] = { 0.5f, 0.25f, 3 };
+        float tolerance = 3;
+        float* x = new float[max_points];
+        float* y = new float[max_points];
+        float* d = new float[max_points];
+
+        srand(8);
+        for (int n = 0; n <= max_points; n++)
+        {
+            int inliers = 0;
+            for (int k = 0; k < n; k++)
+            {
+                x[k] = (float)(rand() % CHECK_WIDTH);
+                y[k] = (float)(rand() % CHECK_HEIGHT);
+                d[k] = plane[0] * x[k] + plane[1] * y[k] + plane[2] + (float)(rand() % 17 - 8) * 0.5f;
+                float r = plane[0] * x[k] + plane[1] * y[k] + plane[2] - d[k];
+                if ((r <= tolerance) && (r >= -tolerance))
+                    inliers++;
+            }
+            if (svs_plane_inliers_avx2(x, y, d, n, plane, tolerance) != inliers)
+                same = false;
+        }
+
+        delete[] x;
+        delete[] y;
+        delete[] d;
+    }
+#endif
+    return(CheckResult("planes: SIMD inlier count", same));
+}
+
+/* matches passed to the quality function of svs_learn, copied for CheckLearn */
+struct LearntMatches
+{
+    unsigned int* matches;
+    int no_of_matches;
+};
+
+/* quality function which keeps a copy of the matches it is given */
+static float KeepMatches(
+    struct svs_context*,
+    const unsigned int* matches,
+    int no_of_matches,
+    int*,
+    void* arg)
+{
+    struct LearntMatches* learnt = (struct LearntMatches*)arg;
+    memcpy(learnt->matches, matches, no_of_matches * 4 * sizeof(unsigned int));
+    learnt->no_of_matches = no_of_matches;
+    return(1);
+}
+
+/* Checks that the matches which svs_learn evaluates for a combination of
+ * weights, found by scoring the terms of each possible match, are those
+ * which svs_match returns with the same weights, with the scalar and
+ * SIMD scoring, and with matches between rows scored with a penalty */
+static int CheckLearn(
+    unsigned char* left,
+    unsigned char* right)
+{
+    int weights[] = { 18, 7, 3 };
+    int filters[] = { SVS_FILTER_HISTOGRAM, SVS_FILTER_NONE };
+    struct svs_context* ctx = svs_create(CHECK_WIDTH, CHECK_HEIGHT, SVS_MAX_FEATURES);
+    struct svs_context* received = svs_create(CHECK_WIDTH, CHECK_HEIGHT, SVS_MAX_FEATURES);
+    struct LearntMatches learnt;
+    int learnt_weights[3];
+    bool same = true;
+
+    learnt.matches = new unsigned int[SVS_MAX_FEATURES * 4];
+    svs_get_features(ctx, left, CHECK_RADIUS, CHECK_RESPONSE, 0, 0);
+    svs_get_features(received, right, CHECK_RADIUS, CHECK_RESPONSE, 0, 0);
+    svs_receive(ctx, &received->svs_data);
+    ctx->match_rows = 1;
+
+    for (int simd = SVS_SIMD_NONE; simd <= svs_simd_detect(); simd++)
+    {
+        for (int f = 0; f < 2; f++)
+        {
+            ctx->simd = simd;
+            ctx->filter = filters[f];
+            learnt.no_of_matches = 0;
+            svs_learn(ctx, 200, 20, 2, weights, weights, 0, 1, KeepMatches, &learnt, learnt_weights);
+            int matches = svs_match(ctx, 200, 20, 2, weights[0], weights[1], weights[2]);
+            if ((matches == 0) || (matches != learnt.no_of_matches) ||
+                    (memcmp(ctx->svs_matches, learnt.matches, matches * 4 * sizeof(unsigned int)) != 0))
+                same = false;
+        }
+    }
+
+    delete[] learnt.matches;
+    svs_free(ctx);
+    svs_free(received);
+    return(CheckResult("learn: same matches as svs_match", same));
+}
+
+/* counts the pairs of matches which cross by comparing every pair */
+static long long CountCrossings(
+    struct svs_context* ctx,
+    const unsigned int* matches,
+    int no_of_matches)
+{
+    int scale = ctx->subpixel ? SVS_SUBPIXEL : 1;
+    long long crossings = 0;
+    for (int i = 0; i < no_of_matches; i++)
+    {
+        for (int j = i + 1; j < no_of_matches; j++)
+        {
+            long long left = (long long)matches[i*4 + 1] * scale - (long long)matches[j*4 + 1] * scale;
+            long long right = left - (long long)matches[i*4 + 3] + (long long)matches[j*4 + 3];
+            if (((left < 0) && (right > 0)) || ((left > 0) && (right < 0)))
+                crossings++;
+        }
+    }
+    return(crossings);
+}
+
+/* Checks svs_crossings against a count of every pair, on random matches,
+ * on matches with many equal positions, and where only the last match
+ * crosses the others */
+static int CheckCrossings()
+{
+    int failures = 0;
+    int max_matches = 100;
+    struct svs_context* ctx = svs_create(CHECK_WIDTH, CHECK_HEIGHT, SVS_MAX_FEATURES);
+    unsigned int* matches = new unsigned int[max_matches * 4];
+    int* pairs = new int[SVS_CROSSINGS_BUFFER(max_matches)];
+    bool random = true, tied = true;
+
+    srand(1);
+    for (int trial = 0; trial < 200; trial++)
+    {
+        ctx->subpixel = trial & 1;
+        int scale = ctx->subpixel ? SVS_SUBPIXEL : 1;
+        int range = (trial < 100) ? CHECK_WIDTH : 4;
+        int no_of_matches = trial % max_matches + 1;
+        for (int i = 0; i < no_of_matches; i++)
+        {
+            matches[i*4] = 1 + rand() % 1000;
+            matches[i*4 + 1] = rand() % range;
+            matches[i*4 + 2] = rand() % CHECK_HEIGHT;
+            matches[i*4 + 3] = rand() % (range * scale / 4 + 1);
+        }
+        if (svs_crossings(ctx, matches, no_of_matches, pairs) != CountCrossings(ctx, matches, no_of_matches))
+        {
+            if (trial < 100)
+                random = false;
+            else
+                tied = false;
+        }
+    }
+    failures += CheckResult("crossings: random matches", random);
+    failures += CheckResult("crossings: equal positions", tied);
+
+    /* matches along a line at zero disparity, crossed by the last,
+     * which shares its right image position with the first */
+    ctx->subpixel = 0;
+    int no_of_matches = 10;
+    for (int i = 0; i < no_of_matches; i++)
+    {
+        matches[i*4] = 1;
+        matches[i*4 + 1] = i * 10 + 5;
+        matches[i*4 + 2] = 4;
+        matches[i*4 + 3] = 0;
+    }
+    matches[(no_of_matches - 1)*4 + 3] = (no_of_matches - 1) * 10;
+    failures += CheckResult("crossings: last match",
+                            (svs_crossings(ctx, matches, no_of_matches, pairs) == no_of_matches - 2) &&
+                            (CountCrossings(ctx, matches, no_of_matches) == no_of_matches - 2));
+
+    delete[] matches;
+    delete[] pairs;
+    svs_free(ctx);
+    return(failures);
+}
+
+/* Sets a rectification map for the context, either leaving every pixel
+ * in place, or scaling the image radially about its centre and rotating
+ * it slightly, so that positions have fractional parts and some lie
+ * outside of the image */
+static void SetRectifyMap(
+    struct svs_context* ctx,
+    bool identity)
+{
+    int width = (int)ctx->imgWidth;
+    int height = (int)ctx->imgHeight;
+    int* source_x = new int[width];
+    int* source_y = new int[width];
+    float cx = width * 0.5f, cy = height * 0.5f;
+    float cos_angle = 0.9994f, sin_angle = 0.0349f;
+
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            if (identity)
+            {
+                source_x[x] = x * SVS_RECTIFY_SCALE;
+                source_y[x] = y * SVS_RECTIFY_SCALE;
+                continue;
+            }
+            float dx = x - cx, dy = y - cy;
+            float scale = 1.0f + 0.3f * (dx*dx + dy*dy) / (cx*cx + cy*cy);
+            source_x[x] = (int)((cx + scale * (dx * cos_angle - dy * sin_angle)) * SVS_RECTIFY_SCALE);
+            source_y[x] = (int)((cy + scale * (dx * sin_angle + dy * cos_angle)) * SVS_RECTIFY_SCALE);
+        }
+        svs_rectify_row(ctx, y, source_x, source_y);
+    }
+    delete[] source_x;
+    delete[] source_y;
+}
+
+/* Checks that each SIMD kernel used by svs_rectify gives the same image
+ * as the scalar code with both interpolations and every image format,
+ * and that a map which leaves every pixel in place copies the raw image */
+static int CheckRectify(
+    unsigned char* img)
+{
+    int failures = 0;
+    int simd_levels = svs_simd_detect() + 1;
+    int formats[] = { SVS_FORMAT_RGB, SVS_FORMAT_LUMA8, SVS_FORMAT_LUMA16 };
+    int bytes[] = { 3, 1, 2 };
+    int image_bytes = CHECK_WIDTH * CHECK_HEIGHT * 3;
+    unsigned char* raw = new unsigned char[image_bytes];
+    unsigned char* scalar = new unsigned char[image_bytes];
+    unsigned char* rectified = new unsigned char[image_bytes];
+    struct svs_context* ctx = svs_create(CHECK_WIDTH, CHECK_HEIGHT, SVS_MAX_FEATURES);
+    bool same = true, unchanged = true;
+
+    for (int f = 0; f < 3; f++)
+    {
+        int frame_bytes = CHECK_WIDTH * CHECK_HEIGHT * bytes[f];
+        ctx->format = formats[f];
+        if (formats[f] == SVS_FORMAT_RGB)
+            memcpy(raw, img, frame_bytes);
+        else
+            svs_luma(ctx, img, 3, raw);
+
+        for (int interpolation = SVS_RECTIFY_NEAREST; interpolation <= SVS_RECTIFY_BILINEAR; interpolation++)
+        {
+            ctx->interpolation = interpolation;
+
+            SetRectifyMap(ctx, false);
+            ctx->simd = SVS_SIMD_NONE;
+            svs_rectify(ctx, raw, scalar);
+            for (int simd = SVS_SIMD_NONE + 1; simd < simd_levels; simd++)
+            {
+                ctx->simd = simd;
+                svs_rectify(ctx, raw, rectified);
+                if (memcmp(scalar, rectified, frame_bytes) != 0)
+                    same = false;
+            }
+
+            SetRectifyMap(ctx, true);
+            for (int simd = SVS_SIMD_NONE; simd < simd_levels; simd++)
+            {
+                ctx->simd = simd;
+                svs_rectify(ctx, raw, rectified);
+                if (memcmp(raw, rectified, frame_bytes) != 0)
+                    unchanged = false;
+            }
+        }
+    }
+    failures += CheckResult("rectify: SIMD kernels match the scalar code", same);
+    failures += CheckResult("rectify: identity map leaves images unchanged", unchanged);
+
+    svs_free(ctx);
+    delete[] raw;
+    delete[] scalar;
+    delete[] rectified;
+    return(failures);
+}
+
+/* Checks that the features found by svs_get_features when it rectifies
+ * the rows it needs into its rolling buffer (see rectify_rows) are the
+ * same as those found within the image rectified by svs_rectify, with
+ * both interpolations, every image format and SIMD level, and with one
+ * thread or several, each of which has its own rolling buffer */
+static int CheckRectifyRows(
+    unsigned char* img)
+{
+    int simd_levels = svs_simd_detect() + 1;
+    int formats[] = { SVS_FORMAT_RGB, SVS_FORMAT_LUMA8, SVS_FORMAT_LUMA16 };
+    int image_bytes = CHECK_WIDTH * CHECK_HEIGHT * 3;
+    unsigned char* raw = new unsigned char[image_bytes];
+    unsigned char* rectified = new unsigned char[image_bytes];
+    bool same = true;
+
+    for (int threads = 1; threads <= 4; threads += 3)
+    {
+        struct svs_context* whole = svs_create(CHECK_WIDTH, CHECK_HEIGHT, SVS_MAX_FEATURES);
+        struct svs_context* rows = svs_create(CHECK_WIDTH, CHECK_HEIGHT, SVS_MAX_FEATURES);
+        whole->threads = threads;
+        rows->threads = threads;
+        rows->rectify_rows = 1;
+        SetRectifyMap(whole, false);
+        SetRectifyMap(rows, false);
+
+        for (int f = 0; f < 3; f++)
+        {
+            whole->format = formats[f];
+            rows->format = formats[f];
+            if (formats[f] == SVS_FORMAT_RGB)
+                memcpy(raw, img, image_bytes);
+            else
+                svs_luma(whole, img, 3, raw);
+
+            for (int interpolation = SVS_RECTIFY_NEAREST; interpolation <= SVS_RECTIFY_BILINEAR; interpolation++)
+            {
+                whole->interpolation = interpolation;
+                rows->interpolation = interpolation;
+                for (int simd = SVS_SIMD_NONE; simd < simd_levels; simd++)
+                {
+                    whole->simd = simd;
+                    rows->simd = simd;
+                    svs_rectify(whole, raw, rectified);
+                    if (!SameDetection(whole, rectified, rows, raw, true))
+                        same = false;
+                }
+            }
+        }
+
+        svs_free(whole);
+        svs_free(rows);
+    }
+
+    delete[] raw;
+    delete[] rectified;
+    return(CheckResult("rectify: rolling buffer matches the whole image", same));
+}
+
+/* Checks that the maps built from a calibration saved by stereoserver
+ * are the same after being saved to a cache file and mapped back in by
+ * svs_calibration_cache, and that the map of the right camera remains
+ * usable once the left camera, which shares its mapping, is freed */
+static int CheckCalibrationCache(
+    const char* filename)
+{
+    const char* cache_filename = "check_calibration.map";
+    const char* name = strrchr(filename, '/');
+    char description[256];
+    struct svs_calibration calib;
+    bool same = false;
+
+    if (svs_calibration_load(&calib, filename) == 0)
+    {
+        struct svs_context* left = svs_create(calib.image_width, calib.image_height, SVS_MAX_FEATURES);
+        struct svs_context* right = svs_create(calib.image_width, calib.image_height, SVS_MAX_FEATURES);
+        struct svs_context* cached_left = svs_create(calib.image_width, calib.image_height, SVS_MAX_FEATURES);
+        struct svs_context* cached_right = svs_create(calib.image_width, calib.image_height, SVS_MAX_FEATURES);
+        size_t map_bytes = calib.image_width * calib.image_height * 2 * sizeof(short int);
+
+        svs_calibration_maps(&calib, left, right);
+        if ((svs_calibration_save(&calib, left, right, cache_filename) == 0) &&
+                (svs_calibration_cache(&calib, cached_left, cached_right, cache_filename) == 0))
+        {
+            same = (memcmp(left->rectify_map, cached_left->rectify_map, map_bytes) == 0);
+            svs_free(cached_left);
+            cached_left = NULL;
+            if (memcmp(right->rectify_map, cached_right->rectify_map, map_bytes) != 0)
+                same = false;
+        }
+        remove(cache_filename);
+
+        svs_free(left);
+        svs_free(right);
+        if (cached_left != NULL)
+            svs_free(cached_left);
+        svs_free(cached_right);
+    }
+
+    sprintf(description, "calibration: cached maps of %.20s", (name != NULL) ? name + 1 : filename);
+    return(CheckResult(description, same));
+}
+
+/* Runs every check upon synthetic images, and upon the calibrations saved
+ * by stereoserver in the given files, printing the result of each, and
+ * returns the number of checks which failed */
+int RunChecks(
+    int no_of_calibrations,
+    char** calibration_filenames)
+{
+    int failures = 0;
+    int image_bytes = CHECK_WIDTH * CHECK_HEIGHT * 3;
+    unsigned char* left = new unsigned char[image_bytes];
+    unsigned char* right = new unsigned char[image_bytes];
+
+    SyntheticImage(left, CHECK_WIDTH, CHECK_HEIGHT, 1);
+    SyntheticImage(right, CHECK_WIDTH, CHECK_HEIGHT, 2);
+    SyntheticPair(left, right, CHECK_WIDTH, CHECK_HEIGHT);
+
+    failures += CheckRowSums();
+    failures += CheckNonMax();
+    failures += CheckDescriptors(left);
+    failures += CheckThreads(left, right);
+    failures += CheckFeatureBudget(left);
+    failures += CheckSubpixel(left);
+    failures += CheckScanline();
+    failures += CheckMatchScores();
+    failures += CheckTemporal();
+    failures += CheckZoneFilter();
+    failures += CheckPlanes();
+    failures += CheckPlaneInliers();
+    failures += CheckLearn(left, right);
+    failures += CheckCrossings();
+    failures += CheckRectify(left);
+    failures += CheckRectifyRows(left);
+    for (int i = 0; i < no_of_calibrations; i++)
+        failures += CheckCalibrationCache(calibration_filenames[i]);
+
+    printf("%d checks failed\n", failures);
+    delete[] left;
+    delete[] right;
+    return(failures);
+}
@@ -16,89 +16,31 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
 #include "stereo.h"
 #include "bitmap.h"
 #include "fileio.h"
 #include "drawing.h"
-
-unsigned int imgWidth = 320;
-unsigned int imgHeight = 240;
-
-/* Two structures are created:
- * SVS_data stores features obtained from this camera
- * SVS_data_received stores features received from the opposite camera */
-struct SVS_data_struct
-{
-
-    /* array storing x coordinates of detected features */
-    short int feature_x[SVS_MAX_FEATURES];
-
-    /* array storing the number of features detected on each row */
-    unsigned short int features_per_row[SVS_MAX_IMAGE_HEIGHT/SVS_VERTICAL_SAMPLING];
-
-    /* Array storing a binary descriptor, 32bits in length, for each detected feature.
-     * This will be used for matching purposes.*/
-    unsigned int descriptor[SVS_MAX_FEATURES];
-
-    /* mean luminance for each feature */
-    unsigned char mean[SVS_MAX_FEATURES];
-
-}
-svs_data, svs_data_received;
-
-/* buffer which stores sliding sum */
-int row_sum[SVS_MAX_IMAGE_WIDTH];
-
-/* peaks along the row */
-unsigned int row_peaks[SVS_MAX_IMAGE_WIDTH];
-
-/* array stores matching probabilities */
-unsigned int svs_matches[SVS_MAX_FEATURES*4];
-
-/* used during filtering */
-unsigned char valid_quadrants[SVS_MAX_IMAGE_WIDTH];
-
-/* array used to store a disparity histogram */
-int disparity_histogram[SVS_MAX_IMAGE_WIDTH];
-
-/* maps raw image pixels to rectified pixels */
-int calibration_map[SVS_MAX_IMAGE_WIDTH*SVS_MAX_IMAGE_HEIGHT];
-
-/* copy the data from one structure to the other */
-void copy_to_received()
-{
-    memcpy(svs_data_received.feature_x, svs_data.feature_x, SVS_MAX_FEATURES * sizeof(short int));
-    memcpy(svs_data_received.features_per_row, svs_data.features_per_row, (SVS_MAX_IMAGE_HEIGHT/SVS_VERTICAL_SAMPLING) * sizeof(unsigned short int));
-    memcpy(svs_data_received.descriptor, svs_data.descriptor, SVS_MAX_FEATURES * sizeof(unsigned int));
-    memcpy(svs_data_received.mean, svs_data.mean, SVS_MAX_FEATURES * sizeof(unsigned char));
-}
+#include "checks.h"
 
 /* draw a binary patch descriptor */
 void draw_descriptor(
+    struct svs_context* ctx,
     int px,
     int py,
     int descriptor_index,
     unsigned char* rectified_frame_buf)
 {
 
-    int i, idx, bit = 1;
-    unsigned int desc;
+    int i, idx;
+    unsigned int* desc;
 
-    /* offsets of pixels to be compared within the patch region
-     * arranged into a rectangular structure */
-    const int pixel_offsets[] =
-        {
-            -2,-4,  -1,-4,         1,-4,  2,-4,
-            -5,-2,  -4,-2,  -3,-2,  -2,-2,  -1,-2,  0,-2,  1,-2,  2,-2,  3,-2,  4,-2,  5,-2,
-            -5, 2,  -4, 2,  -3, 2,  -2, 2,  -1, 2,  0, 2,  1, 2,  2, 2,  3, 2,  4, 2,  5, 2,
-            -2, 4,  -1, 4,         1, 4,  2, 4
-        };
-
-    desc = svs_data.descriptor[descriptor_index];
-    for (i = 0; i < SVS_DESCRIPTOR_PIXELS; i++, bit *= 2)
+    desc = &ctx->svs_data.descriptor[descriptor_index*SVS_DESCRIPTOR_WORDS];
+    for (i = 0; i < SVS_DESCRIPTOR_PIXELS; i++)
     {
-        idx = pixindex((px + pixel_offsets[i*2]), (py + pixel_offsets[i*2+1]));
-        if (desc & bit)
+        idx = pixindex((px + ctx->descriptor_pattern[i*2]), (py + ctx->descriptor_pattern[i*2+1]), ctx->imgWidth);
+        if (desc[i / 32] & (1u << (i % 32)))
         {
             rectified_frame_buf[idx] = 0;
             rectified_frame_buf[idx + 1] = 255;
@@ -118,170 +60,46 @@ void draw_descriptor(
 /*---------------------------------------------------------------------*/
 
 
-/*!
- * \brief does the line intersect with the given line?
- * \param x0 first line top x
- * \param y0 first line top y
- * \param x1 first line bottom x
- * \param y1 first line bottom y
- * \param x2 second line top x
- * \param y2 second line top y
- * \param x3 second line bottom x
- * \param y3 second line bottom y
- * \param xi intersection x coordinate
- * \param yi intersection y coordinate
- * \return true if the lines intersect
- */
-bool intersection(
-    float x0,
-    float y0,
-    float x1,
-    float y1,
-    float x2,
-    float y2,
-    float x3,
-    float y3,
-    float& xi,
-    float& yi)
+/* returns the disparity of a match in whole pixels */
+static int match_disparity(
+    struct svs_context* ctx,
+    const unsigned int* matches,
+    int i)
 {
-    float a1, b1, c1,         //constants of linear equations
-    a2, b2, c2,
-    det_inv,            //the inverse of the determinant of the coefficient
-    m1, m2, dm;         //the gradients of each line
-    bool insideLine = false;  //is the intersection along the lines given, or outside them
-    float tx, ty, bx, by;
-
-    //compute gradients, note the cludge for infinity, however, this will
-    //be close enough
-    if ((x1 - x0) != 0)
-        m1 = (y1 - y0) / (x1 - x0);
-    else
-        m1 = (float)1e+10;   //close, but no cigar
-
-    if ((x3 - x2) != 0)
-        m2 = (y3 - y2) / (x3 - x2);
-    else
-        m2 = (float)1e+10;   //close, but no cigar
-
-    dm = (float)ABS(m1 - m2);
-    if (dm > 0.000001f)
-    {
-        //compute constants
-        a1 = m1;
-        a2 = m2;
-
-        b1 = -1;
-        b2 = -1;
-
-        c1 = (y0 - m1 * x0);
-        c2 = (y2 - m2 * x2);
-
-        //compute the inverse of the determinate
-        det_inv = 1 / (a1 * b2 - a2 * b1);
-
-        //use Kramers rule to compute xi and yi
-        xi = ((b1 * c2 - b2 * c1) * det_inv);
-        yi = ((a2 * c1 - a1 * c2) * det_inv);
-
-        //is the intersection inside the line or outside it?
-        if (x0 < x1)
-        {
-            tx = x0;
-            bx = x1;
-        }
-        else
-        {
-            tx = x1;
-            bx = x0;
-        }
-        if (y0 < y1)
-        {
-            ty = y0;
-            by = y1;
-        }
-        else
-        {
-            ty = y1;
-            by = y0;
-        }
-        if ((xi >= tx) && (xi <= bx) && (yi >= ty) && (yi <= by))
-        {
-            if (x2 < x3)
-            {
-                tx = x2;
-                bx = x3;
-            }
-            else
-            {
-                tx = x3;
-                bx = x2;
-            }
-            if (y2 < y3)
-            {
-                ty = y2;
-                by = y3;
-            }
-            else
-            {
-                ty = y3;
-                by = y2;
-            }
-            if ((xi >= tx) && (xi <= bx) && (yi >= ty) && (yi <= by))
-            {
-                insideLine = true;
-            }
-        }
-    }
-    else
-    {
-        //parallel (or parallelish) lines, return some indicative value
-        xi = 9999;
-    }
-
-    return (insideLine);
+    int disp = matches[i*4 + 3];
+    if (ctx->subpixel)
+        disp = (disp + SVS_SUBPIXEL/2) / SVS_SUBPIXEL;
+    return(disp);
 }
 
-/* returns an estimate of stereo matching quality by
- * counting the number of intersections */
+/* returns an estimate of stereo matching quality from
+ * the number of pairs of matches which cross */
 float EstimateMatchingQuality(
-    int calibration_offset_x,
-    int calibration_offset_y,
-    int no_of_matches)
+    struct svs_context* ctx,
+    const unsigned int* matches,
+    int no_of_matches,
+    int* pairs)
 {
+    long long crossings = svs_crossings(ctx, matches, no_of_matches, pairs);
 
-    int intersections = 0;
-
-    for (int i = 0; i < no_of_matches-1; i++)
-    {
-        int x0 = svs_matches[i*4 + 1];
-        int y0 = svs_matches[i*4 + 2];
-        int disp = svs_matches[i*4 + 3];
-        int x1 = (x0 - disp) - (calibration_offset_x*2);
-        int y1 = imgHeight + y0 - (calibration_offset_y*2);
-
-        for (int j = i + 1; j < no_of_matches-1; j++)
-        {
-            int x2 = svs_matches[j*4 + 1];
-            int y2 = svs_matches[j*4 + 2];
-            disp = svs_matches[j*4 + 3];
-            int x3 = (x2 - disp) - (calibration_offset_x*2);
-            int y3 = imgHeight + y2 - (calibration_offset_y*2);
-
-            float ix = 0;
-            float iy = 0;
-            if (intersection(x0,y0,x1,y1,x2,y2,x3,y3,ix,iy))
-            {
-                intersections++;
-            }
-        }
-    }
+    return(1.0f / (1.0f + ((float)crossings/(float)no_of_matches)));
+}
 
-    return(1.0f / (1.0f + ((float)intersections/(float)no_of_matches)));
+/* quality function used by svs_learn, which needs no argument */
+static float LearnQuality(
+    struct svs_context* ctx,
+    const unsigned int* matches,
+    int no_of_matches,
+    int* pairs,
+    void*)
+{
+    return(EstimateMatchingQuality(ctx, matches, no_of_matches, pairs));
 }
 
+/* searches for the matching weights giving the fewest crossed matches,
+ * using every core of the machine */
 void LearnMatchingWeights(
-    int calibration_offset_x,
-    int calibration_offset_y,
+    struct svs_context* ctx,
     int minimum_matches)
 {
 
@@ -289,70 +107,105 @@ void LearnMatchingWeights(
     int max_disparity_percent = 20;
     int descriptor_match_threshold = 0;//SVS_DESCRIPTOR_PIXELS * 10 / 100;
 
-    int learnDesc_min = 1;
-    int learnDesc_max = 20;
-    int learnLuma_min = 1;
-    int learnLuma_max = 10;
-    int learnDisp_min = 1;
-    int learnDisp_max = 10;
+    /* learnDesc, learnLuma and learnDisp */
+    int min_weights[] = { 1, 1, 1 };
+    int max_weights[] = { 20, 10, 10 };
+    int best_weights[3];
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = (cores > 1) ? (int)cores : 1;
+
+    svs_learn(
+        ctx,
+        ideal_no_of_matches,
+        max_disparity_percent,
+        descriptor_match_threshold,
+        min_weights,
+        max_weights,
+        minimum_matches,
+        threads,
+        LearnQuality,
+        NULL,
+        best_weights);
+
+    int learnDesc_best = best_weights[0];
+    int learnLuma_best = best_weights[1];
+    int learnDisp_best = best_weights[2];
 
-    float max_quality = 0;
-    int learnDesc_best = 1;
-    int learnLuma_best = 1;
-    int learnDisp_best = 1;
+    printf("-- Result --\n");
+    printf("learnDesc: %d\n", learnDesc_best);
+    printf("learnLuma: %d\n", learnLuma_best);
+    printf("learnDisp: %d\n", learnDisp_best);
+}
 
-    for (int learnDesc = learnDesc_min; learnDesc < learnDesc_max; learnDesc++)
-    {
 
-        for (int learnLuma = learnLuma_min; learnLuma < learnLuma_max; learnLuma++)
-        {
+/*---------------------------------------------------------------------*/
+/* benchmarks */
+/*---------------------------------------------------------------------*/
 
-            for (int learnDisp = learnDisp_min; learnDisp < learnDisp_max; learnDisp++)
-            {
+/* returns the current time in microseconds */
+double TimeMicroseconds()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return((double)tv.tv_sec * 1000000.0 + (double)tv.tv_usec);
+}
 
-                int matches = svs_match(
-                                  ideal_no_of_matches,
-                                  max_disparity_percent,
-                                  descriptor_match_threshold,
-                                  learnDesc,
-                                  learnLuma,
-                                  learnDisp);
+/* compares the time taken by each non-maximal suppression method, and
+ * by the window method without SIMD kernels, over all sampled rows of
+ * the given image, for a range of radii */
+void BenchmarkNonMax(
+    struct svs_context* ctx,
+    unsigned char* rectified_frame_buf,
+    unsigned int minimum_response,
+    int iterations)
+{
+    const char* method_name[] = { "scan", "window", "window (no SIMD)" };
+    int method_non_max[] = { SVS_NON_MAX_SCAN, SVS_NON_MAX_WINDOW, SVS_NON_MAX_WINDOW };
+    int method_simd[] = { ctx->simd, ctx->simd, SVS_SIMD_NONE };
+    int simd = ctx->simd;
+    unsigned int* row_peaks = new unsigned int[ctx->imgWidth];
+
+    printf("-- Non-maximal suppression (%d x %d) --\n", ctx->imgWidth, ctx->imgHeight);
+    for (int inhibition_radius = 4; inhibition_radius <= 32; inhibition_radius *= 2)
+    {
+        double elapsed[3] = { 0, 0, 0 };
+        for (int y = 4; y < (int)ctx->imgHeight - 4; y += SVS_VERTICAL_SAMPLING)
+        {
+            svs_update_sums(ctx, y, rectified_frame_buf);
+            memcpy(row_peaks, ctx->row_peaks, ctx->imgWidth * sizeof(unsigned int));
 
-                if (matches > minimum_matches)
+            for (int method = 0; method < 3; method++)
+            {
+                ctx->non_max = method_non_max[method];
+                ctx->simd = method_simd[method];
+                double t = TimeMicroseconds();
+                for (int i = 0; i < iterations; i++)
                 {
-                    float quality = EstimateMatchingQuality(
-                                        calibration_offset_x,
-                                        calibration_offset_y,
-                                        matches);
-
-                    if (quality > max_quality)
-                    {
-                        max_quality = quality;
-                        learnDesc_best = learnDesc;
-                        learnLuma_best = learnLuma;
-                        learnDisp_best = learnDisp;
-                    }
+                    memcpy(ctx->row_peaks, row_peaks, ctx->imgWidth * sizeof(unsigned int));
+                    svs_non_max(ctx, inhibition_radius, minimum_response);
                 }
+                elapsed[method] += TimeMicroseconds() - t;
             }
         }
+        for (int method = 0; method < 3; method++)
+        {
+            printf("radius %2d  %-16s  %8.1f uS per frame\n",
+                   inhibition_radius, method_name[method], elapsed[method] / iterations);
+        }
     }
-
-    printf("-- Result --\n");
-    printf("learnDesc: %d\n", learnDesc_best);
-    printf("learnLuma: %d\n", learnLuma_best);
-    printf("learnDisp: %d\n", learnDisp_best);
+    ctx->non_max = SVS_NON_MAX_SCAN;
+    ctx->simd = simd;
+    delete[] row_peaks;
 }
 
-
 /*---------------------------------------------------------------------*/
 /* main */
 /*---------------------------------------------------------------------*/
 
-int main()
+int main(int argc, char* argv[])
 {
 
-    printf("frame size %d bytes\n", sizeof(svs_data));
-
     bool show_descriptors = false;
     std::string left_image_filename = "left6.bmp";
     std::string right_image_filename = "right6.bmp";
@@ -369,6 +222,42 @@ int main()
     int calibration_offset_y = -4; //6;
     int inhibition_radius = 16;
     unsigned int minimum_response = 180;
+    int max_features = SVS_MAX_FEATURES;
+
+    /* format of the images used for feature detection.  The luma
+     * formats convert each frame to a single channel on arrival */
+    int image_format = SVS_FORMAT_RGB;
+
+    /* non-maximal suppression method */
+    int non_max = SVS_NON_MAX_SCAN;
+    bool benchmark = false;
+
+    /* number of threads used for feature detection */
+    int threads = 1;
+
+    /* refine feature positions to a fraction of a pixel */
+    bool subpixel = false;
+
+    /* only keep matches which are consistent in both directions */
+    bool consistency = false;
+
+    /* method used to choose between possible matches */
+    int matcher = SVS_MATCHER_GREEDY;
+
+    /* filter used to remove noisy matches */
+    int filter = SVS_FILTER_HISTOGRAM;
+
+    /* sampled rows above and below to search for matches */
+    int match_rows = 0;
+
+    /* desired number of features per image, or zero to use
+     * a fixed minimum response */
+    int target_features = 0;
+
+    /* calibration saved by stereoserver, used to rectify the images
+     * when it exists, and the cache of the maps built from it */
+    std::string calibration_filename = "calibration.xml";
+    std::string calibration_cache_filename = "calibration.map";
 
     /* matching params */
     int ideal_no_of_matches = 200;
@@ -378,6 +267,19 @@ int main()
     int learnLuma = 7; //4;
     int learnDisp = 3; //7;
 
+    /* -check checks that optional modes and SIMD kernels give the
+     * results they should on synthetic images, and that the maps of any
+     * calibration files following it survive being cached, rather than
+     * processing the images, and returns non-zero if any check fails.
+     * -benchmark times each non-maximal suppression method on the images */
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-check") == 0)
+            return((RunChecks(argc - i - 1, &argv[i + 1]) == 0) ? 0 : 1);
+        if (strcmp(argv[i], "-benchmark") == 0)
+            benchmark = true;
+    }
+
     if ((fileio::FileExists(left_image_filename)) &&
             (fileio::FileExists(right_image_filename)))
     {
@@ -387,7 +289,66 @@ int main()
         Bitmap* bmp_right = new Bitmap();
         bmp_right->FromFile(right_image_filename);
 
+        unsigned int imgWidth = bmp_left->Width;
+        unsigned int imgHeight = bmp_left->Height;
+
+        /* one context for each camera */
+        struct svs_context* svs_ctx[2];
+        svs_ctx[0] = svs_create(bmp_left->Width, bmp_left->Height, max_features);
+        svs_ctx[1] = svs_create(bmp_right->Width, bmp_right->Height, max_features);
+        if ((svs_ctx[0] == NULL) || (svs_ctx[1] == NULL))
+        {
+            printf("Unable to allocate stereo buffers\n");
+            return(-1);
+        }
+        printf("frame size %d bytes\n", svs_data_size(svs_ctx[0]));
+        svs_ctx[0]->format = image_format;
+        svs_ctx[1]->format = image_format;
+        svs_ctx[0]->non_max = non_max;
+        svs_ctx[1]->non_max = non_max;
+        svs_ctx[0]->threads = threads;
+        svs_ctx[1]->threads = threads;
+        svs_ctx[0]->target_features = target_features;
+        svs_ctx[1]->target_features = target_features;
+        svs_ctx[0]->subpixel = subpixel;
+        svs_ctx[1]->subpixel = subpixel;
+        svs_ctx[0]->consistency = consistency;
+        svs_ctx[0]->matcher = matcher;
+        svs_ctx[0]->filter = filter;
+        svs_ctx[0]->match_rows = match_rows;
+
+        if (fileio::FileExists(calibration_filename))
+        {
+            struct svs_calibration calibration;
+            if (svs_calibrate(&calibration, svs_ctx[0], svs_ctx[1],
+                              calibration_filename.c_str(),
+                              calibration_cache_filename.c_str()) == 0)
+            {
+                /* the bitmaps are rectified as RGB, whichever
+                 * format is used for feature detection */
+                unsigned char* raw_image = new unsigned char[imgWidth * imgHeight * 3];
+                for (cam = 0; cam < 2; cam++)
+                {
+                    Bitmap* bmp = (cam == 0) ? bmp_left : bmp_right;
+                    memcpy(raw_image, bmp->Data, imgWidth * imgHeight * 3);
+                    svs_ctx[cam]->format = SVS_FORMAT_RGB;
+                    svs_rectify(svs_ctx[cam], raw_image, bmp->Data);
+                    svs_ctx[cam]->format = image_format;
+                }
+                delete[] raw_image;
+
+                /* offsets of the right image, as uploaded to the SVS */
+                calibration_offset_x = -(int)calibration.offset_x;
+                calibration_offset_y = (int)calibration.offset_y;
+            }
+            else
+            {
+                printf("Unable to load calibration %s\n", calibration_filename.c_str());
+            }
+        }
+
         unsigned char* rectified_frame_buf;
+        unsigned char* luma_buf = new unsigned char[imgWidth * imgHeight * 2];
         unsigned char* img_matches = new unsigned char[imgWidth * imgHeight * 3];
         unsigned char* img_matches_two_images = new unsigned char[imgWidth * imgHeight * 2 * 3];
 
@@ -402,21 +363,29 @@ int main()
         for (cam = 1; cam >= 0; cam--)
         {
 
+            struct svs_context* ctx = svs_ctx[cam];
+
             if (cam == 0)
-            {
                 rectified_frame_buf = bmp_left->Data;
-                imgWidth = bmp_left->Width;
-                imgHeight = bmp_left->Height;
-            }
             else
-            {
                 rectified_frame_buf = bmp_right->Data;
-                imgWidth = bmp_right->Width;
-                imgHeight = bmp_right->Height;
+
+            unsigned char* detection_buf = rectified_frame_buf;
+            if (image_format != SVS_FORMAT_RGB)
+            {
+                svs_luma(ctx, rectified_frame_buf, 3, luma_buf);
+                detection_buf = luma_buf;
+            }
+
+            if (benchmark)
+            {
+                BenchmarkNonMax(ctx, detection_buf, minimum_response, 10);
+                ctx->non_max = non_max;
             }
 
             no_of_feats = svs_get_features(
-                              rectified_frame_buf,
+                              ctx,
+                              detection_buf,
                               inhibition_radius,
                               minimum_response,
                               calib_offset_x,
@@ -424,24 +393,22 @@ int main()
 
             printf("cam %d:  %d\n", cam, no_of_feats);
 
-            if (cam == 1)
-                copy_to_received();
-            else
+            if (cam == 0)
                 memcpy(img_matches, rectified_frame_buf, imgWidth*imgHeight*3*sizeof(unsigned char));
 
             /* display the features */
             int row = 0;
-            int feats_remaining = svs_data.features_per_row[row];
+            int feats_remaining = ctx->svs_data.features_per_row[row];
 
             for (int f = 0; f < no_of_feats; f++, feats_remaining--)
             {
 
-                int x = (int)svs_data.feature_x[f] - calib_offset_x;
+                int x = (int)ctx->svs_data.feature_x[f] - calib_offset_x;
                 int y = 4 + (row * SVS_VERTICAL_SAMPLING) + calib_offset_y;
 
                 if (show_descriptors)
                 {
-                    draw_descriptor(x, y, f, rectified_frame_buf);
+                    draw_descriptor(ctx, x, y, f, rectified_frame_buf);
                 }
                 else
                 {
@@ -452,7 +419,7 @@ int main()
                 if (feats_remaining <= 0)
                 {
                     row++;
-                    feats_remaining = svs_data.features_per_row[row];
+                    feats_remaining = ctx->svs_data.features_per_row[row];
                 }
             }
 
@@ -463,9 +430,13 @@ int main()
         bmp_left->SavePPM(left_features_filename.c_str());
         bmp_right->SavePPM(right_features_filename.c_str());
 
-        //LearnMatchingWeights(calibration_offset_x, calibration_offset_y, 100);
+        /* matching is performed on the left camera */
+        svs_receive(svs_ctx[0], &svs_ctx[1]->svs_data);
+
+        //LearnMatchingWeights(svs_ctx[0], 100);
 
         int matches = svs_match(
+                          svs_ctx[0],
                           ideal_no_of_matches,
                           max_disparity_percent,
                           descriptor_match_threshold,
@@ -477,16 +448,16 @@ int main()
         /* show disparity as spots */
         for (int i = 0; i < matches; i++)
         {
-            int x = svs_matches[i*4 + 1];
-            int y = svs_matches[i*4 + 2];
-            int disp = svs_matches[i*4 + 3];
+            int x = svs_ctx[0]->svs_matches[i*4 + 1];
+            int y = svs_ctx[0]->svs_matches[i*4 + 2];
+            int disp = match_disparity(svs_ctx[0], svs_ctx[0]->svs_matches, i);
             drawing::drawBlendedSpot(img_matches, imgWidth, imgHeight, x, y, disp/3, 0, 255, 0);
         }
 
         /* show disparity as lines */
         for (int i = 0; i < matches; i+= matches/20)
         {
-            int x = svs_matches[i*4 + 1];
+            int x = svs_ctx[0]->svs_matches[i*4 + 1];
             int r=0,g=0,b=0;
             switch((x/4) % 6)
             {
@@ -533,8 +504,8 @@ int main()
                     break;
                 }
             }
-            int y = svs_matches[i*4 + 2];
-            int disp = svs_matches[i*4 + 3];
+            int y = svs_ctx[0]->svs_matches[i*4 + 2];
+            int disp = match_disparity(svs_ctx[0], svs_ctx[0]->svs_matches, i);
             int x2 = (x - disp) - calibration_offset_x;
             int y2 = imgHeight + y - calibration_offset_y;
             drawing::drawLine(img_matches_two_images, imgWidth, imgHeight*2, x,y, x2, y2, r,g,b,0,false);
@@ -573,6 +544,9 @@ int main()
         delete bmp_matches_two_images;
         delete bmp_left;
         delete bmp_right;
+        delete[] luma_buf;
+        svs_free(svs_ctx[0]);
+        svs_free(svs_ctx[1]);
     }
     else
     {
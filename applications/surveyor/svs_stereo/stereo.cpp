@@ -117,105 +117,250 @@ void svs_slave(
     printf("     CRC-sent: 0x%x CRC-received: 0x%x\n", (unsigned short)*inbuf16, ix);
 }
 
-/* Two structures are created:
- * svs_data stores features obtained from this camera
- * svs_data_received stores features received from the opposite camera */
-struct svs_data_struct
-    {
-
-        /* array storing x coordinates of detected features */
-        short int feature_x[SVS_MAX_FEATURES];
-
-        /* array storing the number of features detected on each row */
-        unsigned short int features_per_row[SVS_MAX_IMAGE_HEIGHT/SVS_VERTICAL_SAMPLING];
-
-        /* Array storing a binary descriptor, 32bits in length, for each detected feature.
-         * This will be used for matching purposes.*/
-        unsigned int descriptor[SVS_MAX_FEATURES];
-
-        /* mean luminance for each feature */
-        unsigned char mean[SVS_MAX_FEATURES];
-
-    }
-svs_data, svs_data_received;
-
-/* buffer which stores sliding sum */
-int row_sum[SVS_MAX_IMAGE_WIDTH];
-
-/* buffer used to find peaks in edge space */
-unsigned int row_peaks[SVS_MAX_IMAGE_WIDTH];
-
-/* array stores matching probabilities (prob,x,y,disp) */
-unsigned int svs_matches[SVS_MAX_FEATURES*4];
-
-/* used during filtering */
-unsigned char valid_quadrants[SVS_MAX_IMAGE_WIDTH];
-
-/* array used to store a disparity histogram */
-int disparity_histogram[SVS_MAX_IMAGE_WIDTH];
+#endif
 
-/* maps raw image pixels to rectified pixels */
-int calibration_map[SVS_MAX_IMAGE_WIDTH*SVS_MAX_IMAGE_HEIGHT];
+/* offsets of pixels to be compared within the patch region
+ * arranged into a rectangular structure */
+const int pixel_offsets[] =
+    {
+        -2,-4,  -1,-4,         1,-4,  2,-4,
+        -5,-2,  -4,-2,  -3,-2,  -2,-2,  -1,-2,  0,-2,  1,-2,  2,-2,  3,-2,  4,-2,  5,-2,
+        -5, 2,  -4, 2,  -3, 2,  -2, 2,  -1, 2,  0, 2,  1, 2,  2, 2,  3, 2,  4, 2,  5, 2,
+        -2, 4,  -1, 4,         1, 4,  2, 4
+    };
 
+/* creates the descriptor sampling pattern.  Wider descriptors sample a
+ * grid of rows above and below the feature, within the same vertical
+ * extent of four rows as the 30 pixel pattern */
+static void svs_descriptor_pattern(
+    struct svs_context* ctx)
+{
+    int i, dx, dy;
 
+#if SVS_DESCRIPTOR_PIXELS == 30
+    for (i = 0; i < SVS_DESCRIPTOR_PIXELS*2; i++)
+        ctx->descriptor_pattern[i] = pixel_offsets[i];
 #else
+    const int rows_4[] = { -4, -2, 2, 4 };
+    const int rows_8[] = { -4, -3, -2, -1, 1, 2, 3, 4 };
+    int rows = (SVS_DESCRIPTOR_PIXELS > 64) ? 8 : 4;
+    int columns = SVS_DESCRIPTOR_PIXELS / rows;
+    for (i = 0; i < SVS_DESCRIPTOR_PIXELS; i++)
+    {
+        ctx->descriptor_pattern[i*2] = (i % columns) - columns/2;
+        ctx->descriptor_pattern[i*2 + 1] = (rows == 8) ? rows_8[i / columns] : rows_4[i / columns];
+    }
+#endif
 
-extern unsigned int imgWidth, imgHeight;
-
-/* Two structures are created:
- * svs_data stores features obtained from this camera
- * svs_data_received stores features received from the opposite camera */
-extern struct svs_data_struct
+    ctx->descriptor_radius = 0;
+    ctx->descriptor_rows = 0;
+    for (i = 0; i < SVS_DESCRIPTOR_PIXELS; i++)
     {
+        dx = ctx->descriptor_pattern[i*2];
+        dy = ctx->descriptor_pattern[i*2 + 1];
+        ctx->descriptor_offsets[i] = dy * (int)ctx->imgWidth + dx;
+        if (dx < 0) dx = -dx;
+        if (dx > ctx->descriptor_radius)
+            ctx->descriptor_radius = dx;
+        if (dy < 0) dy = -dy;
+        if (dy > ctx->descriptor_rows)
+            ctx->descriptor_rows = dy;
+    }
+}
 
-        /* array storing x coordinates of detected features */
-        short int feature_x[SVS_MAX_FEATURES];
 
-        /* array storing the number of features detected on each row */
-        unsigned short int features_per_row[SVS_MAX_IMAGE_HEIGHT/SVS_VERTICAL_SAMPLING];
+/* Returns the address of the next buffer within an arena and moves the
+ * offset past it.  With a NULL arena only the offset is updated, so the
+ * same sequence of calls can be used to find the size of the arena */
+static void* svs_arena_buffer(
+    unsigned char* arena,   /* aligned block of memory, or NULL */
+    size_t* offset,         /* offset of the next buffer */
+    size_t bytes)           /* size of the buffer */
+{
+    void* buffer = (arena != NULL) ? (void*)(arena + *offset) : NULL;
+    *offset += (bytes + SVS_ARENA_ALIGNMENT - 1) & ~(size_t)(SVS_ARENA_ALIGNMENT - 1);
+    return(buffer);
+}
 
-        /* Array storing a binary descriptor, 32bits in length, for each detected feature.
-         * This will be used for matching purposes.*/
-        unsigned int descriptor[SVS_MAX_FEATURES];
+/* allocates a zeroed arena of the given size, aligned to SVS_ARENA_ALIGNMENT.
+ * Returns the aligned address, with the block to be freed in *block */
+static unsigned char* svs_arena_alloc(
+    size_t bytes,    /* size of the arena */
+    void** block)    /* returned block to be passed to free */
+{
+    *block = calloc(bytes + SVS_ARENA_ALIGNMENT, 1);
+    if (*block == NULL)
+        return(NULL);
+    return((unsigned char*)(((size_t)*block + SVS_ARENA_ALIGNMENT - 1) & ~(size_t)(SVS_ARENA_ALIGNMENT - 1)));
+}
 
-        /* mean luminance for each feature */
-        unsigned char mean[SVS_MAX_FEATURES];
+/* Points the buffers of the context into the given arena, returning the
+ * number of bytes used.  Called with a NULL arena to find the size */
+static size_t svs_context_buffers(
+    struct svs_context* ctx,
+    unsigned char* arena)
+{
+    size_t offset = 0;
+    int width = (int)ctx->imgWidth;
+    int height = (int)ctx->imgHeight;
+    int max_features = ctx->max_features;
+    int i;
 
+    for (i = 0; i < 2; i++)
+    {
+        struct svs_data_struct* data = (i == 0) ? &ctx->svs_data : &ctx->svs_data_received;
+        data->feature_x = (short int*)svs_arena_buffer(arena, &offset, max_features * sizeof(short int));
+        data->feature_subx = (signed char*)svs_arena_buffer(arena, &offset, max_features * sizeof(signed char));
+        data->features_per_row = (unsigned short int*)svs_arena_buffer(arena, &offset, ctx->feature_rows * sizeof(unsigned short int));
+        data->descriptor = (unsigned int*)svs_arena_buffer(arena, &offset, max_features * SVS_DESCRIPTOR_WORDS * sizeof(unsigned int));
+        data->mean = (unsigned char*)svs_arena_buffer(arena, &offset, max_features * sizeof(unsigned char));
     }
-svs_data, svs_data_received;
-
-/* buffer which stores sliding sum */
-extern int row_sum[SVS_MAX_IMAGE_WIDTH];
 
-/* buffer used to find peaks in edge space */
-extern unsigned int row_peaks[SVS_MAX_IMAGE_WIDTH];
+    ctx->row_sum = (int*)svs_arena_buffer(arena, &offset, width * sizeof(int));
+    ctx->row_peaks = (unsigned int*)svs_arena_buffer(arena, &offset, width * sizeof(unsigned int));
+    ctx->non_max_window = (unsigned int*)svs_arena_buffer(arena, &offset, 3 * svs_window_length(width) * sizeof(unsigned int));
+    ctx->eigen_descriptor = (unsigned int*)svs_arena_buffer(arena, &offset, max_features * SVS_DESCRIPTOR_WORDS * sizeof(unsigned int));
+    ctx->match_scores = (unsigned int*)svs_arena_buffer(arena, &offset, max_features * sizeof(unsigned int));
+    ctx->feature_offset = (int*)svs_arena_buffer(arena, &offset, ctx->feature_rows * sizeof(int));
+    ctx->received_offset = (int*)svs_arena_buffer(arena, &offset, ctx->feature_rows * sizeof(int));
+    ctx->cross_check = (int*)svs_arena_buffer(arena, &offset, (width + max_features) * 2 * sizeof(int));
+    ctx->prior_disp = (int*)svs_arena_buffer(arena, &offset, ctx->feature_rows * 2 * sizeof(int));
+    ctx->svs_matches = (unsigned int*)svs_arena_buffer(arena, &offset, max_features * 4 * sizeof(unsigned int));
+    ctx->match_heap = (int*)svs_arena_buffer(arena, &offset, max_features * sizeof(int));
+    ctx->match_sorted = (unsigned int*)svs_arena_buffer(arena, &offset, max_features * 4 * sizeof(unsigned int));
+#ifndef SVS_EMBEDDED
+    ctx->plane_points = (float*)svs_arena_buffer(arena, &offset, max_features * 3 * sizeof(float));
+    ctx->plane_index = (int*)svs_arena_buffer(arena, &offset, max_features * sizeof(int));
+#endif
+    ctx->rectify_buffer = (short int*)svs_arena_buffer(arena, &offset, width * height * 2 * sizeof(short int));
+    ctx->rectify_map = ctx->rectify_buffer;
+    ctx->rectify_index = (int*)svs_arena_buffer(arena, &offset, width * sizeof(int));
+    ctx->rectify_window = (unsigned char*)svs_arena_buffer(arena, &offset, svs_rectify_window_bytes(width));
 
-/* array stores matching probabilities (prob,x,y,disp) */
-extern unsigned int svs_matches[SVS_MAX_FEATURES*4];
+    return(offset);
+}
 
-/* used during filtering */
-extern unsigned char valid_quadrants[SVS_MAX_IMAGE_WIDTH];
+/* Initialises a context for an image of the given dimensions, allocating
+ * its buffers.  Returns zero on success, or -1 if memory could not be
+ * allocated or SVS_RECTIFY_ROWS is too small for the descriptor pattern.
+ * The buffers are released with svs_release */
+int svs_init(
+    struct svs_context* ctx,  /* context to be initialised */
+    unsigned int width,       /* image width in pixels */
+    unsigned int height,      /* image height in pixels */
+    int max_features)         /* maximum number of features within each image */
+{
+    memset(ctx, 0, sizeof(struct svs_context));
+    ctx->imgWidth = width;
+    ctx->imgHeight = height;
+    ctx->max_features = max_features;
+    ctx->feature_rows = ((int)height + SVS_VERTICAL_SAMPLING - 1) / SVS_VERTICAL_SAMPLING;
+    ctx->simd = svs_simd_detect();
+    ctx->threads = 1;
+    ctx->control_bands = 4;
+    ctx->row_penalty = 200;
+    ctx->prior_margin = 8;
+    ctx->prior_keyframe = 0;
+
+    /* filter within the left and right, and upper and lower hemifields */
+    ctx->filter_grids = 2;
+    ctx->filter_grid[0] = 2;
+    ctx->filter_grid[1] = 1;
+    ctx->filter_grid[2] = 1;
+    ctx->filter_grid[3] = 2;
+    ctx->filter_planes = 2;
+    ctx->plane_hypotheses = 64;
+    ctx->plane_support = 10;
+    svs_descriptor_pattern(ctx);
+
+    /* rows rectified by svs_get_features must hold every row sampled by a descriptor */
+    if (2 * ctx->descriptor_rows + 1 > SVS_RECTIFY_ROWS)
+        return(-1);
 
-/* array used to store a disparity histogram */
-extern int disparity_histogram[SVS_MAX_IMAGE_WIDTH];
+    unsigned char* arena = svs_arena_alloc(svs_context_buffers(ctx, NULL), &ctx->arena);
+    if (arena == NULL)
+        return(-1);
+    svs_context_buffers(ctx, arena);
 
-/* maps raw image pixels to rectified pixels */
-extern int calibration_map[SVS_MAX_IMAGE_WIDTH*SVS_MAX_IMAGE_HEIGHT];
+    /* there is no previous frame from which to predict disparities */
+    for (int row = 0; row < ctx->feature_rows; row++)
+        ctx->prior_disp[row*2] = 1;
+    return(0);
+}
 
+/* releases the buffers and threads belonging to a context */
+void svs_release(
+    struct svs_context* ctx)
+{
+#ifndef SVS_EMBEDDED
+    svs_calibration_unmap(ctx);
 #endif
+    svs_pool_free(ctx->pool);
+    free(ctx->band_arena);
+    free(ctx->disparity_histogram);
+    free(ctx->arena);
+    ctx->pool = NULL;
+    ctx->band_arena = NULL;
+    ctx->bands = NULL;
+    ctx->no_of_bands = 0;
+    ctx->disparity_histogram = NULL;
+    ctx->histogram_length = 0;
+    ctx->arena = NULL;
+}
 
-extern unsigned int imgWidth, imgHeight;
-
-/* offsets of pixels to be compared within the patch region
- * arranged into a rectangular structure */
-const int pixel_offsets[] =
+/* allocates and initialises a new context */
+struct svs_context* svs_create(
+    unsigned int width,   /* image width in pixels */
+    unsigned int height,  /* image height in pixels */
+    int max_features)     /* maximum number of features within each image */
+{
+    struct svs_context* ctx = (struct svs_context*)malloc(sizeof(struct svs_context));
+    if ((ctx != NULL) &&
+            (svs_init(ctx, width, height, max_features) != 0))
     {
-        -2,-4,  -1,-4,         1,-4,  2,-4,
-        -5,-2,  -4,-2,  -3,-2,  -2,-2,  -1,-2,  0,-2,  1,-2,  2,-2,  3,-2,  4,-2,  5,-2,
-        -5, 2,  -4, 2,  -3, 2,  -2, 2,  -1, 2,  0, 2,  1, 2,  2, 2,  3, 2,  4, 2,  5, 2,
-        -2, 4,  -1, 4,         1, 4,  2, 4
-    };
+        free(ctx);
+        ctx = NULL;
+    }
+    return(ctx);
+}
 
+/* releases a context created with svs_create */
+void svs_free(
+    struct svs_context* ctx)
+{
+    if (ctx == NULL)
+        return;
+    svs_release(ctx);
+    free(ctx);
+}
+
+/* returns the number of bytes of feature data sent between cameras */
+int svs_data_size(
+    struct svs_context* ctx)
+{
+    return(ctx->max_features * (int)(sizeof(short int) + sizeof(signed char) + SVS_DESCRIPTOR_WORDS * sizeof(unsigned int) + sizeof(unsigned char)) +
+           ctx->feature_rows * (int)sizeof(unsigned short int));
+}
+
+/* Stores features received from the opposite camera, which should
+ * have the same image dimensions as this one */
+void svs_receive(
+    struct svs_context* ctx,            /* context for this camera */
+    struct svs_data_struct* received)   /* features from the opposite camera */
+{
+    int row, no_of_features = 0;
+
+    memcpy(ctx->svs_data_received.features_per_row, received->features_per_row, ctx->feature_rows * sizeof(unsigned short int));
+    for (row = 0; row < ctx->feature_rows; row++)
+        no_of_features += received->features_per_row[row];
+    if (no_of_features > ctx->max_features)
+        no_of_features = ctx->max_features;
+
+    memcpy(ctx->svs_data_received.feature_x, received->feature_x, no_of_features * sizeof(short int));
+    memcpy(ctx->svs_data_received.feature_subx, received->feature_subx, no_of_features * sizeof(signed char));
+    memcpy(ctx->svs_data_received.descriptor, received->descriptor, no_of_features * SVS_DESCRIPTOR_WORDS * sizeof(unsigned int));
+    memcpy(ctx->svs_data_received.mean, received->mean, no_of_features * sizeof(unsigned char));
+}
 
 /* lookup table used for counting the number of set bits */
 const unsigned char BitsSetTable256[] =
@@ -238,55 +383,272 @@ const unsigned char BitsSetTable256[] =
         4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8
     };
 
+/* reverses the order of the bits within a word */
+static inline unsigned int svs_reverse_bits(
+    unsigned int v)
+{
+    v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+    v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+    v = ((v >> 4) & 0x0f0f0f0f) | ((v & 0x0f0f0f0f) << 4);
+    v = ((v >> 8) & 0x00ff00ff) | ((v & 0x00ff00ff) << 8);
+    return((v >> 16) | (v << 16));
+}
 
-/* Updates sliding sums and edge response values along a single row
- * Returns the mean luminance along the row */
-int svs_update_sums(
+/* returns the number of bits set within the bitwise AND of two descriptors */
+static inline int svs_descriptor_bits(
+    int simd,                 /* instruction set (SVS_SIMD_*) */
+    const unsigned int* a,    /* first descriptor */
+    const unsigned int* b)    /* second descriptor */
+{
+    int i, bits = 0;
+    unsigned int v;
+
+#if defined(__GNUC__) && defined(__POPCNT__)
+    /* compiled for a CPU with a population count instruction */
+    for (i = 0; i < SVS_DESCRIPTOR_WORDS; i++)
+        bits += __builtin_popcount(a[i] & b[i]);
+    return(bits);
+#endif
+
+#ifdef SVS_SIMD_X86
+    if (simd == SVS_SIMD_AVX2)
+    {
+        if ((SVS_DESCRIPTOR_WORDS % 8) == 0)
+            return(svs_match_bits_avx2(a, b, SVS_DESCRIPTOR_WORDS));
+        return(svs_match_bits_popcnt(a, b, SVS_DESCRIPTOR_WORDS));
+    }
+#endif
+
+    for (i = 0; i < SVS_DESCRIPTOR_WORDS; i++)
+    {
+        v = a[i] & b[i];
+        bits +=
+            BitsSetTable256[v & 0xff] +
+            BitsSetTable256[(v >> 8) & 0xff] +
+            BitsSetTable256[(v >> 16) & 0xff] +
+            BitsSetTable256[v >> 24];
+    }
+    return(bits);
+}
+
+/* Scores a feature from the left camera against a number of features from
+ * the right camera, returning the total of the scores.  Features within
+ * the disparity range which have enough descriptor bits in common are
+ * scored on the similarity of their descriptors, luminance and disparity.
+ * Features with a moderate negative disparity are given a score based
+ * upon the disparity alone.  Every score is reduced by the given penalty */
+static unsigned int svs_match_scores(
+    struct svs_context* ctx,                /* context for the left camera */
+    const struct svs_match_params* params,  /* left camera feature and weights */
+    const unsigned int* eigen,              /* eigendescriptors of the right features */
+    const short int* feature_x,             /* x coordinates of the right features */
+    const unsigned char* mean,              /* mean luminance of the right features */
+    int features,                           /* number of right features */
+    unsigned int* score)                    /* returned scores */
+{
+    int R, disp, luma_diff, s;
+    unsigned int correlation, anticorrelation, total = 0;
+
+#ifdef SVS_SIMD_X86
+    if (ctx->simd == SVS_SIMD_AVX2)
+        return(svs_match_scores_avx2(params, eigen, feature_x, mean, SVS_DESCRIPTOR_WORDS, features, score));
+#endif
+
+    for (R = 0; R < features; R++)
+    {
+
+        /* set matching score to zero */
+        score[R] = 0;
+
+        /* compute disparity */
+        disp = params->xL - feature_x[R];
+
+        /* is the disparity within range? */
+        if ((disp >= -10) && (disp < params->max_disp))
+        {
+            if (disp < 0)
+                disp = 0;
+
+            /* count the number of bitwise descriptor correlation bits */
+            correlation = svs_descriptor_bits(ctx->simd, params->descL, &eigen[R*SVS_DESCRIPTOR_WORDS]);
+
+            /* were enough bits matched ? */
+            if ((int)correlation > params->threshold)
+            {
+
+                /* count the number of anti-correlation bits */
+                anticorrelation = svs_descriptor_bits(ctx->simd, params->descLanti, &eigen[R*SVS_DESCRIPTOR_WORDS]);
+
+                /* is the mean luminance similar? */
+                luma_diff = mean[R] - params->meanL;
+                if (luma_diff < 0)
+                    luma_diff = -luma_diff;
+
+                s = 10000 +
+                    (params->max_disp * params->learnDisp) +
+                    (((int)correlation + (int)(params->pixels - anticorrelation)) * params->learnDesc) -
+                    (luma_diff * params->learnLuma) -
+                    (disp * params->learnDisp) -
+                    params->penalty;
+                if (s < 0)
+                    s = 0;
+
+                /* store overall matching score */
+                score[R] = (unsigned int)s;
+                total += score[R];
+            }
+        }
+        else
+        {
+            if ((disp < 0) && (disp > -params->max_disp))
+            {
+                s = (params->max_disp - disp) * params->learnDisp - params->penalty;
+                if (s > 0)
+                {
+                    score[R] = (unsigned int)s;
+                    total += score[R];
+                }
+            }
+        }
+    }
+    return(total);
+}
+
+
+#ifndef SVS_EMBEDDED
+
+/* computes the sliding sum along a row of the image, in units of R+G+B
+ * for RGB and 16 bit luma images, or of luma for 8 bit luma images */
+static void svs_row_sum(
+    struct svs_context* ctx,              /* context for this camera */
     int y,                                /* row index */
-    unsigned char* rectified_frame_buf)   /* image data */
+    unsigned char* rectified_frame_buf,   /* image data */
+    int* row_sum)                         /* returned sliding sum */
+{
+    int x, idx;
+    unsigned int v;
+    int width = (int)ctx->imgWidth;
+
+    switch(ctx->format)
+    {
+    case SVS_FORMAT_LUMA8:
+        {
+            unsigned char* luma = &rectified_frame_buf[y * width];
+#ifdef SVS_SIMD_X86
+            if (ctx->simd != SVS_SIMD_NONE)
+            {
+                svs_row_sum_luma8_sse2(luma, width, row_sum);
+                break;
+            }
+#endif
+            row_sum[0] = luma[0];
+            for (x = 1; x < width; x++)
+                row_sum[x] = row_sum[x-1] + luma[x];
+            break;
+        }
+    case SVS_FORMAT_LUMA16:
+        {
+            unsigned short* luma = &((unsigned short*)rectified_frame_buf)[y * width];
+#ifdef SVS_SIMD_X86
+            if (ctx->simd != SVS_SIMD_NONE)
+            {
+                svs_row_sum_luma16_sse2(luma, width, row_sum);
+                break;
+            }
+#endif
+            row_sum[0] = luma[0];
+            for (x = 1; x < width; x++)
+                row_sum[x] = row_sum[x-1] + luma[x];
+            break;
+        }
+    default:
+        {
+            idx = pixindex(0, y, width);
+#ifdef SVS_SIMD_X86
+            if (ctx->simd != SVS_SIMD_NONE)
+            {
+                /* vectorised version of the loop below, giving identical results */
+                svs_row_sum_sse2(&rectified_frame_buf[idx], width, row_sum);
+                break;
+            }
+#endif
+            row_sum[0] =
+                rectified_frame_buf[idx + 2] +
+                rectified_frame_buf[idx + 1] +
+                rectified_frame_buf[idx + 0];
+            for (x = 1; x < width; x++)
+            {
+                idx = pixindex(x, y, width);
+                v = rectified_frame_buf[idx + 2] +
+                    rectified_frame_buf[idx + 1] +
+                    rectified_frame_buf[idx];
+                row_sum[x] = row_sum[x-1] + v;
+            }
+            break;
+        }
+    }
+}
+
+#endif
+
+/* Updates sliding sums and edge response values along a single row,
+ * using the given buffers.  Returns the mean luminance along the row */
+static int svs_row_update(
+    struct svs_context* ctx,              /* context for this camera */
+    int y,                                /* row within the image data */
+    unsigned char* rectified_frame_buf,   /* image data */
+    int* row_sum,                         /* buffer for the sliding sum */
+    unsigned int* row_peaks)              /* returned edge responses */
 {
 
-    int x, idx, mean=0;
+    int x, mean=0;
+
+#ifdef SVS_EMBEDDED
+
+    int idx;
     unsigned int v;
 
     /* compute sums along the row */
-    int stride = pixindex(imgWidth, 0);
+    int stride = pixindex(ctx->imgWidth, 0, ctx->imgWidth);
     idx = stride * y;
 
-#ifdef SVS_EMBEDDED
-
     row_sum[0] = rectified_frame_buf[idx];
-    for (x = 1; x < (int)imgWidth; x++)
+    for (x = 1; x < (int)ctx->imgWidth; x++)
     {
-        idx = pixindex(x, y);
+        idx = pixindex(x, y, ctx->imgWidth);
         v = rectified_frame_buf[idx];
         row_sum[x] = row_sum[x-1] + v;
     }
 
     /* row mean luminance */
-    mean = row_sum[x-1] / (int)imgWidth;
+    mean = row_sum[x-1] / (int)ctx->imgWidth;
 #else
 
-    row_sum[0] =
-        rectified_frame_buf[idx + 2] +
-        rectified_frame_buf[idx + 1] +
-        rectified_frame_buf[idx + 0];
-    for (x = 1; x < (int)imgWidth; x++)
+    /* compute sums along the row */
+    svs_row_sum(ctx, y, rectified_frame_buf, row_sum);
+
+    /* row mean luminance, on the same scale for every image format */
+    if (ctx->format == SVS_FORMAT_LUMA8)
+        mean = row_sum[ctx->imgWidth-1] / (((int)ctx->imgWidth-1)*2);
+    else
+        mean = row_sum[ctx->imgWidth-1] / (((int)ctx->imgWidth-1)*6);
+
+#ifdef SVS_SIMD_X86
+    if (ctx->simd != SVS_SIMD_NONE)
     {
-        idx = pixindex(x, y);
-        v = rectified_frame_buf[idx + 2] +
-            rectified_frame_buf[idx + 1] +
-            rectified_frame_buf[idx];
-        row_sum[x] = row_sum[x-1] + v;
+        /* vectorised versions of the loop below, giving identical results */
+        if (ctx->simd == SVS_SIMD_AVX2)
+            svs_row_peaks_avx2(row_sum, (int)ctx->imgWidth, row_peaks);
+        else
+            svs_row_peaks_sse2(row_sum, (int)ctx->imgWidth, row_peaks);
+        return(mean);
     }
-
-    /* row mean luminance */
-    mean = row_sum[x-1] / (((int)imgWidth-1)*6);
+#endif
 #endif
 
     /* compute peaks */
     int p0, p1;
-    for (x = 4; x < (int)imgWidth-4; x++)
+    for (x = 4; x < (int)ctx->imgWidth-4; x++)
     {
 
         /* edge using 2 pixel radius */
@@ -309,8 +671,115 @@ int svs_update_sums(
 }
 
 
-/* performs non-maximal suppression on the given row */
-void svs_non_max(
+/* Updates sliding sums and edge response values along a single row
+ * Returns the mean luminance along the row */
+int svs_update_sums(
+    struct svs_context* ctx,              /* context for this camera */
+    int y,                                /* row index */
+    unsigned char* rectified_frame_buf)   /* image data */
+{
+    return(svs_row_update(ctx, y, rectified_frame_buf, ctx->row_sum, ctx->row_peaks));
+}
+
+/* Non-maximal suppression using sliding window maxima (van Herk/Gil-Werman).
+ * After thresholding, a response survives only if it is greater than every
+ * response up to inhibition_radius-1 pixels to its right, and no smaller
+ * than every response up to inhibition_radius-1 pixels to its left, so that
+ * ties go to the rightmost response as they do in the scanning version.
+ * Unlike the scan the result does not depend upon the order in which pixels
+ * are visited, and the cost is a fixed number of operations per pixel
+ * whatever the radius.
+ * The thresholded row is padded with k = inhibition_radius-1 zeros at each
+ * end and divided into blocks of k.  Running maxima forwards and backwards
+ * within each block then give the maximum of any k pixel window as
+ * max(backward[start], forward[end]) */
+static void svs_non_max_window(
+    struct svs_context* ctx,   /* context for this camera */
+    unsigned int* peaks,       /* edge responses along the row */
+    unsigned int* window,      /* working buffers */
+    int inhibition_radius,     /* radius for non-maximal suppression */
+    unsigned int threshold)    /* minimum response */
+{
+    int x, i, p, b, block_end, n;
+    unsigned int v, m, left, right;
+    int lo = 4, hi = (int)ctx->imgWidth - 4;
+    int k = inhibition_radius - 1;
+
+    if (threshold < 1) threshold = 1;
+    if (k < 1)
+    {
+        for (x = lo; x < hi; x++)
+        {
+            if (peaks[x] < threshold)
+                peaks[x] = 0;
+        }
+        return;
+    }
+    if (k > hi - lo) k = hi - lo;
+
+#ifdef SVS_SIMD_X86
+    if (ctx->simd == SVS_SIMD_AVX2)
+    {
+        svs_non_max_window_avx2(&peaks[lo], hi - lo, k, threshold,
+                                window, window + svs_window_length(ctx->imgWidth),
+                                window + svs_window_length(ctx->imgWidth)*2);
+        return;
+    }
+#endif
+
+    unsigned int* t = window;
+    unsigned int* fwd = window + svs_window_length(ctx->imgWidth);
+    unsigned int* bwd = window + svs_window_length(ctx->imgWidth)*2;
+
+    /* apply the threshold to the padded row */
+    n = (hi - lo) + k*2;
+    for (p = 0; p < k; p++)
+    {
+        t[p] = 0;
+        t[n - 1 - p] = 0;
+    }
+    for (x = lo; x < hi; x++)
+    {
+        v = peaks[x];
+        t[k + x - lo] = (v < threshold) ? 0 : v;
+    }
+
+    /* running maxima within each block */
+    for (b = 0; b < n; b += k)
+    {
+        block_end = b + k;
+        if (block_end > n) block_end = n;
+
+        m = 0;
+        for (i = b; i < block_end; i++)
+        {
+            if (t[i] > m) m = t[i];
+            fwd[i] = m;
+        }
+        m = 0;
+        for (i = block_end - 1; i >= b; i--)
+        {
+            if (t[i] > m) m = t[i];
+            bwd[i] = m;
+        }
+    }
+
+    /* compare each response against the windows on either side */
+    for (x = lo; x < hi; x++)
+    {
+        p = k + x - lo;
+        v = t[p];
+        left = (bwd[p - k] > fwd[p - 1]) ? bwd[p - k] : fwd[p - 1];
+        right = (bwd[p + 1] > fwd[p + k]) ? bwd[p + 1] : fwd[p + k];
+        peaks[x] = ((v >= left) && (v > right)) ? v : 0;
+    }
+}
+
+/* performs non-maximal suppression on the given row of edge responses */
+static void svs_row_non_max(
+    struct svs_context* ctx,   /* context for this camera */
+    unsigned int* row_peaks,   /* edge responses along the row */
+    unsigned int* window,      /* working buffers for SVS_NON_MAX_WINDOW */
     int inhibition_radius,     /* radius for non-maximal suppression */
     unsigned int min_response) /* minimum threshold as a percent in the range 0-200 */
 {
@@ -320,16 +789,31 @@ void svs_non_max(
 
     /* average response */
     unsigned int av_peaks = 0;
-    for (x = 4; x < (int)imgWidth - 4; x++)
+#ifdef SVS_SIMD_X86
+    if (ctx->simd != SVS_SIMD_NONE)
+    {
+        av_peaks = svs_row_total_sse2(&row_peaks[4], (int)ctx->imgWidth - 8);
+    }
+    else
+#endif
     {
-        av_peaks += row_peaks[x];
+        for (x = 4; x < (int)ctx->imgWidth - 4; x++)
+        {
+            av_peaks += row_peaks[x];
+        }
     }
-    av_peaks /= (imgWidth - 8);
+    av_peaks /= (ctx->imgWidth - 8);
 
     /* adjust the threshold */
     av_peaks = av_peaks * min_response / 100;
 
-    for (x = 4; x < (int)imgWidth - inhibition_radius; x++)
+    if (ctx->non_max == SVS_NON_MAX_WINDOW)
+    {
+        svs_non_max_window(ctx, row_peaks, window, inhibition_radius, av_peaks);
+        return;
+    }
+
+    for (x = 4; x < (int)ctx->imgWidth - inhibition_radius; x++)
     {
 
         if (row_peaks[x] < av_peaks)
@@ -353,44 +837,79 @@ void svs_non_max(
     }
 }
 
-/* creates a binary descriptor for a feature at the given coordinate
-   which can subsequently be used for matching */
-int svs_compute_descriptor(
-    int px,
-    int py,
-    unsigned char* rectified_frame_buf,
-    int no_of_features,
-    int row_mean)
+/* performs non-maximal suppression on the given row */
+void svs_non_max(
+    struct svs_context* ctx,   /* context for this camera */
+    int inhibition_radius,     /* radius for non-maximal suppression */
+    unsigned int min_response) /* minimum threshold as a percent in the range 0-200 */
 {
+    svs_row_non_max(ctx, ctx->row_peaks, ctx->non_max_window, inhibition_radius, min_response);
+}
 
-    unsigned char bit_count = 0;
-    int pixel_offset_idx, ix, bit;
-    int meanval = 0;
-    unsigned int desc = 0;
-
-    /* find the mean luminance for the patch */
-    for (pixel_offset_idx = 0; pixel_offset_idx < SVS_DESCRIPTOR_PIXELS*2; pixel_offset_idx += 2)
+/* returns the number of bytes of each pixel of the images used by the context */
+static inline int svs_bytes_per_pixel(
+    struct svs_context* ctx)
+{
+    switch(ctx->format)
     {
-        ix = rectified_frame_buf[pixindex((px + pixel_offsets[pixel_offset_idx]), (py + pixel_offsets[pixel_offset_idx + 1]))];
-        meanval += rectified_frame_buf[ix];
+    case SVS_FORMAT_LUMA8:
+        return(1);
+    case SVS_FORMAT_LUMA16:
+        return(2);
+    default:
+        return(3);
     }
-    meanval /= SVS_DESCRIPTOR_PIXELS;
+}
 
-    /* binarise */
-    bit = 1;
-    for (pixel_offset_idx = 0; pixel_offset_idx < SVS_DESCRIPTOR_PIXELS*2; pixel_offset_idx += 2, bit *= 2)
+/* returns the value of a pixel used to build patch descriptors,
+ * given its index within the image.  On a PC this is R+G+B for RGB
+ * images, in line with the sliding sums */
+static inline int svs_patch_sample(
+    struct svs_context* ctx,
+    unsigned char* rectified_frame_buf,
+    int idx)
+{
+    switch(ctx->format)
     {
-        ix = rectified_frame_buf[pixindex((px + pixel_offsets[pixel_offset_idx]), (py + pixel_offsets[pixel_offset_idx + 1]))];
-        if (rectified_frame_buf[ix] > meanval)
-        {
-            desc |= bit;
-            bit_count++;
-        }
+    case SVS_FORMAT_LUMA8:
+        return(rectified_frame_buf[idx]);
+    case SVS_FORMAT_LUMA16:
+        return(((unsigned short*)rectified_frame_buf)[idx]);
+    default:
+        idx *= 3;
+#ifdef SVS_EMBEDDED
+        return(rectified_frame_buf[idx]);
+#else
+        return(rectified_frame_buf[idx] + rectified_frame_buf[idx + 1] + rectified_frame_buf[idx + 2]);
+#endif
     }
+}
+
+/* Given the mean value of the patch samples and the resulting binary
+ * descriptor, stores the descriptor and the mean luminance of the patch.
+ * Returns zero if the feature is suitable for matching */
+static int svs_descriptor_result(
+    struct svs_context* ctx,
+    int meanval,
+    const unsigned int* desc,
+    int row_mean,
+    unsigned int* descriptor,
+    unsigned char* mean)
+{
+    int i;
+    int bit_count = svs_descriptor_bits(ctx->simd, desc, desc);
 
     if ((bit_count > 3) &&
             (bit_count < SVS_DESCRIPTOR_PIXELS-3))
     {
+        /* samples which are R+G+B */
+#ifdef SVS_EMBEDDED
+        if (ctx->format == SVS_FORMAT_LUMA16)
+#else
+        if (ctx->format != SVS_FORMAT_LUMA8)
+#endif
+            meanval /= 3;
+
         meanval /= 3;
 
         /* adjust the patch luminance relative to the mean
@@ -403,8 +922,9 @@ int svs_compute_descriptor(
         if (meanval > 255)
             meanval = 255;
 
-        svs_data.mean[no_of_features] = (unsigned char)(meanval/3);
-        svs_data.descriptor[no_of_features] = desc;
+        *mean = (unsigned char)(meanval/3);
+        for (i = 0; i < SVS_DESCRIPTOR_WORDS; i++)
+            descriptor[i] = desc[i];
         return(0);
     }
     else
@@ -414,63 +934,676 @@ int svs_compute_descriptor(
     }
 }
 
-/* returns a set of features suitable for stereo matching */
-int svs_get_features(
-    unsigned char* rectified_frame_buf,  /* image data */
-    int inhibition_radius,               /* radius for non-maximal supression */
-    unsigned int minimum_response,       /* minimum threshold */
-    int calibration_offset_x,            /* calibration x offset in pixels */
-    int calibration_offset_y)            /* calibration y offset in pixels */
+/* creates a binary descriptor and mean luminance for a feature at the
+   given coordinate within the image data.  Returns zero if the feature
+   is suitable for matching */
+static int svs_feature_descriptor(
+    struct svs_context* ctx,
+    int px,
+    int py,
+    unsigned char* rectified_frame_buf,
+    int row_mean,
+    unsigned int* descriptor,
+    unsigned char* mean)
 {
 
-    unsigned short int no_of_feats;
-    int x, y, row_mean, start_x;
-    int no_of_features = 0;
-    int row_idx = 0;
+    int i, sample[SVS_DESCRIPTOR_PIXELS];
+    int idx = py * (int)ctx->imgWidth + px;
+    int meanval = 0;
+    unsigned int desc[SVS_DESCRIPTOR_WORDS];
 
-    memset(svs_data.features_per_row, 0, SVS_MAX_IMAGE_HEIGHT/SVS_VERTICAL_SAMPLING * sizeof(unsigned short));
+    memset(desc, 0, sizeof(desc));
 
-    start_x = imgWidth - 15;
-    if ((int)imgWidth - inhibition_radius - 1 < start_x)
-        start_x = (int)imgWidth - inhibition_radius - 1;
+    /* find the mean luminance for the patch */
+    for (i = 0; i < SVS_DESCRIPTOR_PIXELS; i++)
+    {
+        sample[i] = svs_patch_sample(ctx, rectified_frame_buf, idx + ctx->descriptor_offsets[i]);
+        meanval += sample[i];
+    }
+    meanval /= SVS_DESCRIPTOR_PIXELS;
 
-    for (y = 4 + calibration_offset_y; y < (int)imgHeight - 4; y += SVS_VERTICAL_SAMPLING)
+    /* binarise */
+    for (i = 0; i < SVS_DESCRIPTOR_PIXELS; i++)
     {
+        if (sample[i] > meanval)
+            desc[i / 32] |= 1u << (i % 32);
+    }
 
-        /* reset number of features on the row */
-        no_of_feats = 0;
+    return(svs_descriptor_result(ctx, meanval, desc, row_mean, descriptor, mean));
+}
 
-        if ((y >= 4) && (y <= (int)imgHeight - 4))
+/* creates a binary descriptor for a feature at the given coordinate
+   which can subsequently be used for matching */
+int svs_compute_descriptor(
+    struct svs_context* ctx,
+    int px,
+    int py,
+    unsigned char* rectified_frame_buf,
+    int no_of_features,
+    int row_mean)
+{
+    return(svs_feature_descriptor(
+               ctx, px, py, rectified_frame_buf, row_mean,
+               &ctx->svs_data.descriptor[no_of_features*SVS_DESCRIPTOR_WORDS],
+               &ctx->svs_data.mean[no_of_features]));
+}
+
+/* Returns the sub-pixel offset of an edge response peak at x, in units of
+ * 1/SVS_SUBPIXEL pixels, by fitting a parabola to the responses at x-1, x
+ * and x+1.  The responses are recomputed from the sliding sums, since
+ * non-maximal suppression has already cleared those of the neighbours */
+static int svs_subpixel_offset(
+    int* row_sum,    /* sliding sum for the row */
+    int x)           /* position of the peak */
+{
+    int i, p0, p1, r[3], curvature, offset;
+
+    for (i = 0; i < 3; i++)
+    {
+        p0 = (row_sum[x + i - 1] - row_sum[x + i - 3]) -
+             (row_sum[x + i + 1] - row_sum[x + i - 1]);
+        if (p0 < 0)
+            p0 = -p0;
+        p1 = (row_sum[x + i - 1] - row_sum[x + i - 5]) -
+             (row_sum[x + i + 3] - row_sum[x + i - 1]);
+        if (p1 < 0)
+            p1 = -p1;
+        r[i] = p0 + p1;
+    }
+
+    /* the peak of the parabola lies within half a pixel of x only if x
+     * is a local maximum of the response */
+    curvature = r[0] - 2*r[1] + r[2];
+    if ((curvature >= 0) || (r[0] > r[1]) || (r[2] > r[1]))
+        return(0);
+
+    offset = (r[0] - r[2]) * SVS_SUBPIXEL / (2 * curvature);
+    if (offset > SVS_SUBPIXEL/2)
+        offset = SVS_SUBPIXEL/2;
+    if (offset < -SVS_SUBPIXEL/2)
+        offset = -SVS_SUBPIXEL/2;
+    return(offset);
+}
+
+/* stores the position of a detected feature */
+static inline void svs_feature_position(
+    struct svs_context* ctx,    /* context for this camera */
+    int* row_sum,               /* sliding sum for the row */
+    int x,                      /* position of the feature */
+    int calibration_offset_x,   /* calibration x offset in pixels */
+    short int* feature_x,       /* returned x coordinate */
+    signed char* feature_subx)  /* returned sub-pixel offset */
+{
+    *feature_x = (short int)(x + calibration_offset_x);
+    *feature_subx = (signed char)(ctx->subpixel ? svs_subpixel_offset(row_sum, x) : 0);
+}
+
+/* Consecutive rows of the image held in a buffer.  This is either the
+ * whole image, or when rows are rectified by svs_get_features as they
+ * are needed (see rectify_rows) a rolling buffer of SVS_RECTIFY_ROWS rows */
+struct svs_rows
+{
+    unsigned char* buffer;   /* image data, starting at the first row held */
+    int first, count;        /* first row held, and the number of rows held */
+    int last;                /* last row which will be read */
+};
+
+/* Detects features along a single row, storing at most max_features
+ * of them in order of decreasing x.  Returns the number stored */
+static int svs_row_features(
+    struct svs_context* ctx,             /* context for this camera */
+    const struct svs_rows* rows,         /* rows of the image held, including those sampled by descriptors */
+    int y,                               /* row index */
+    int inhibition_radius,               /* radius for non-maximal supression */
+    unsigned int minimum_response,       /* minimum threshold */
+    int calibration_offset_x,            /* calibration x offset in pixels */
+    int* row_sum,                        /* buffer for the sliding sum */
+    unsigned int* row_peaks,             /* buffer for edge responses */
+    unsigned int* window,                /* buffers for non-maximal suppression */
+    short int* feature_x,                /* returned x coordinates */
+    signed char* feature_subx,           /* returned sub-pixel offsets */
+    unsigned int* descriptor,            /* returned descriptors */
+    unsigned char* mean,                 /* returned mean luminance */
+    int max_features)                    /* maximum number of features to store */
+{
+    int x, row_mean, start_x;
+    int no_of_feats = 0;
+
+    /* row within the buffer */
+    unsigned char* rectified_frame_buf = rows->buffer;
+    int row = y - rows->first;
+
+    start_x = ctx->imgWidth - 15;
+    if ((int)ctx->imgWidth - inhibition_radius - 1 < start_x)
+        start_x = (int)ctx->imgWidth - inhibition_radius - 1;
+
+    /* keep wide descriptor patterns within the row */
+    if ((int)ctx->imgWidth - ctx->descriptor_radius - 1 < start_x)
+        start_x = (int)ctx->imgWidth - ctx->descriptor_radius - 1;
+
+    row_mean = svs_row_update(ctx, row, rectified_frame_buf, row_sum, row_peaks);
+    svs_row_non_max(ctx, row_peaks, window, inhibition_radius, minimum_response);
+
+#ifdef SVS_SIMD_X86
+    if (ctx->simd == SVS_SIMD_AVX2)
+    {
+        /* Descriptors are computed for eight candidates at a time, gathering
+         * each sample for all of them at once.  The results are identical
+         * to those of svs_feature_descriptor */
+        int i, n, no_of_candidates = 0;
+        int candidate_x[8], pixel_index[8], patch_mean[8];
+        unsigned int desc[8*SVS_DESCRIPTOR_WORDS];
+        int bytes_per_sample = 3;
+        if (ctx->format == SVS_FORMAT_LUMA8) bytes_per_sample = 1;
+        if (ctx->format == SVS_FORMAT_LUMA16) bytes_per_sample = 2;
+
+        /* Each sample is gathered as four bytes, so candidates sampling the
+         * last few bytes of the rows held are left to the scalar version below */
+        int last_index = rows->count * (int)ctx->imgWidth - (4 + bytes_per_sample - 1) / bytes_per_sample;
+        int reach = 0;
+        for (i = 0; i < SVS_DESCRIPTOR_PIXELS; i++)
         {
+            if (ctx->descriptor_offsets[i] > reach)
+                reach = ctx->descriptor_offsets[i];
+        }
 
-            row_mean = svs_update_sums(y, rectified_frame_buf);
-            svs_non_max(inhibition_radius, minimum_response);
+        for (x = start_x; x > 15; x--)
+        {
+            if (row_peaks[x] > 0)
+                candidate_x[no_of_candidates++] = x;
 
-            /* store the features */
-            for (x = start_x; x > 15; x--)
+            if ((no_of_candidates == 8) ||
+                    ((x == 16) && (no_of_candidates > 0)))
             {
-                if (row_peaks[x] > 0)
+                n = no_of_candidates;
+                no_of_candidates = 0;
+                if (row * (int)ctx->imgWidth + candidate_x[0] + reach > last_index)
                 {
-
-                    if (svs_compute_descriptor(
-                                x, y, rectified_frame_buf, no_of_features, row_mean) == 0)
+                    for (i = 0; i < n; i++)
                     {
-
-                        svs_data.feature_x[no_of_features++] = (short int)(x + calibration_offset_x);
-                        no_of_feats++;
-                        if (no_of_features == SVS_MAX_FEATURES)
+                        if (svs_feature_descriptor(
+                                    ctx, candidate_x[i], row, rectified_frame_buf, row_mean,
+                                    &descriptor[no_of_feats*SVS_DESCRIPTOR_WORDS], &mean[no_of_feats]) == 0)
                         {
-                            y = imgHeight;
-                            printf("stereo feature buffer full\n");
-                            break;
+                            svs_feature_position(ctx, row_sum, candidate_x[i], calibration_offset_x,
+                                                 &feature_x[no_of_feats], &feature_subx[no_of_feats]);
+                            no_of_feats++;
+                            if (no_of_feats == max_features)
+                                return(no_of_feats);
                         }
                     }
+                    continue;
+                }
+
+                /* unused lanes repeat the first candidate */
+                for (i = 0; i < 8; i++)
+                    pixel_index[i] = row * (int)ctx->imgWidth + candidate_x[(i < n) ? i : 0];
+
+                svs_descriptors_avx2(
+                    rectified_frame_buf, bytes_per_sample, pixel_index,
+                    ctx->descriptor_offsets, SVS_DESCRIPTOR_PIXELS, desc, patch_mean);
+
+                for (i = 0; i < n; i++)
+                {
+                    if (svs_descriptor_result(
+                                ctx, patch_mean[i], &desc[i*SVS_DESCRIPTOR_WORDS], row_mean,
+                                &descriptor[no_of_feats*SVS_DESCRIPTOR_WORDS], &mean[no_of_feats]) == 0)
+                    {
+                        svs_feature_position(ctx, row_sum, candidate_x[i], calibration_offset_x,
+                                             &feature_x[no_of_feats], &feature_subx[no_of_feats]);
+                        no_of_feats++;
+                        if (no_of_feats == max_features)
+                            return(no_of_feats);
+                    }
+                }
+            }
+        }
+        return(no_of_feats);
+    }
+#endif
+
+    /* store the features */
+    for (x = start_x; x > 15; x--)
+    {
+        if (row_peaks[x] > 0)
+        {
+
+            if (svs_feature_descriptor(
+                        ctx, x, row, rectified_frame_buf, row_mean,
+                        &descriptor[no_of_feats*SVS_DESCRIPTOR_WORDS], &mean[no_of_feats]) == 0)
+            {
+
+                svs_feature_position(ctx, row_sum, x, calibration_offset_x,
+                                     &feature_x[no_of_feats], &feature_subx[no_of_feats]);
+                no_of_feats++;
+                if (no_of_feats == max_features)
+                    break;
+            }
+        }
+    }
+    return(no_of_feats);
+}
+
+/* features detected within a band of rows by one thread */
+struct svs_band
+{
+    /* working buffers for the row being processed.  These begin
+     * zeroed, as in the context, since the scanning non-maximal
+     * suppression reads a few responses beyond those updated */
+    int* row_sum;
+    unsigned int* row_peaks;
+    unsigned int* non_max_window;
+
+    /* range of sampled rows, as indexes into features_per_row */
+    int first_row, last_row;
+
+    /* features for each row of the band, stored consecutively.
+     * Features beyond max_features within a band can never be
+     * returned, so the band stops once it has found that many */
+    short int* feature_x;
+    signed char* feature_subx;
+    unsigned int* descriptor;
+    unsigned char* mean;
+    unsigned short int* features_per_row;
+
+    /* scores and possible matches found by svs_match within the band */
+    unsigned int* match_scores;
+    unsigned int* matches;
+    int no_of_matches;
+    int* cross_check;
+
+    /* raw pixel of each pixel of the row being rectified, and
+     * the rolling buffer of rows rectified by svs_get_features */
+    int* rectify_index;
+    unsigned char* rectify_window;
+};
+
+/* Points the buffers of each band into the given arena, following the
+ * band structures themselves, and returns the number of bytes used.
+ * Called with a NULL arena to find the size */
+static size_t svs_band_buffers(
+    struct svs_context* ctx,
+    unsigned char* arena,
+    int bands)
+{
+    size_t offset = 0;
+    int width = (int)ctx->imgWidth;
+    int max_features = ctx->max_features;
+    int b;
+
+    struct svs_band* band = (struct svs_band*)svs_arena_buffer(arena, &offset, bands * sizeof(struct svs_band));
+    for (b = 0; b < bands; b++)
+    {
+        struct svs_band dummy;
+        struct svs_band* bnd = (band != NULL) ? &band[b] : &dummy;
+        bnd->row_sum = (int*)svs_arena_buffer(arena, &offset, width * sizeof(int));
+        bnd->row_peaks = (unsigned int*)svs_arena_buffer(arena, &offset, width * sizeof(unsigned int));
+        bnd->non_max_window = (unsigned int*)svs_arena_buffer(arena, &offset, 3 * svs_window_length(width) * sizeof(unsigned int));
+        bnd->feature_x = (short int*)svs_arena_buffer(arena, &offset, max_features * sizeof(short int));
+        bnd->feature_subx = (signed char*)svs_arena_buffer(arena, &offset, max_features * sizeof(signed char));
+        bnd->descriptor = (unsigned int*)svs_arena_buffer(arena, &offset, max_features * SVS_DESCRIPTOR_WORDS * sizeof(unsigned int));
+        bnd->mean = (unsigned char*)svs_arena_buffer(arena, &offset, max_features * sizeof(unsigned char));
+        bnd->features_per_row = (unsigned short int*)svs_arena_buffer(arena, &offset, ctx->feature_rows * sizeof(unsigned short int));
+        bnd->match_scores = (unsigned int*)svs_arena_buffer(arena, &offset, max_features * sizeof(unsigned int));
+        bnd->matches = (unsigned int*)svs_arena_buffer(arena, &offset, max_features * 4 * sizeof(unsigned int));
+        bnd->cross_check = (int*)svs_arena_buffer(arena, &offset, (width + max_features) * 2 * sizeof(int));
+        bnd->rectify_index = (int*)svs_arena_buffer(arena, &offset, width * sizeof(int));
+        bnd->rectify_window = (unsigned char*)svs_arena_buffer(arena, &offset, svs_rectify_window_bytes(width));
+    }
+    ctx->bands = band;
+    return(offset);
+}
+
+/* Returns the number of bands of rows to be processed in parallel,
+ * creating the threads and band buffers when this changes.  Returns one
+ * if only a single thread is to be used, or if the buffers could not
+ * be allocated */
+static int svs_bands(
+    struct svs_context* ctx)
+{
+    int bands = ctx->threads;
+    if ((bands > 1) && (bands != ctx->no_of_bands))
+    {
+        /* create the threads and band buffers */
+        svs_pool_free(ctx->pool);
+        free(ctx->band_arena);
+        ctx->pool = svs_pool_create(bands);
+        unsigned char* arena = svs_arena_alloc(svs_band_buffers(ctx, NULL, bands), &ctx->band_arena);
+        ctx->no_of_bands = 0;
+        if (arena != NULL)
+        {
+            svs_band_buffers(ctx, arena, bands);
+            ctx->no_of_bands = bands;
+        }
+    }
+    if (bands > ctx->no_of_bands)
+        bands = 1;
+    return(bands);
+}
+
+/* parameters shared by every band of svs_get_features */
+struct svs_band_params
+{
+    struct svs_context* ctx;
+    unsigned char* rectified_frame_buf;
+    int inhibition_radius;
+    unsigned int minimum_response;
+    int calibration_offset_x;
+    int first_y;
+    int rows;
+};
+
+/* returns the index of the control band containing the given sampled row */
+static inline int svs_control_band(
+    struct svs_context* ctx,
+    int row,     /* index of the sampled row */
+    int rows)    /* number of sampled rows */
+{
+    return(row * ctx->control_bands / rows);
+}
+
+/* returns the inhibition radius and minimum response to be used on a row,
+ * which are adapted by the feature budget controller when it is enabled */
+static inline void svs_row_thresholds(
+    struct svs_context* ctx,
+    int row,                          /* index of the sampled row */
+    int rows,                         /* number of sampled rows */
+    int* inhibition_radius,           /* radius for non-maximal supression */
+    unsigned int* minimum_response)   /* minimum threshold */
+{
+    if (ctx->target_features > 0)
+    {
+        int b = svs_control_band(ctx, row, rows);
+        *inhibition_radius = ctx->control_radius[b];
+        *minimum_response = ctx->control_response[b];
+    }
+}
+
+/* Feature budget controller.  The target number of features is shared
+ * equally between control bands.  After each frame the minimum response
+ * within each band is scaled towards the value which would have given the
+ * band its share, damped so that noise in the feature count does not cause
+ * oscillation.  If the response reaches its limits and adapt_radius is set
+ * then the inhibition radius is adjusted instead.  Bands which were not
+ * completely searched because the feature buffer filled up are treated as
+ * having twice their share, so the thresholds rise until it no longer fills */
+static void svs_control_update(
+    struct svs_context* ctx,
+    int rows,             /* number of sampled rows */
+    int last_row)         /* last row searched, or rows if the buffer did not fill */
+{
+    int b, row, count, target, first_row;
+    unsigned int response;
+
+    target = ctx->target_features;
+    if (target > ctx->max_features)
+        target = ctx->max_features;
+    target /= ctx->control_bands;
+    if (target < 1)
+        target = 1;
+
+    row = 0;
+    for (b = 0; b < ctx->control_bands; b++)
+    {
+        /* features found within the band */
+        count = 0;
+        first_row = row;
+        while ((row < rows) && (svs_control_band(ctx, row, rows) == b))
+            count += ctx->svs_data.features_per_row[row++];
+        if ((row > first_row) && (last_row < row))
+        {
+            if (count < target*2)
+                count = target*2;
+        }
+
+        /* damped proportional update of the minimum response */
+        response = ctx->control_response[b];
+        response = response * (unsigned int)(count + target*3) / (unsigned int)(target*4);
+        if (response == ctx->control_response[b])
+        {
+            /* make sure that small responses can still move */
+            if (count > target + target/4)
+                response++;
+            else if ((count < target - target/4) && (response > 0))
+                response--;
+        }
+
+        if (response < SVS_CONTROL_MIN_RESPONSE)
+        {
+            response = SVS_CONTROL_MIN_RESPONSE;
+            if ((ctx->adapt_radius) && (count < target) &&
+                    (ctx->control_radius[b] > SVS_CONTROL_MIN_RADIUS))
+                ctx->control_radius[b]--;
+        }
+        if (response > SVS_CONTROL_MAX_RESPONSE)
+        {
+            response = SVS_CONTROL_MAX_RESPONSE;
+            if ((ctx->adapt_radius) && (count > target) &&
+                    (ctx->control_radius[b] < SVS_CONTROL_MAX_RADIUS))
+                ctx->control_radius[b]++;
+        }
+        ctx->control_response[b] = response;
+    }
+}
+
+static void svs_rectified_rows(struct svs_context* ctx, unsigned char* raw_image,
+                               struct svs_rows* rows, int y, int* index);
+
+/* Sets the rows of the image read by svs_get_features up to the given
+ * sampled row.  These are the whole of the given image, or if
+ * rectify_rows is set, the rows rectified into the rolling buffer,
+ * which begins empty */
+static void svs_image_rows(
+    struct svs_context* ctx,      /* context for this camera */
+    unsigned char* image,         /* image passed to svs_get_features */
+    unsigned char* window,        /* rolling buffer of rectified rows */
+    struct svs_rows* rows,        /* returned rows */
+    int last_y)                   /* last sampled row */
+{
+    rows->first = 0;
+    if (ctx->rectify_rows)
+    {
+        rows->buffer = window;
+        rows->count = 0;
+        rows->last = last_y + ctx->descriptor_rows;
+    }
+    else
+    {
+        rows->buffer = image;
+        rows->count = (int)ctx->imgHeight;
+        rows->last = (int)ctx->imgHeight - 1;
+    }
+}
+
+/* detects features within one band of rows */
+static void svs_band_features(
+    void* arg,   /* svs_band_params */
+    int index)   /* index of the band */
+{
+    struct svs_band_params* params = (struct svs_band_params*)arg;
+    struct svs_context* ctx = params->ctx;
+    struct svs_band* band = &ctx->bands[index];
+    struct svs_rows window;
+    int row, y, n, inhibition_radius;
+    unsigned int minimum_response;
+    int no_of_features = 0;
+
+    svs_image_rows(ctx, params->rectified_frame_buf, band->rectify_window, &window,
+                   params->first_y + (band->last_row - 1) * SVS_VERTICAL_SAMPLING);
+
+    for (row = band->first_row; row < band->last_row; row++)
+    {
+        n = 0;
+        y = params->first_y + row * SVS_VERTICAL_SAMPLING;
+        if ((y >= 4) && (no_of_features < ctx->max_features))
+        {
+            inhibition_radius = params->inhibition_radius;
+            minimum_response = params->minimum_response;
+            svs_row_thresholds(ctx, row, params->rows, &inhibition_radius, &minimum_response);
+
+            if (ctx->rectify_rows)
+                svs_rectified_rows(ctx, params->rectified_frame_buf, &window, y, band->rectify_index);
+
+            n = svs_row_features(
+                    ctx, &window, y,
+                    inhibition_radius, minimum_response,
+                    params->calibration_offset_x,
+                    band->row_sum, band->row_peaks, band->non_max_window,
+                    &band->feature_x[no_of_features],
+                    &band->feature_subx[no_of_features],
+                    &band->descriptor[no_of_features*SVS_DESCRIPTOR_WORDS],
+                    &band->mean[no_of_features],
+                    ctx->max_features - no_of_features);
+            no_of_features += n;
+        }
+        band->features_per_row[row - band->first_row] = (unsigned short int)n;
+    }
+}
+
+/* Returns a set of features suitable for stereo matching.  The image is
+ * the raw image rather than the rectified one if rectify_rows is set */
+int svs_get_features(
+    struct svs_context* ctx,             /* context for this camera */
+    unsigned char* rectified_frame_buf,  /* image data */
+    int inhibition_radius,               /* radius for non-maximal supression */
+    unsigned int minimum_response,       /* minimum threshold */
+    int calibration_offset_x,            /* calibration x offset in pixels */
+    int calibration_offset_y)            /* calibration y offset in pixels */
+{
+
+    unsigned short int no_of_feats;
+    int y, b, row, rows, bands, last_row, row_radius;
+    unsigned int row_response;
+    int no_of_features = 0;
+    int row_idx = 0;
+
+    memset(ctx->svs_data.features_per_row, 0, ctx->feature_rows * sizeof(unsigned short));
+
+    /* number of sampled rows */
+    rows = 0;
+    for (y = 4 + calibration_offset_y; y < (int)ctx->imgHeight - 4; y += SVS_VERTICAL_SAMPLING)
+        rows++;
+    if (rows > ctx->feature_rows)
+        rows = ctx->feature_rows;
+    if (rows < 1)
+        return(0);
+    last_row = rows;
+
+    if (ctx->target_features > 0)
+    {
+        if (ctx->control_bands < 1) ctx->control_bands = 1;
+        if (ctx->control_bands > SVS_MAX_CONTROL_BANDS) ctx->control_bands = SVS_MAX_CONTROL_BANDS;
+
+        /* the controller starts from the given thresholds */
+        for (b = 0; b < ctx->control_bands; b++)
+        {
+            if (ctx->control_response[b] == 0)
+            {
+                ctx->control_response[b] = minimum_response;
+                ctx->control_radius[b] = inhibition_radius;
+            }
+        }
+    }
+
+    bands = svs_bands(ctx);
+    if (bands > 1)
+    {
+        struct svs_band_params params;
+        params.ctx = ctx;
+        params.rectified_frame_buf = rectified_frame_buf;
+        params.inhibition_radius = inhibition_radius;
+        params.minimum_response = minimum_response;
+        params.calibration_offset_x = calibration_offset_x;
+        params.first_y = 4 + calibration_offset_y;
+        params.rows = rows;
+
+        for (b = 0; b < bands; b++)
+        {
+            ctx->bands[b].first_row = rows * b / bands;
+            ctx->bands[b].last_row = rows * (b + 1) / bands;
+        }
+
+        svs_pool_run(ctx->pool, svs_band_features, &params, bands);
+
+        /* concatenate the bands in order of increasing y, stopping
+         * at the same feature as the single threaded version */
+        for (b = 0; b < bands; b++)
+        {
+            struct svs_band* band = &ctx->bands[b];
+            int band_feature = 0;
+            for (row = band->first_row; row < band->last_row; row++)
+            {
+                no_of_feats = band->features_per_row[row - band->first_row];
+                if (no_of_feats > ctx->max_features - no_of_features)
+                    no_of_feats = ctx->max_features - no_of_features;
+
+                memcpy(&ctx->svs_data.feature_x[no_of_features], &band->feature_x[band_feature], no_of_feats * sizeof(short int));
+                memcpy(&ctx->svs_data.feature_subx[no_of_features], &band->feature_subx[band_feature], no_of_feats * sizeof(signed char));
+                memcpy(&ctx->svs_data.descriptor[no_of_features*SVS_DESCRIPTOR_WORDS], &band->descriptor[band_feature*SVS_DESCRIPTOR_WORDS], no_of_feats * SVS_DESCRIPTOR_WORDS * sizeof(unsigned int));
+                memcpy(&ctx->svs_data.mean[no_of_features], &band->mean[band_feature], no_of_feats * sizeof(unsigned char));
+                ctx->svs_data.features_per_row[row] = no_of_feats;
+                band_feature += no_of_feats;
+                no_of_features += no_of_feats;
+
+                if (no_of_features == ctx->max_features)
+                {
+                    printf("stereo feature buffer full\n");
+                    last_row = row;
+                    b = bands;
+                    break;
                 }
             }
         }
+    }
+    else
+    {
+        struct svs_rows window;
+        svs_image_rows(ctx, rectified_frame_buf, ctx->rectify_window, &window,
+                       4 + calibration_offset_y + (rows - 1) * SVS_VERTICAL_SAMPLING);
+
+        for (y = 4 + calibration_offset_y; row_idx < rows; y += SVS_VERTICAL_SAMPLING)
+        {
+
+            /* reset number of features on the row */
+            no_of_feats = 0;
+
+            if ((y >= 4) && (y <= (int)ctx->imgHeight - 4))
+            {
+                row_radius = inhibition_radius;
+                row_response = minimum_response;
+                svs_row_thresholds(ctx, row_idx, rows, &row_radius, &row_response);
+
+                if (ctx->rectify_rows)
+                    svs_rectified_rows(ctx, rectified_frame_buf, &window, y, ctx->rectify_index);
+
+                no_of_feats = svs_row_features(
+                                  ctx, &window, y,
+                                  row_radius, row_response,
+                                  calibration_offset_x,
+                                  ctx->row_sum, ctx->row_peaks, ctx->non_max_window,
+                                  &ctx->svs_data.feature_x[no_of_features],
+                                  &ctx->svs_data.feature_subx[no_of_features],
+                                  &ctx->svs_data.descriptor[no_of_features*SVS_DESCRIPTOR_WORDS],
+                                  &ctx->svs_data.mean[no_of_features],
+                                  ctx->max_features - no_of_features);
+                no_of_features += no_of_feats;
+                if (no_of_features == ctx->max_features)
+                {
+                    ctx->svs_data.features_per_row[row_idx] = no_of_feats;
+                    printf("stereo feature buffer full\n");
+                    last_row = row_idx;
+                    break;
+                }
+            }
 
-        svs_data.features_per_row[row_idx++] = no_of_feats;
+            ctx->svs_data.features_per_row[row_idx++] = no_of_feats;
+        }
     }
+
+    /* adapt the thresholds for the next frame */
+    if (ctx->target_features > 0)
+        svs_control_update(ctx, rows, last_row);
+
     return(no_of_features);
 }
 
@@ -478,6 +1611,7 @@ int svs_get_features(
 
 /* updates a set of features suitable for stereo matching */
 int svs_grab(
+    struct svs_context* ctx,   /* context for this camera */
     int calibration_offset_x,  /* calibration x offset in pixels */
     int calibration_offset_y)  /* calibration y offset in pixels */
 {
@@ -485,482 +1619,2335 @@ int svs_grab(
     const int inhibition_radius = 16;
     const unsigned int minimum_response = 180;
 
-    /* grab new frame */
-    move_image((unsigned char *)DMA_BUF1, (unsigned char *)DMA_BUF2, (unsigned char *)FRAME_BUF, imgWidth, imgHeight);
+    /* grab new frame */
+    move_image((unsigned char *)DMA_BUF1, (unsigned char *)DMA_BUF2, (unsigned char *)FRAME_BUF, ctx->imgWidth, ctx->imgHeight);
+
+    /* convert to YUV */
+    move_yuv422_to_planar((unsigned char *)FRAME_BUF, (unsigned char *)FRAME_BUF3, ctx->imgWidth, ctx->imgHeight);
+
+    /* rectify the image */
+    svs_rectify(ctx, (unsigned char *)FRAME_BUF3, (unsigned char *)FRAME_BUF4);
+
+    /* compute edge features */
+    return(svs_get_features(ctx, (unsigned char *)FRAME_BUF4, inhibition_radius, minimum_response, calibration_offset_x, calibration_offset_y));
+}
+
+#endif
+
+/* adds a possible match to the list of matches for a row, returning the new number of matches */
+static inline int svs_add_match(
+    struct svs_context* ctx,    /* context for the left camera */
+    int fL,                     /* index of the left camera feature */
+    int fR,                     /* index of the right camera feature */
+    int y,                      /* y coordinate of the row */
+    unsigned int prob,          /* matching probability */
+    unsigned int* matches,      /* matches for the row (prob,x,y,disp) */
+    int no_of_matches)          /* number of matches so far */
+{
+    int xL, disp;
+
+    /* possible disparity */
+    xL = ctx->svs_data.feature_x[fL];
+    disp = xL - ctx->svs_data_received.feature_x[fR];
+
+    if (disp >= -10)
+    {
+        if (ctx->subpixel)
+        {
+            /* fixed point disparity */
+            disp = disp * SVS_SUBPIXEL +
+                   ctx->svs_data.feature_subx[fL] -
+                   ctx->svs_data_received.feature_subx[fR];
+        }
+        if (disp < 0)
+            disp = 0;
+        /* add the best result to the list of possible matches */
+        matches[no_of_matches*4] = prob;
+        matches[no_of_matches*4 + 1] = (unsigned int)xL;
+        matches[no_of_matches*4 + 2] = (unsigned int)y;
+        matches[no_of_matches*4 + 3] = (unsigned int)disp;
+        no_of_matches++;
+    }
+    return(no_of_matches);
+}
+
+/* Computes the eigendescriptors of the features received from the
+ * opposite camera on one row, relative to the mean descriptor of the row */
+static void svs_received_eigen(
+    struct svs_context* ctx,   /* context for the left camera */
+    int row)                   /* index of the sampled row */
+{
+    int R, bit, w;
+    int fR = ctx->received_offset[row];
+    int no_of_feats_right = ctx->svs_data_received.features_per_row[row];
+    unsigned int meandescR[SVS_DESCRIPTOR_WORDS];
+    short meandesc[SVS_DESCRIPTOR_PIXELS];
+    unsigned int *desc;
+
+    /* compute mean descriptor for the right row
+     * this will be used to create eigendescriptors */
+    memset(meandescR, 0, sizeof(meandescR));
+    memset(meandesc, 0, (SVS_DESCRIPTOR_PIXELS)* sizeof(short));
+    for (R = 0; R < no_of_feats_right; R++)
+    {
+        desc = &ctx->svs_data_received.descriptor[(fR + R)*SVS_DESCRIPTOR_WORDS];
+        for (bit = 0; bit < SVS_DESCRIPTOR_PIXELS; bit++)
+            meandesc[bit] += (desc[bit / 32] >> (bit % 32)) & 1;
+    }
+    for (bit = 0; bit < SVS_DESCRIPTOR_PIXELS; bit++)
+    {
+        /* more bits set than clear */
+        if (meandesc[bit]*2 - no_of_feats_right > 0)
+            meandescR[bit / 32] |= 1u << (bit % 32);
+    }
+
+    /* right camera feature eigendescriptors */
+    for (R = 0; R < no_of_feats_right; R++)
+    {
+        desc = &ctx->svs_data_received.descriptor[(fR + R)*SVS_DESCRIPTOR_WORDS];
+        for (w = 0; w < SVS_DESCRIPTOR_WORDS; w++)
+            ctx->eigen_descriptor[(fR + R)*SVS_DESCRIPTOR_WORDS + w] = desc[w] & meandescR[w];
+    }
+}
+
+/* Computes the mean descriptor of the features along one row of the
+ * left camera image, used to create their eigendescriptors */
+static void svs_left_mean(
+    struct svs_context* ctx,   /* context for the left camera */
+    int fL,                    /* index of the first feature on the row */
+    int no_of_feats_left,      /* number of features on the row */
+    unsigned int* meandescL)   /* returned mean descriptor */
+{
+    int L, bit;
+    short meandesc[SVS_DESCRIPTOR_PIXELS];
+    unsigned int *desc;
+
+    memset(meandescL, 0, SVS_DESCRIPTOR_WORDS * sizeof(unsigned int));
+    memset(meandesc, 0, (SVS_DESCRIPTOR_PIXELS)* sizeof(short));
+    for (L = 0; L < no_of_feats_left; L++)
+    {
+        desc = &ctx->svs_data.descriptor[(fL + L)*SVS_DESCRIPTOR_WORDS];
+        for (bit = 0; bit < SVS_DESCRIPTOR_PIXELS; bit++)
+            meandesc[bit] += (desc[bit / 32] >> (bit % 32)) & 1;
+    }
+    for (bit = 0; bit < SVS_DESCRIPTOR_PIXELS; bit++)
+    {
+        /* more bits set than clear */
+        if (meandesc[bit]*2 - no_of_feats_left >= 0)
+            meandescL[bit / 32] |= 1u << (bit % 32);
+    }
+}
+
+/* computes the eigendescriptor of a left camera feature, and the
+ * same descriptor with its bits reversed for anti-correlation matching */
+static inline void svs_left_eigen(
+    const unsigned int* desc,        /* descriptor of the feature */
+    const unsigned int* meandescL,   /* mean descriptor of the row */
+    unsigned int* descL,             /* returned eigendescriptor */
+    unsigned int* descLanti)         /* returned reversed eigendescriptor */
+{
+    int w;
+
+    for (w = 0; w < SVS_DESCRIPTOR_WORDS; w++)
+        descL[w] = desc[w] & meandescL[w];
+    for (w = 0; w < SVS_DESCRIPTOR_WORDS; w++)
+        descLanti[w] = svs_reverse_bits(descL[SVS_DESCRIPTOR_WORDS - 1 - w]);
+    descLanti[0] >>= SVS_DESCRIPTOR_WORDS*32 - SVS_DESCRIPTOR_PIXELS;
+}
+
+/* Moves the range of right camera features first..last forwards to
+ * cover disparities from min_disp to max_disp for a left camera feature.
+ * Features are in order of decreasing x, so as we move along the left
+ * camera row the range can only move forwards */
+static inline void svs_match_window(
+    struct svs_context* ctx,   /* context for the left camera */
+    int xL,                    /* x coordinate of the left camera feature */
+    int fR,                    /* index of the first right camera feature */
+    int min_disp,              /* minimum disparity */
+    int max_disp,              /* maximum disparity */
+    int end,                   /* end of the right camera row, relative to fR */
+    int* first,                /* first feature within the range, relative to fR */
+    int* last)                 /* feature following the range, relative to fR */
+{
+    while ((*first < end) &&
+            (xL - ctx->svs_data_received.feature_x[fR + *first] < min_disp))
+        (*first)++;
+    if (*last < *first)
+        *last = *first;
+    while ((*last < end) &&
+            (xL - ctx->svs_data_received.feature_x[fR + *last] <= max_disp))
+        (*last)++;
+}
+
+/* Returns the highest total probability of the scanline matcher using the
+ * first i+1 left camera features and the first j right camera features.
+ * Only the costs within the disparity range of each left camera feature
+ * are stored.  Since the ranges only move forwards along the row, j is
+ * never before the range of feature i, and beyond the range the cost
+ * does not change */
+static inline int svs_scanline_cost(
+    const int* cost,    /* costs of each left camera feature */
+    const int* start,   /* index of the first cost of each left camera feature */
+    const int* first,   /* first right camera feature within the range of each */
+    int i,              /* index of the left camera feature */
+    int j)              /* number of right camera features */
+{
+    int k;
+
+    if (i < 0)
+        return(0);
+    k = j - first[i];
+    if (k > start[i + 1] - start[i] - 1)
+        k = start[i + 1] - start[i] - 1;
+    return(cost[start[i] + k]);
+}
+
+/* Adds a left camera feature to the dynamic programming table of the
+ * scanline matcher, given the scores of the right camera features from
+ * first to last within its disparity range.  Each left and right camera
+ * feature is matched at most once, and matches may not cross, so the
+ * cost of the first j right camera features is the best of leaving
+ * either feature unmatched, or matching the two, which adds the matching
+ * probability.  Returns zero if there is no room for the costs */
+static int svs_scanline_step(
+    int* cost,                  /* costs of each left camera feature */
+    int* start,                 /* index of the first cost of each left camera feature */
+    int* first_R,               /* first right camera feature within the range of each */
+    int capacity,               /* maximum number of costs */
+    int i,                      /* index of the left camera feature */
+    int first,                  /* first right camera feature within range */
+    int last,                   /* right camera feature following the range */
+    const unsigned int* scores, /* matching scores of the right camera features */
+    unsigned int total,         /* total matching score */
+    unsigned int max_prob)      /* maximum probability accepted */
+{
+    int j, v, d;
+    unsigned int prob;
+    int* c;
+
+    if (start[i] + last - first + 1 > capacity)
+        return(0);
+    start[i + 1] = start[i] + last - first + 1;
+    first_R[i] = first;
+
+    c = &cost[start[i]];
+    c[0] = svs_scanline_cost(cost, start, first_R, i - 1, first);
+    for (j = first + 1; j <= last; j++)
+    {
+        v = svs_scanline_cost(cost, start, first_R, i - 1, j);
+        if (c[j - first - 1] > v)
+            v = c[j - first - 1];
+        if (total > 0)
+        {
+            prob = scores[j - 1] * 1000 / total;
+            if ((prob > 0) && (prob <= max_prob))
+            {
+                d = svs_scanline_cost(cost, start, first_R, i - 1, j - 1) + (int)prob;
+                if (d > v)
+                    v = d;
+            }
+        }
+        c[j - first] = v;
+    }
+    return(1);
+}
+
+/* Traces back through the dynamic programming table of the scanline
+ * matcher from its last left camera feature, storing the matches along
+ * the row in the same order as the greedy matcher.  Returns the number
+ * of matches stored */
+static int svs_scanline_matches(
+    struct svs_context* ctx,    /* context for the left camera */
+    const int* cost,            /* costs of each left camera feature */
+    const int* start,           /* index of the first cost of each left camera feature */
+    const int* first_R,         /* first right camera feature within the range of each */
+    int no_of_feats_left,       /* number of left camera features in the table */
+    int fL,                     /* index of the first left camera feature */
+    int fR,                     /* index of the first right camera feature */
+    int y,                      /* y coordinate of the row */
+    unsigned int* matches,      /* returned matches (prob,x,y,disp) */
+    int max_matches)            /* maximum number of matches to store */
+{
+    int i, j, v, k, no_of_matches = 0;
+    unsigned int tmp[4];
+
+    i = no_of_feats_left - 1;
+    j = (i >= 0) ? first_R[i] + start[i + 1] - start[i] - 1 : 0;
+    while (i >= 0)
+    {
+        if (j > first_R[i] + start[i + 1] - start[i] - 1)
+            j = first_R[i] + start[i + 1] - start[i] - 1;
+        if (j == first_R[i])
+        {
+            /* no right camera feature left to match */
+            i--;
+            continue;
+        }
+        v = cost[start[i] + j - first_R[i]];
+        if (v == svs_scanline_cost(cost, start, first_R, i - 1, j))
+        {
+            /* left camera feature unmatched */
+            i--;
+        }
+        else if (v == cost[start[i] + j - first_R[i] - 1])
+        {
+            /* right camera feature unmatched */
+            j--;
+        }
+        else
+        {
+            if (no_of_matches < max_matches)
+                no_of_matches = svs_add_match(
+                                    ctx, fL + i, fR + j - 1, y,
+                                    (unsigned int)(v - svs_scanline_cost(cost, start, first_R, i - 1, j - 1)),
+                                    matches, no_of_matches);
+            i--;
+            j--;
+        }
+    }
+
+    /* the matches were found in reverse order along the row */
+    for (k = 0; k < no_of_matches / 2; k++)
+    {
+        memcpy(tmp, &matches[k*4], sizeof(tmp));
+        memcpy(&matches[k*4], &matches[(no_of_matches - 1 - k)*4], sizeof(tmp));
+        memcpy(&matches[(no_of_matches - 1 - k)*4], tmp, sizeof(tmp));
+    }
+    return(no_of_matches);
+}
+
+/* Matches the features along one row of the left camera image with those
+ * from the opposite camera, storing at most max_matches possible matches
+ * as (prob,x,y,disp).  Returns the number stored.  Right camera features
+ * within ctx->match_rows sampled rows above or below are also considered,
+ * with their scores reduced by ctx->row_penalty for each row of offset,
+ * except by the scanline matcher, which only considers the same row */
+static int svs_match_row(
+    struct svs_context* ctx,                /* context for the left camera */
+    const struct svs_match_params* weights, /* matching weights */
+    int row,                                /* index of the sampled row */
+    int rows,                               /* number of sampled rows */
+    int y,                                  /* y coordinate of the row */
+    unsigned int* scores,                   /* buffer for matching scores */
+    int* cross_check,                       /* buffer used by the consistency check and scanline matcher */
+    unsigned int* matches,                  /* returned matches */
+    int max_matches,                        /* maximum number of matches to store */
+    int temporal)                           /* non-zero if disparities predicted from the previous frame are searched first */
+{
+    int xL, L, R, no_of_feats_left, no_of_feats_right, r, n;
+    int max_disp, meanL, fL, fR, bestR=0, first_row, last_row;
+    int first_R[SVS_MAX_MATCH_ROWS*2 + 1], last_R[SVS_MAX_MATCH_ROWS*2 + 1];
+    int row_end[SVS_MAX_MATCH_ROWS*2 + 1];
+    int prior, prior_min, prior_max, pass, scanline, scanline_feats;
+    unsigned int descL[SVS_DESCRIPTOR_WORDS], descLanti[SVS_DESCRIPTOR_WORDS];
+    unsigned int total, best_score, best_prob, threshold;
+    struct svs_match_params params;
+    int no_of_matches = 0;
+
+    unsigned int meandescL[SVS_DESCRIPTOR_WORDS];
+
+    params = *weights;
+    params.descL = descL;
+    params.descLanti = descLanti;
+    max_disp = params.max_disp;
+
+    /* rows of right camera features to be searched */
+    scanline = (ctx->matcher == SVS_MATCHER_SCANLINE);
+    first_row = row - ((scanline) ? 0 : ctx->match_rows);
+    if (first_row < 0)
+        first_row = 0;
+    last_row = row + ((scanline) ? 0 : ctx->match_rows) + 1;
+    if (last_row > rows)
+        last_row = rows;
+
+    /* index of the first feature on the row, and number of features on left and right rows.
+     * The right camera features of the rows searched are stored consecutively from fR */
+    fL = ctx->feature_offset[row];
+    fR = ctx->received_offset[first_row];
+    no_of_feats_left = ctx->svs_data.features_per_row[row];
+
+    /* For the consistency check, the best right camera feature for each
+     * left camera feature and its probability, and the best left camera
+     * feature for each right camera feature and its score.  Since the
+     * total score of a right camera feature is the same for every left
+     * camera feature, the best left feature is the one with the highest
+     * score, so the scores are shared by both directions */
+    int* left_best = cross_check;
+    int* left_prob = &cross_check[ctx->imgWidth];
+    int* right_best = &cross_check[ctx->imgWidth*2];
+    int* right_score = &cross_check[ctx->imgWidth*2 + ctx->max_features];
+
+    /* The scanline matcher shares the same buffer, holding the index of the
+     * first cost and the first right camera feature within range for each
+     * left camera feature, followed by the costs themselves */
+    int* scanline_start = cross_check;
+    int* scanline_first = &cross_check[ctx->imgWidth];
+    int* scanline_cost = &cross_check[ctx->imgWidth*2];
+
+    /* compute mean descriptor for the left row
+     * this will be used to create eigendescriptors */
+    svs_left_mean(ctx, fL, no_of_feats_left, meandescL);
+
+    /* Range of disparities predicted from the previous frame.  This always
+     * extends down to zero disparity, so that distant features, which the
+     * filter relies upon to classify the scene as near or far, are kept.
+     * The scanline matcher orders the features of the whole row at once,
+     * so cannot search again for individual features, and ignores it */
+    prior = 0;
+    prior_min = 0;
+    prior_max = 0;
+    if ((temporal) && (!scanline) &&
+            (ctx->prior_disp[row*2] <= ctx->prior_disp[row*2 + 1]))
+    {
+        prior_min = ctx->prior_disp[row*2] - ctx->prior_margin;
+        prior_max = ctx->prior_disp[row*2 + 1] + ctx->prior_margin;
+        if (prior_min > -ctx->prior_margin)
+            prior_min = -ctx->prior_margin;
+        if (prior_min < -max_disp + 1)
+            prior_min = -max_disp + 1;
+        if (prior_max > max_disp - 1)
+            prior_max = max_disp - 1;
+        prior = (prior_min <= prior_max);
+    }
+
+    /* best right camera feature for each left camera feature, or -1 if
+     * it has not yet been matched */
+    for (L = 0; L < no_of_feats_left; L++)
+        left_best[L] = -1;
+
+    /* The predicted range of disparities is searched first, and each left
+     * camera feature without an acceptable match within it, or whose match
+     * is not consistent, is searched for again over the full range, so that
+     * features which have come closer than predicted are still found.  A
+     * feature with only a single candidate has a probability of 1000, and
+     * is rejected as there is nothing to compare it against */
+    for (pass = (prior ? 0 : 1); pass < 2; pass++)
+    {
+        if (pass == 1)
+        {
+            prior_min = -max_disp + 1;
+            prior_max = max_disp - 1;
+        }
+
+        /* matches with lower disparities are discarded by svs_add_match,
+         * so would only constrain the order of the scanline matches */
+        if ((scanline) && (prior_min < -10))
+            prior_min = -10;
+
+        /* Features on each row are stored in order of decreasing x, so the
+         * right camera features on each row within disparity range of each
+         * left camera feature lie between first_R and last_R, and both of
+         * these can only increase as we move along the row.  Features outside
+         * of the range would have a zero matching score.  Indexes are relative
+         * to fR */
+        no_of_feats_right = 0;
+        for (n = 0; n < last_row - first_row; n++)
+        {
+            first_R[n] = no_of_feats_right;
+            last_R[n] = no_of_feats_right;
+            no_of_feats_right += ctx->svs_data_received.features_per_row[first_row + n];
+            row_end[n] = no_of_feats_right;
+        }
+
+        /* scanline_start shares its buffer with left_best */
+        if (scanline)
+            scanline_start[0] = 0;
+        scanline_feats = no_of_feats_left;
+
+        if ((ctx->consistency) && (!scanline))
+        {
+            /* right camera features already paired within the predicted
+             * range keep their left camera feature */
+            for (R = 0; R < no_of_feats_right; R++)
+            {
+                if ((pass == 1) && (prior) && (right_best[R] > -1) &&
+                        (left_best[right_best[R]] == R))
+                {
+                    right_score[R] = 0x7fffffff;
+                }
+                else
+                {
+                    right_best[R] = -1;
+                    right_score[R] = 0;
+                }
+            }
+        }
+
+        /* features along the row in the left camera */
+        for (L = 0; L < no_of_feats_left; L++)
+        {
+
+            /* already matched within the predicted range.  The scanline
+             * matcher makes a single pass, and its table shares the
+             * buffer with left_best, so is not tested */
+            if ((!scanline) && (left_best[L] > -1))
+                continue;
+
+            /* x coordinate of the feature in the left camera */
+            xL = ctx->svs_data.feature_x[fL + L];
+
+            /* mean luminance and eigendescriptor for the left camera feature */
+            meanL = ctx->svs_data.mean[fL + L];
+            svs_left_eigen(&ctx->svs_data.descriptor[(fL + L)*SVS_DESCRIPTOR_WORDS],
+                           meandescL, descL, descLanti);
+
+            params.xL = xL;
+            params.meanL = meanL;
+            total = 0;
+            for (n = 0; n < last_row - first_row; n++)
+            {
+                /* range of right camera features with prior_min <= disp <= prior_max */
+                svs_match_window(ctx, xL, fR, prior_min, prior_max, row_end[n], &first_R[n], &last_R[n]);
+
+                /* score the features along the row in the right camera */
+                r = first_row + n;
+                params.penalty = ctx->row_penalty * ((r > row) ? (r - row) : (row - r));
+                total += svs_match_scores(
+                             ctx, &params,
+                             &ctx->eigen_descriptor[(fR + first_R[n])*SVS_DESCRIPTOR_WORDS],
+                             &ctx->svs_data_received.feature_x[fR + first_R[n]],
+                             &ctx->svs_data_received.mean[fR + first_R[n]],
+                             last_R[n] - first_R[n], &scores[first_R[n]]);
+            }
+
+            if (scanline)
+            {
+                /* add the feature to the table, or if there is no
+                 * room then leave the rest of the row unmatched */
+                if (!svs_scanline_step(
+                            scanline_cost, scanline_start, scanline_first,
+                            ctx->max_features*2, L, first_R[0], last_R[0],
+                            scores, total, 999))
+                {
+                    scanline_feats = L;
+                    break;
+                }
+                continue;
+            }
+
+            /* non-zero total matching score */
+            if (total > 0)
+            {
+
+                /* The match probability of each feature is its score * 1000 / total.
+                 * The highest probability belongs to the highest score, and the
+                 * first feature with that probability is chosen.  This avoids
+                 * dividing the score of every feature */
+                best_score = 0;
+                for (n = 0; n < last_row - first_row; n++)
+                {
+                    for (R = first_R[n]; R < last_R[n]; R++)
+                    {
+                        if (scores[R] > best_score)
+                            best_score = scores[R];
+                    }
+                }
+                best_prob = best_score * 1000 / total;
+                if (best_prob > 0)
+                {
+                    threshold = best_prob * total;
+                    for (n = 0; n < last_row - first_row; n++)
+                    {
+                        for (R = first_R[n]; R < last_R[n]; R++)
+                        {
+                            if (scores[R] * 1000 >= threshold)
+                                break;
+                        }
+                        if (R < last_R[n])
+                        {
+                            bestR = R;
+                            break;
+                        }
+                    }
+                }
+
+                if (ctx->consistency)
+                {
+                    /* best left camera feature for each right camera feature */
+                    for (n = 0; n < last_row - first_row; n++)
+                    {
+                        for (R = first_R[n]; R < last_R[n]; R++)
+                        {
+                            if ((int)scores[R] > right_score[R])
+                            {
+                                right_score[R] = (int)scores[R];
+                                right_best[R] = L;
+                            }
+                        }
+                    }
+                }
+
+                if ((best_prob > 0) && (best_prob < 1000))
+                {
+                    left_best[L] = bestR;
+                    left_prob[L] = (int)best_prob;
+                }
+            }
+        }
+
+        if ((ctx->consistency) && (!scanline))
+        {
+            /* keep only pairs of features which are each other's best match.
+             * Right camera features on other rows may match left camera features
+             * on those rows more closely, but only this row is checked */
+            for (L = 0; L < no_of_feats_left; L++)
+            {
+                R = left_best[L];
+                if ((R > -1) && (right_best[R] != L))
+                    left_best[L] = -1;
+            }
+        }
+    }
+
+    if (scanline)
+    {
+        no_of_matches = svs_scanline_matches(
+                            ctx, scanline_cost, scanline_start, scanline_first,
+                            scanline_feats, fL, fR, y, matches, max_matches);
+    }
+    else
+    {
+        /* matches in order along the row */
+        for (L = 0; L < no_of_feats_left; L++)
+        {
+            R = left_best[L];
+            if ((R > -1) && (no_of_matches < max_matches))
+                no_of_matches = svs_add_match(ctx, fL + L, fR + R, y, (unsigned int)left_prob[L], matches, no_of_matches);
+        }
+    }
+    return(no_of_matches);
+}
+
+/* parameters shared by every band of svs_match */
+struct svs_match_band_params
+{
+    struct svs_context* ctx;
+    struct svs_match_params weights;
+    int rows;
+    int temporal;
+};
+
+/* computes eigendescriptors for the right camera features within one band of rows */
+static void svs_band_eigen(
+    void* arg,   /* svs_match_band_params */
+    int index)   /* index of the band */
+{
+    struct svs_match_band_params* params = (struct svs_match_band_params*)arg;
+    struct svs_band* band = &params->ctx->bands[index];
+    int row;
+
+    for (row = band->first_row; row < band->last_row; row++)
+        svs_received_eigen(params->ctx, row);
+}
+
+/* matches the features within one band of rows */
+static void svs_band_matches(
+    void* arg,   /* svs_match_band_params */
+    int index)   /* index of the band */
+{
+    struct svs_match_band_params* params = (struct svs_match_band_params*)arg;
+    struct svs_context* ctx = params->ctx;
+    struct svs_band* band = &ctx->bands[index];
+    int row;
+
+    band->no_of_matches = 0;
+    for (row = band->first_row; row < band->last_row; row++)
+    {
+        band->no_of_matches += svs_match_row(
+                                   ctx, &params->weights, row, params->rows,
+                                   4 + row * SVS_VERTICAL_SAMPLING,
+                                   band->match_scores, band->cross_check,
+                                   &band->matches[band->no_of_matches*4],
+                                   ctx->max_features - band->no_of_matches,
+                                   params->temporal);
+    }
+}
+
+/* Stores the range of disparities, in whole pixels, of the possible matches
+ * which survived filtering on each sampled row and its neighbours.  Used
+ * to predict the disparities of the next frame when ctx->temporal is set.
+ * Rows without any matches have an empty range */
+static void svs_update_prior(
+    struct svs_context* ctx,      /* context for the left camera */
+    int no_of_possible_matches)   /* number of possible matches */
+{
+    int i, row, r, disp;
+    int* prior = ctx->prior_disp;
+
+    for (row = 0; row < ctx->feature_rows; row++)
+    {
+        prior[row*2] = 1;
+        prior[row*2 + 1] = 0;
+    }
+
+    for (i = 0; i < no_of_possible_matches; i++)
+    {
+        if (ctx->svs_matches[i*4] == 0)
+            continue;
+        row = ((int)ctx->svs_matches[i*4 + 2] - 4) / SVS_VERTICAL_SAMPLING;
+        disp = (int)ctx->svs_matches[i*4 + 3];
+        if (ctx->subpixel)
+            disp = (disp + SVS_SUBPIXEL/2) >> SVS_SUBPIXEL_BITS;
+        for (r = row - 1; r <= row + 1; r++)
+        {
+            if ((r < 0) || (r >= ctx->feature_rows))
+                continue;
+            if (prior[r*2] > prior[r*2 + 1])
+            {
+                prior[r*2] = disp;
+                prior[r*2 + 1] = disp;
+            }
+            else
+            {
+                if (disp < prior[r*2]) prior[r*2] = disp;
+                if (disp > prior[r*2 + 1]) prior[r*2 + 1] = disp;
+            }
+        }
+    }
+}
+
+/* returns non-zero if possible match a is better than possible match b.
+ * Of matches with equal probability the earliest is preferred */
+static inline int svs_better_match(
+    const unsigned int* matches,   /* possible matches (prob,x,y,disp) */
+    int a,                         /* index of the first match */
+    int b)                         /* index of the second match */
+{
+    return((matches[a*4] > matches[b*4]) ||
+           ((matches[a*4] == matches[b*4]) && (a < b)));
+}
+
+/* restores the heap property below the given position within a heap
+ * of match indexes, where the worst match is at the root */
+static void svs_match_heap_down(
+    const unsigned int* matches,   /* possible matches (prob,x,y,disp) */
+    int* heap,                     /* heap of match indexes */
+    int size,                      /* number of entries in the heap */
+    int pos)                       /* position to sift down from */
+{
+    int child, v = heap[pos];
+    while ((child = pos*2 + 1) < size)
+    {
+        if ((child + 1 < size) && (svs_better_match(matches, heap[child], heap[child + 1])))
+            child++;
+        if (!svs_better_match(matches, v, heap[child]))
+            break;
+        heap[pos] = heap[child];
+        pos = child;
+    }
+    heap[pos] = v;
+}
+
+/* Selects the possible matches to be returned by svs_match, moving them to
+ * the start of the matches according to ctx->match_output, and returns
+ * their number.  The best matches are found using a heap of at most
+ * ideal_no_of_matches entries, so only those which are returned are
+ * sorted.  Matches with zero probability are never returned */
+static int svs_select_matches(
+    struct svs_context* ctx,      /* context for the left camera */
+    unsigned int* matches,        /* possible matches (prob,x,y,disp) */
+    int* heap,                    /* buffer of max_features entries */
+    unsigned int* sorted,         /* buffer of max_features matches */
+    int no_of_possible_matches,   /* number of possible matches */
+    int ideal_no_of_matches)      /* ideal number of matches to be returned */
+{
+    int i, pos, size = 0, limit;
+
+    if (ctx->match_output == SVS_MATCHES_THRESHOLD)
+    {
+        /* keep the order of the matches, moving those above the threshold forwards */
+        for (i = 0; i < no_of_possible_matches; i++)
+        {
+            if ((matches[i*4] > 0) && (matches[i*4] >= ctx->match_threshold))
+            {
+                if (size != i)
+                    memcpy(&matches[size*4], &matches[i*4], 4 * sizeof(unsigned int));
+                size++;
+            }
+        }
+        return(size);
+    }
+
+    limit = no_of_possible_matches;
+    if ((ctx->match_output == SVS_MATCHES_BEST) && (ideal_no_of_matches < limit))
+        limit = ideal_no_of_matches;
+    if (limit <= 0)
+        return(0);
+
+    /* the heap holds the best matches so far, with the worst at its root */
+    for (i = 0; i < no_of_possible_matches; i++)
+    {
+        if (matches[i*4] == 0)
+            continue;
+        if (size < limit)
+        {
+            /* add to the heap */
+            pos = size++;
+            while ((pos > 0) && (svs_better_match(matches, heap[(pos - 1) / 2], i)))
+            {
+                heap[pos] = heap[(pos - 1) / 2];
+                pos = (pos - 1) / 2;
+            }
+            heap[pos] = i;
+        }
+        else if (svs_better_match(matches, i, heap[0]))
+        {
+            /* replace the worst match */
+            heap[0] = i;
+            svs_match_heap_down(matches, heap, size, 0);
+        }
+    }
+
+    /* remove the worst match from the heap repeatedly, giving the
+     * match indexes in descending order of probability */
+    for (i = size - 1; i > 0; i--)
+    {
+        pos = heap[0];
+        heap[0] = heap[i];
+        heap[i] = pos;
+        svs_match_heap_down(matches, heap, i, 0);
+    }
+
+    for (i = 0; i < size; i++)
+        memcpy(&sorted[i*4], &matches[heap[i]*4], 4 * sizeof(unsigned int));
+    memcpy(matches, sorted, size * 4 * sizeof(unsigned int));
+    return(size);
+}
+
+/* Finds the index of the first feature on each row for both cameras,
+ * and returns the number of sampled rows to be matched */
+static int svs_match_rows(
+    struct svs_context* ctx)   /* context for the left camera */
+{
+    int y, row, rows;
+
+    ctx->feature_offset[0] = 0;
+    ctx->received_offset[0] = 0;
+    for (row = 1; row < ctx->feature_rows; row++)
+    {
+        ctx->feature_offset[row] = ctx->feature_offset[row - 1] + ctx->svs_data.features_per_row[row - 1];
+        ctx->received_offset[row] = ctx->received_offset[row - 1] + ctx->svs_data_received.features_per_row[row - 1];
+    }
+
+    /* number of sampled rows */
+    rows = 0;
+    for (y = 4; y < (int)ctx->imgHeight - 4; y += SVS_VERTICAL_SAMPLING)
+        rows++;
+
+    if (ctx->match_rows < 0)
+        ctx->match_rows = 0;
+    if (ctx->match_rows > SVS_MAX_MATCH_ROWS)
+        ctx->match_rows = SVS_MAX_MATCH_ROWS;
+    return(rows);
+}
+
+/* Match features from this camera with features from the opposite one.
+ * It is assumed that matching is performed on the left camera CPU.
+ * With more than one thread the rows are divided into bands, each
+ * matched by a separate thread, giving the same matches as the
+ * single threaded version */
+int svs_match(
+    struct svs_context* ctx,          /* context for the left camera */
+    int ideal_no_of_matches,          /* ideal number of matches to be returned */
+    int max_disparity_percent,        /* max disparity as a percent of image width */
+    int descriptor_match_threshold,   /* minimum no of descriptor bits to be matched, in the range 1 - SVS_DESCRIPTOR_PIXELS */
+    int learnDesc,                    /* descriptor match weight */
+    int learnLuma,                    /* luminance match weight */
+    int learnDisp)                    /* disparity weight */
+{
+
+    int y, row, rows, b, bands, n;
+    int max_disp;
+    struct svs_match_band_params params;
+    int no_of_possible_matches = 0, matches = 0;
+
+    /* convert max disparity from percent to pixels */
+    max_disp = max_disparity_percent * ctx->imgWidth / 100;
+
+    params.ctx = ctx;
+    params.weights.descL = NULL;
+    params.weights.descLanti = NULL;
+    params.weights.xL = 0;
+    params.weights.meanL = 0;
+    params.weights.max_disp = max_disp;
+    params.weights.threshold = descriptor_match_threshold;
+    params.weights.pixels = SVS_DESCRIPTOR_PIXELS;
+    params.weights.learnDesc = learnDesc;
+    params.weights.learnLuma = learnLuma;
+    params.weights.learnDisp = learnDisp;
+    params.weights.penalty = 0;
+
+    rows = svs_match_rows(ctx);
+    params.rows = rows;
+
+    /* every prior_keyframe frames the full range of disparities is searched,
+     * so that features are not missed indefinitely when a wrong match is
+     * found within the predicted range */
+    params.temporal = ctx->temporal;
+    if ((ctx->prior_keyframe > 0) && (ctx->prior_frame % ctx->prior_keyframe == 0))
+        params.temporal = 0;
+    ctx->prior_frame++;
+
+    bands = svs_bands(ctx);
+    if (bands > 1)
+    {
+        for (b = 0; b < bands; b++)
+        {
+            ctx->bands[b].first_row = rows * b / bands;
+            ctx->bands[b].last_row = rows * (b + 1) / bands;
+        }
+
+        /* the eigendescriptors of every row are needed before matching,
+         * since rows may be matched against their neighbours */
+        svs_pool_run(ctx->pool, svs_band_eigen, &params, bands);
+        svs_pool_run(ctx->pool, svs_band_matches, &params, bands);
+
+        /* concatenate the matches of each band in order of increasing y,
+         * stopping at the same match as the single threaded version */
+        for (b = 0; b < bands; b++)
+        {
+            n = ctx->bands[b].no_of_matches;
+            if (n > ctx->max_features - no_of_possible_matches)
+                n = ctx->max_features - no_of_possible_matches;
+            memcpy(&ctx->svs_matches[no_of_possible_matches*4], ctx->bands[b].matches, n * 4 * sizeof(unsigned int));
+            no_of_possible_matches += n;
+        }
+    }
+    else
+    {
+        for (row = 0; row < rows; row++)
+            svs_received_eigen(ctx, row);
+
+        y = 4;
+        for (row = 0; row < rows; row++, y += SVS_VERTICAL_SAMPLING)
+        {
+            no_of_possible_matches += svs_match_row(
+                                          ctx, &params.weights, row, rows, y,
+                                          ctx->match_scores, ctx->cross_check,
+                                          &ctx->svs_matches[no_of_possible_matches*4],
+                                          ctx->max_features - no_of_possible_matches,
+                                          params.temporal);
+        }
+    }
+
+    if (no_of_possible_matches > 1)
+    {
+
+        /* filter the results */
+        svs_filter(ctx, no_of_possible_matches, max_disp, 3);
+
+        /* predict the disparities within the next frame */
+        svs_update_prior(ctx, no_of_possible_matches);
+
+        /* select the matches to be returned */
+        matches = svs_select_matches(ctx, ctx->svs_matches, ctx->match_heap, ctx->match_sorted,
+                                     no_of_possible_matches, ideal_no_of_matches);
+    }
+    else
+    {
+        svs_update_prior(ctx, 0);
+    }
+    return(matches);
+}
+
+
+/* Returns the zone of a grid containing the given coordinate, given the
+ * boundaries between zones, or -1 if the coordinate lies on a boundary */
+static inline int svs_filter_zone(
+    unsigned int v,                /* coordinate */
+    const unsigned int* boundary,  /* parts+1 boundaries, from zero to the image size */
+    int parts)                     /* number of zones */
+{
+    int k = 0;
+
+    while ((k < parts) && (v >= boundary[k + 1]))
+        k++;
+    if ((k >= parts) || (v == boundary[k]))
+        return(-1);
+    return(k);
+}
+
+/* returns the number of disparities covered by the histogram of each
+ * zone within svs_filter_matches */
+static inline int svs_histogram_length(
+    struct svs_context* ctx,
+    int max_disparity_pixels)   /* maximum disparity in pixels */
+{
+    int length = max_disparity_pixels + 1;
+    if (length > (int)ctx->imgWidth)
+        length = (int)ctx->imgWidth;
+    if (length < 1)
+        length = 1;
+    return(length);
+}
+
+/* Removes noise from the given matches by searching for a peak in the
+ * disparity histogram of each zone of the image, as set by
+ * ctx->filter_grids and ctx->filter_grid.  The histograms of every zone
+ * are built in a single pass over the matches, and a second pass sets
+ * the probability of each match to zero unless it lies close to the
+ * peak of its zone within at least one of the grids.  Scenes without
+ * a clear peak are treated as distant, keeping only small disparities */
+static void svs_filter_matches(
+    struct svs_context* ctx,         /* context for the left camera */
+    unsigned int* matches,           /* possible matches (prob,x,y,disp) */
+    int* disparity_histogram,        /* buffer of SVS_MAX_FILTER_ZONES * svs_histogram_length entries */
+    int no_of_possible_matches,      /* the number of stereo matches */
+    int max_disparity_pixels,        /* maximum disparity in pixels */
+    int tolerance)                   /* tolerance around the peak in pixels of disparity */
+{
+    int i, g, z, zone, d, cx, valid;
+    int zones = 0, grids = 0;
+    int columns[SVS_MAX_FILTER_GRIDS], rows[SVS_MAX_FILTER_GRIDS], first_zone[SVS_MAX_FILTER_GRIDS];
+    unsigned int bx[SVS_MAX_FILTER_GRIDS][SVS_MAX_FILTER_ZONES + 1];
+    unsigned int by[SVS_MAX_FILTER_GRIDS][SVS_MAX_FILTER_ZONES + 1];
+    int zone_row[SVS_MAX_FILTER_GRIDS], near[SVS_MAX_FILTER_ZONES];
+    unsigned int min_disp[SVS_MAX_FILTER_ZONES], max_disp[SVS_MAX_FILTER_ZONES];
+    unsigned int x, y, y_prev, disp;
+    int* hist;
+
+    /* sub-pixel disparities are rounded to whole pixels */
+    int disp_shift = ctx->subpixel ? SVS_SUBPIXEL_BITS : 0;
+    int disp_round = (1 << disp_shift) >> 1;
+
+    /* histograms cover disparities up to the maximum, and the peak is
+     * searched for below it, where both neighbours are within the histogram */
+    int length = svs_histogram_length(ctx, max_disparity_pixels);
+    int peak_end = max_disparity_pixels - 1;
+    if (peak_end > length - 1)
+        peak_end = length - 1;
+
+    /* grids which fit within the available zones */
+    for (g = 0; (g < ctx->filter_grids) && (g < SVS_MAX_FILTER_GRIDS); g++)
+    {
+        columns[g] = (ctx->filter_grid[g*2] < 1) ? 1 : ctx->filter_grid[g*2];
+        rows[g] = (ctx->filter_grid[g*2 + 1] < 1) ? 1 : ctx->filter_grid[g*2 + 1];
+        if (zones + columns[g] * rows[g] > SVS_MAX_FILTER_ZONES)
+            break;
+        first_zone[g] = zones;
+        zones += columns[g] * rows[g];
+
+        /* boundaries between the zones */
+        for (z = 0; z <= columns[g]; z++)
+            bx[g][z] = ctx->imgWidth * z / columns[g];
+        for (z = 0; z <= rows[g]; z++)
+            by[g][z] = ctx->imgHeight * z / rows[g];
+        grids++;
+    }
+
+    memset(disparity_histogram, 0, zones * length * sizeof(int));
+
+    /* update the disparity histogram of each zone containing each match.
+     * Matches arrive in row order, so the row of zones within each grid
+     * only needs to be found when y changes */
+    y_prev = 0xffffffff;
+    for (i = 0; i < no_of_possible_matches; i++)
+    {
+        x = matches[i*4 + 1];
+        y = matches[i*4 + 2];
+        disp = (matches[i*4 + 3] + disp_round) >> disp_shift;
+        if (y != y_prev)
+        {
+            for (g = 0; g < grids; g++)
+                zone_row[g] = svs_filter_zone(y, by[g], rows[g]);
+            y_prev = y;
+        }
+        if ((int)disp >= length)
+            continue;
+        for (g = 0; g < grids; g++)
+        {
+            if (zone_row[g] < 0)
+                continue;
+            cx = svs_filter_zone(x, bx[g], columns[g]);
+            if (cx < 0)
+                continue;
+            zone = first_zone[g] + zone_row[g] * columns[g] + cx;
+            disparity_histogram[zone * length + disp]++;
+        }
+    }
+
+    /* locate the histogram peak of each zone */
+    for (z = 0; z < zones; z++)
+    {
+        int mass = 0;
+        int disp2 = 0;
+        int hist_thresh;
+        int hist_max = 0;
+        int hist_mean = 0;
+        int hist_mean_hits = 0;
+        hist = &disparity_histogram[z * length];
+        for (d = 0; d < length; d++)
+        {
+            if (hist[d] > hist_max)
+                hist_max = hist[d];
+        }
+        hist_thresh = hist_max/4;
+        for (d = 3; d < peak_end; d++)
+        {
+            if (hist[d] > hist_thresh)
+            {
+                int m = hist[d] + hist[d-1] + hist[d+1];
+                mass += m;
+                disp2 += m * d;
+            }
+            if (hist[d] > 0)
+            {
+                hist_mean += hist[d];
+                hist_mean_hits++;
+            }
+        }
+        if (mass > 0)
+        {
+            disp2 /= mass;
+            hist_mean /= hist_mean_hits;
+        }
+
+        /* simple near/far classification adjusts
+         * the peak disparity that we're interested in */
+        near[z] = 1;
+        if (hist_mean*4 > hist[0])
+        {
+            near[z] = 0;
+        }
+        min_disp[z] = disp2 - tolerance;
+        max_disp[z] = disp2 + tolerance;
+    }
+
+    /* remove matches too far away from the peak by setting
+     * their probabilities to zero */
+    y_prev = 0xffffffff;
+    for (i = 0; i < no_of_possible_matches; i++)
+    {
+        x = matches[i*4 + 1];
+        y = matches[i*4 + 2];
+        disp = (matches[i*4 + 3] + disp_round) >> disp_shift;
+        if (y != y_prev)
+        {
+            for (g = 0; g < grids; g++)
+                zone_row[g] = svs_filter_zone(y, by[g], rows[g]);
+            y_prev = y;
+        }
+        valid = 0;
+        for (g = 0; (g < grids) && (!valid); g++)
+        {
+            if (zone_row[g] < 0)
+                continue;
+            cx = svs_filter_zone(x, bx[g], columns[g]);
+            if (cx < 0)
+                continue;
+            zone = first_zone[g] + zone_row[g] * columns[g] + cx;
+            if (near[zone] == 1)
+            {
+                /* near - within stereo ranging resolution */
+                valid = !((disp < min_disp[zone]) || (disp > max_disp[zone]));
+            }
+            else
+            {
+                /* far out man */
+                valid = (disp <= 2);
+            }
+        }
+        if (!valid)
+        {
+            /* set probability to zero */
+            matches[i*4] = 0;
+        }
+    }
+}
+
+#ifndef SVS_EMBEDDED
+
+/* Returns the number of the given points lying within the tolerance of
+ * the plane disparity = plane[0]*x + plane[1]*y + plane[2] */
+static int svs_plane_inliers(
+    int simd,                  /* instruction set (SVS_SIMD_*) */
+    const float* x,            /* x coordinates */
+    const float* y,            /* y coordinates */
+    const float* d,            /* disparities in pixels */
+    int n,                     /* number of points */
+    const float* plane,        /* plane coefficients */
+    float tolerance)           /* tolerance in pixels of disparity */
+{
+    int k, inliers = 0;
+    float r;
+
+#ifdef SVS_SIMD_X86
+    if (simd == SVS_SIMD_AVX2)
+        return(svs_plane_inliers_avx2(x, y, d, n, plane, tolerance));
+#endif
+
+    for (k = 0; k < n; k++)
+    {
+        r = plane[0] * x[k] + plane[1] * y[k] + plane[2] - d[k];
+        if ((r <= tolerance) && (r >= -tolerance))
+            inliers++;
+    }
+    return(inliers);
+}
+
+/* returns a pseudo-random number below the given range */
+static inline int svs_plane_random(
+    unsigned int* seed,        /* state of the generator */
+    int range)                 /* upper limit of the number */
+{
+    *seed = *seed * 1103515245 + 12345;
+    return((int)((*seed >> 8) % (unsigned int)range));
+}
+
+/* Finds the plane passing through three points, returning zero if
+ * they are too close to lying on a line */
+static int svs_plane_through(
+    const float* x,            /* x coordinates */
+    const float* y,            /* y coordinates */
+    const float* d,            /* disparities */
+    int i, int j, int k,       /* indexes of the three points */
+    float* plane)              /* returned plane coefficients */
+{
+    float u1 = x[j] - x[i], v1 = y[j] - y[i], e1 = d[j] - d[i];
+    float u2 = x[k] - x[i], v2 = y[k] - y[i], e2 = d[k] - d[i];
+    float det = u1 * v2 - u2 * v1;
+
+    if ((det < 16) && (det > -16))
+        return(0);
+    plane[0] = (e1 * v2 - e2 * v1) / det;
+    plane[1] = (u1 * e2 - u2 * e1) / det;
+    plane[2] = d[i] - plane[0] * x[i] - plane[1] * y[i];
+    return(1);
+}
+
+/* Returns the number of planes through random triples of points which
+ * must be tried for a 99% chance that one of them passes through three
+ * points close to the plane being sought, given the proportion of the
+ * sample points which are close to the best plane tried so far */
+static int svs_plane_trials(
+    int inliers,               /* sample points close to the best plane */
+    int samples,               /* number of sample points */
+    int max_trials)            /* largest number of planes to be tried */
+{
+    float w = (float)inliers / (float)samples;
+    float miss = 1.0f - w * w * w;
+    float p = 1.0f;
+    int trials = 0;
+
+    /* chance that none of the planes tried passes through three such points */
+    while ((p > 0.01f) && (trials < max_trials))
+    {
+        p *= miss;
+        trials++;
+    }
+    return(trials);
+}
+
+/* Refines a plane by a least squares fit to the points lying within
+ * the tolerance of it, returning zero if the fit is degenerate */
+static int svs_plane_refine(
+    const float* x,            /* x coordinates */
+    const float* y,            /* y coordinates */
+    const float* d,            /* disparities */
+    int n,                     /* number of points */
+    const float* plane,        /* plane to be refined */
+    float tolerance,           /* tolerance in pixels of disparity */
+    float* refined)            /* returned plane coefficients */
+{
+    double sx = 0, sy = 0, sd = 0, sxx = 0, sxy = 0, syy = 0, sxd = 0, syd = 0;
+    double hits = 0, det, a, b;
+    float r;
+    int k;
+
+    for (k = 0; k < n; k++)
+    {
+        r = plane[0] * x[k] + plane[1] * y[k] + plane[2] - d[k];
+        if ((r <= tolerance) && (r >= -tolerance))
+        {
+            sx += x[k];
+            sy += y[k];
+            sd += d[k];
+            sxx += (double)x[k] * x[k];
+            sxy += (double)x[k] * y[k];
+            syy += (double)y[k] * y[k];
+            sxd += (double)x[k] * d[k];
+            syd += (double)y[k] * d[k];
+            hits++;
+        }
+    }
+    if (hits < 3)
+        return(0);
+
+    /* solve the normal equations about the centroid */
+    sxx -= sx * sx / hits;
+    sxy -= sx * sy / hits;
+    syy -= sy * sy / hits;
+    sxd -= sx * sd / hits;
+    syd -= sy * sd / hits;
+    det = sxx * syy - sxy * sxy;
+    if (det <= 1e-6 * sxx * syy)
+        return(0);
+    a = (sxd * syy - syd * sxy) / det;
+    b = (syd * sxx - sxd * sxy) / det;
+    refined[0] = (float)a;
+    refined[1] = (float)b;
+    refined[2] = (float)((sd - a * sx - b * sy) / hits);
+    return(1);
+}
+
+/* Removes noise from the given matches by fitting planes in (x, y, disparity)
+ * space to them using preemptive RANSAC, as set by ctx->filter_planes,
+ * ctx->plane_hypotheses and ctx->plane_support, and setting the probability
+ * of matches which are not close to any of the planes to zero.  The
+ * matches are shuffled, so that each block against which the hypotheses
+ * are scored is a random sample, and each plane is then fitted to the
+ * matches which are not close to the planes already found */
+static void svs_filter_planes(
+    struct svs_context* ctx,         /* context for the left camera */
+    unsigned int* matches,           /* possible matches (prob,x,y,disp) */
+    float* points,                   /* buffer of max_features * 3 entries */
+    int* index,                      /* buffer of max_features entries */
+    int no_of_possible_matches,      /* the number of stereo matches */
+    int tolerance)                   /* tolerance about each plane in pixels of disparity */
+{
+    float plane[SVS_MAX_PLANE_HYPOTHESES*3], best_plane[3], refined[3];
+    int score[SVS_MAX_PLANE_HYPOTHESES], order[SVS_MAX_PLANE_HYPOTHESES];
+    float* x = points;
+    float* y = &points[ctx->max_features];
+    float* d = &points[ctx->max_features*2];
+    float tol = (float)tolerance;
+    float disp_scale = ctx->subpixel ? 1.0f / SVS_SUBPIXEL : 1.0f;
+    float r;
+    int i, j, k, l, p, h, hypotheses, needed, active, start, end, remaining, support, inliers, attempt;
+    int points_count = 0;
+
+    /* the random sequence is the same for every frame, giving repeatable results */
+    unsigned int seed = 0x2545f491;
+
+    hypotheses = ctx->plane_hypotheses;
+    if (hypotheses > SVS_MAX_PLANE_HYPOTHESES)
+        hypotheses = SVS_MAX_PLANE_HYPOTHESES;
+
+    /* shuffle the matches into the buffers as they are copied.  The new
+     * match goes to a random position, and the match which held it, if
+     * any, moves to the end */
+    for (i = 0; i < no_of_possible_matches; i++)
+    {
+        if (matches[i*4] == 0)
+            continue;
+        j = svs_plane_random(&seed, points_count + 1);
+        if (j < points_count)
+        {
+            x[points_count] = x[j];
+            y[points_count] = y[j];
+            d[points_count] = d[j];
+            index[points_count] = index[j];
+        }
+        x[j] = (float)matches[i*4 + 1];
+        y[j] = (float)matches[i*4 + 2];
+        d[j] = (float)matches[i*4 + 3] * disp_scale;
+        index[j] = i;
+        points_count++;
+    }
+
+    support = points_count * ctx->plane_support / 100;
+    if (support < 3)
+        support = 3;
+
+    remaining = points_count;
+    for (p = 0; (p < ctx->filter_planes) && (remaining >= support); p++)
+    {
+        /* planes through random triples of the remaining matches, each
+         * scored against the first block of matches as it is found.  No
+         * more are found once enough have been tried for one of them to
+         * pass through three matches close to the best plane so far */
+        end = (remaining < SVS_PLANE_BLOCK) ? remaining : SVS_PLANE_BLOCK;
+        h = 0;
+        needed = hypotheses;
+        inliers = 0;
+        for (i = 0; (i < hypotheses) && (h < needed); i++)
+        {
+            for (attempt = 0; attempt < 4; attempt++)
+            {
+                j = svs_plane_random(&seed, remaining);
+                k = svs_plane_random(&seed, remaining);
+                l = svs_plane_random(&seed, remaining);
+                if ((j != k) && (j != l) && (k != l) &&
+                        (svs_plane_through(x, y, d, j, k, l, &plane[h*3])))
+                {
+                    score[h] = svs_plane_inliers(ctx->simd, x, y, d, end, &plane[h*3], tol);
+                    order[h] = h;
+                    if (score[h] > inliers)
+                    {
+                        inliers = score[h];
+                        needed = svs_plane_trials(inliers, end, hypotheses);
+                    }
+                    h++;
+                    break;
+                }
+            }
+        }
+        if (h == 0)
+            break;
+
+        /* score the hypotheses against successive blocks of matches,
+         * keeping the better half after each block, and stopping once
+         * the others could not overtake the best even if every match
+         * which remains to be scored were close to them */
+        active = h;
+        for (start = 0; (active > 1) && (start < remaining); start = end)
+        {
+            end = start + SVS_PLANE_BLOCK;
+            if (end > remaining)
+                end = remaining;
+
+            /* the first block was scored as the hypotheses were found */
+            if (start > 0)
+            {
+                for (i = 0; i < active; i++)
+                    score[order[i]] += svs_plane_inliers(ctx->simd, &x[start], &y[start], &d[start],
+                                                         end - start, &plane[order[i]*3], tol);
+            }
+
+            /* insertion sort into descending order of score */
+            for (i = 1; i < active; i++)
+            {
+                k = order[i];
+                for (j = i - 1; (j >= 0) && (score[order[j]] < score[k]); j--)
+                    order[j + 1] = order[j];
+                order[j + 1] = k;
+            }
+            if (score[order[0]] - score[order[1]] > remaining - end)
+                break;
+            active = (active + 1) / 2;
+        }
+
+        /* the best hypothesis must be supported by enough matches */
+        memcpy(best_plane, &plane[order[0]*3], sizeof(best_plane));
+        inliers = svs_plane_inliers(ctx->simd, x, y, d, remaining, best_plane, tol);
+        if (inliers < support)
+            break;
+        if ((svs_plane_refine(x, y, d, remaining, best_plane, tol, refined)) &&
+                (svs_plane_inliers(ctx->simd, x, y, d, remaining, refined, tol) >= inliers))
+            memcpy(best_plane, refined, sizeof(best_plane));
+
+        /* the matches close to the plane are kept, and the others
+         * remain to be fitted by the next plane */
+        j = 0;
+        for (i = 0; i < remaining; i++)
+        {
+            r = best_plane[0] * x[i] + best_plane[1] * y[i] + best_plane[2] - d[i];
+            if ((r > tol) || (r < -tol))
+            {
+                x[j] = x[i];
+                y[j] = y[i];
+                d[j] = d[i];
+                index[j] = index[i];
+                j++;
+            }
+        }
+        remaining = j;
+    }
+
+    /* set the probability of matches not close to any plane to zero */
+    for (i = 0; i < remaining; i++)
+        matches[index[i]*4] = 0;
+}
+
+#endif
+
+/* removes noise from the given matches using the filter selected by ctx->filter */
+static void svs_filter_candidates(
+    struct svs_context* ctx,         /* context for the left camera */
+    unsigned int* matches,           /* possible matches (prob,x,y,disp) */
+    int* disparity_histogram,        /* buffer used by the histogram filter */
+    float* plane_points,             /* buffers used by the plane filter */
+    int* plane_index,
+    int no_of_possible_matches,      /* the number of stereo matches */
+    int max_disparity_pixels,        /* maximum disparity in pixels */
+    int tolerance)                   /* tolerance in pixels of disparity */
+{
+    if (ctx->filter == SVS_FILTER_NONE)
+        return;
+#ifndef SVS_EMBEDDED
+    if (ctx->filter == SVS_FILTER_PLANES)
+    {
+        svs_filter_planes(ctx, matches, plane_points, plane_index,
+                          no_of_possible_matches, tolerance);
+        return;
+    }
+#endif
+    svs_filter_matches(ctx, matches, disparity_histogram,
+                       no_of_possible_matches, max_disparity_pixels, tolerance);
+}
+
+/* filtering function removes noise, by default by searching for a peak in the disparity histogram */
+void svs_filter(
+    struct svs_context* ctx,    /* context for the left camera */
+    int no_of_possible_matches, /* the number of stereo matches */
+    int max_disparity_pixels,   /*maximum disparity in pixels */
+    int tolerance)              /* tolerance around the peak in pixels of disparity */
+{
+    /* the histograms are enlarged whenever the maximum disparity increases,
+     * and the matches are left unfiltered if memory could not be allocated */
+    int length = svs_histogram_length(ctx, max_disparity_pixels);
+    if (length > ctx->histogram_length)
+    {
+        int* hist = (int*)realloc(ctx->disparity_histogram, SVS_MAX_FILTER_ZONES * length * sizeof(int));
+        if (hist == NULL)
+            return;
+        ctx->disparity_histogram = hist;
+        ctx->histogram_length = length;
+    }
+
+    svs_filter_candidates(ctx, ctx->svs_matches, ctx->disparity_histogram,
+                          ctx->plane_points, ctx->plane_index,
+                          no_of_possible_matches, max_disparity_pixels, tolerance);
+}
+
+#ifndef SVS_EMBEDDED
+
+/* Sorts pairs of values into ascending order of the first value, then of
+ * the second, using a buffer of the same size.  If count is non-NULL then
+ * only the first value of each pair is used, and the number of pairs
+ * which were out of order, with the first value of the later pair
+ * strictly below that of the earlier one, is added to it */
+static void svs_merge_sort(
+    int* pairs,          /* pairs of values */
+    int* buffer,         /* buffer of the same size */
+    int n,               /* number of pairs */
+    long long* count)    /* number of inversions, or NULL */
+{
+    int width, lo, mid, hi, i, j, k, later;
+    int* src = pairs;
+    int* dst = buffer;
+    int* tmp;
+
+    for (width = 1; width < n; width *= 2)
+    {
+        for (lo = 0; lo < n; lo += width * 2)
+        {
+            mid = (lo + width < n) ? lo + width : n;
+            hi = (lo + width * 2 < n) ? lo + width * 2 : n;
+            i = lo;
+            j = mid;
+            for (k = lo; k < hi; k++)
+            {
+                if ((i < mid) && (j < hi))
+                {
+                    later = (src[j*2] < src[i*2]) ||
+                            ((count == NULL) && (src[j*2] == src[i*2]) && (src[j*2 + 1] < src[i*2 + 1]));
+                }
+                else
+                {
+                    later = (i >= mid);
+                }
+                if (later)
+                {
+                    /* every remaining pair of the first half is out of order */
+                    if ((count != NULL) && (i < mid))
+                        *count += mid - i;
+                    dst[k*2] = src[j*2];
+                    dst[k*2 + 1] = src[j*2 + 1];
+                    j++;
+                }
+                else
+                {
+                    dst[k*2] = src[i*2];
+                    dst[k*2 + 1] = src[i*2 + 1];
+                    i++;
+                }
+            }
+        }
+        tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != pairs)
+        memcpy(pairs, src, n * 2 * sizeof(int));
+}
+
+/* Returns the number of pairs of matches whose lines cross when drawn
+ * between the left and right images.  The lines of two matches cross when
+ * their features are in the opposite order along the left image to that
+ * along the right image.  Matches sharing a position in either image do
+ * not cross.  Counted in O(n log n) time by sorting on the left image
+ * positions and counting the inversions of the right image positions,
+ * within a buffer owned by the caller, so that nothing is allocated when
+ * called for every combination of weights within svs_learn */
+long long svs_crossings(
+    struct svs_context* ctx,       /* context for the left camera */
+    const unsigned int* matches,   /* matches (prob,x,y,disp) */
+    int no_of_matches,             /* number of matches */
+    int* pairs)                    /* buffer of SVS_CROSSINGS_BUFFER(no_of_matches) ints */
+{
+    int i, scale = ctx->subpixel ? SVS_SUBPIXEL : 1;
+    long long crossings = 0;
 
-    /* convert to YUV */
-    move_yuv422_to_planar((unsigned char *)FRAME_BUF, (unsigned char *)FRAME_BUF3, imgWidth, imgHeight);
+    if (no_of_matches < 2)
+        return(0);
 
-    /* rectify the image */
-    svs_rectify((unsigned char *)FRAME_BUF3, (unsigned char *)FRAME_BUF4);
+    /* positions in the left and right images, in units of the disparity */
+    for (i = 0; i < no_of_matches; i++)
+    {
+        pairs[i*2] = (int)matches[i*4 + 1] * scale;
+        pairs[i*2 + 1] = pairs[i*2] - (int)matches[i*4 + 3];
+    }
+    svs_merge_sort(pairs, &pairs[no_of_matches*2], no_of_matches, NULL);
 
-    /* compute edge features */
-    return(svs_get_features((unsigned char *)FRAME_BUF4, inhibition_radius, minimum_response, calibration_offset_x, calibration_offset_y));
+    /* count the inversions of the right image positions */
+    for (i = 0; i < no_of_matches; i++)
+        pairs[i*2] = pairs[i*2 + 1];
+    svs_merge_sort(pairs, &pairs[no_of_matches*2], no_of_matches, &crossings);
+    return(crossings);
 }
 
-#endif
-
-/* Match features from this camera with features from the opposite one.
- * It is assumed that matching is performed on the left camera CPU */
-int svs_match(
-    int ideal_no_of_matches,          /* ideal number of matches to be returned */
-    int max_disparity_percent,        /* max disparity as a percent of image width */
-    int descriptor_match_threshold,   /* minimum no of descriptor bits to be matched, in the range 1 - SVS_DESCRIPTOR_PIXELS */
-    int learnDesc,                    /* descriptor match weight */
-    int learnLuma,                    /* luminance match weight */
-    int learnDisp)                    /* disparity weight */
+/* The possible matches considered by svs_match, reduced to the terms
+ * which are multiplied by each of the matching weights.  The score of
+ * each match is base + desc*learnDesc - luma*learnLuma + disp*learnDisp,
+ * or zero if that is negative.  Each term is held in its own array, so
+ * that several matches can be scored at once */
+struct svs_learn_terms
+{
+    int capacity;  /* number of matches allocated */
+    int* fR;       /* index of the right camera feature */
+    int* base;     /* part of the score which is independent of the weights */
+    int* desc;     /* descriptor correlation */
+    int* luma;     /* luminance difference */
+    int* disp;     /* disparity */
+};
+
+/* buffers used to evaluate one combination of weights within svs_learn */
+struct svs_learn_worker
 {
+    unsigned int* matches;
+    int* disparity_histogram;
+    float* plane_points;
+    int* plane_index;
+    int* heap;
+    unsigned int* sorted;
+    int* crossings;
+};
+
+/* parameters shared by every worker of svs_learn */
+struct svs_learn_params
+{
+    struct svs_context* ctx;
+    int rows;
+    int ideal_no_of_matches;
+    int max_disp;
+    int minimum_matches;
+    const int* min_weights;
+    int grid[3];
+    int cells;
+    const struct svs_learn_terms* terms;
+    int* term_start;
+    struct svs_learn_worker* workers;
+    int workers_count;
+    svs_quality quality;
+    void* arg;
+    float* cell_quality;
+};
+
+/* Enlarges the arrays of terms to hold the given number of matches.
+ * Returns zero if memory could not be allocated */
+static int svs_learn_grow(
+    struct svs_learn_terms* terms,   /* terms to be enlarged */
+    int capacity)                    /* number of matches */
+{
+    int** array[5];
+    int i;
+
+    array[0] = &terms->fR;
+    array[1] = &terms->base;
+    array[2] = &terms->desc;
+    array[3] = &terms->luma;
+    array[4] = &terms->disp;
+    for (i = 0; i < 5; i++)
+    {
+        int* a = (int*)realloc(*array[i], capacity * sizeof(int));
+        if (a == NULL)
+            return(0);
+        *array[i] = a;
+    }
+    terms->capacity = capacity;
+    return(1);
+}
 
-    int xL, xR, L, R, y, no_of_feats_left, no_of_feats_right, row, bit;
-    int luma_diff, max_disp, meanL, meanR, disp, fL=0, fR=0, bestR;
-    unsigned int descL, descLanti, descR, desc_match;
-    unsigned int correlation, anticorrelation, total, n;
-    unsigned int match_prob, best_prob;
-    int max, curr_idx, search_idx, winner_idx=0;
-    int no_of_possible_matches = 0, matches = 0;
+/* releases the arrays of terms */
+static void svs_learn_free(
+    struct svs_learn_terms* terms)
+{
+    free(terms->fR);
+    free(terms->base);
+    free(terms->desc);
+    free(terms->luma);
+    free(terms->disp);
+}
 
-    unsigned int meandescL, meandescR;
-    short meandesc[SVS_DESCRIPTOR_PIXELS];
+/* Scores the possible matches from first to last for the given weights,
+ * returning the total of the scores and the highest score in best */
+static unsigned int svs_learn_scores(
+    int simd,                              /* instruction set (SVS_SIMD_*) */
+    const struct svs_learn_terms* terms,   /* terms of the matches */
+    int first,                             /* first match */
+    int last,                              /* match following the last */
+    const int* weights,                    /* learnDesc, learnLuma and learnDisp */
+    unsigned int* best)                    /* returned highest score */
+{
+    int k, s;
+    unsigned int total = 0;
 
-    /* convert max disparity from percent to pixels */
-    max_disp = max_disparity_percent * imgWidth / 100;
+#ifdef SVS_SIMD_X86
+    if (simd == SVS_SIMD_AVX2)
+        return(svs_learn_scores_avx2(&terms->base[first], &terms->desc[first], &terms->luma[first],
+                                     &terms->disp[first], last - first, weights, best));
+#endif
 
-    row = 0;
-    for (y = 4; y < (int)imgHeight - 4; y += SVS_VERTICAL_SAMPLING, row++)
+    *best = 0;
+    for (k = first; k < last; k++)
     {
-
-        /* number of features on left and right rows */
-        no_of_feats_left = svs_data.features_per_row[row];
-        no_of_feats_right = svs_data_received.features_per_row[row];
-
-        /* compute mean descriptor for the left row
-         * this will be used to create eigendescriptors */
-        meandescL = 0;
-        memset(meandesc, 0, (SVS_DESCRIPTOR_PIXELS)* sizeof(short));
-        for (L = 0; L < no_of_feats_left; L++)
-        {
-            descL = svs_data.descriptor[fL + L];
-            n = 1;
-            for (bit = 0; bit < SVS_DESCRIPTOR_PIXELS; bit++, n *= 2)
-            {
-                if (descL & n)
-                    meandesc[bit]++;
-                else
-                    meandesc[bit]--;
-            }
-        }
-        n = 1;
-        for (bit = 0; bit < SVS_DESCRIPTOR_PIXELS; bit++, n *= 2)
+        s = terms->base[k] + terms->desc[k] * weights[0] - terms->luma[k] * weights[1] + terms->disp[k] * weights[2];
+        if (s > 0)
         {
-            if (meandesc[bit] >= 0)
-                meandescL |= n;
+            total += (unsigned int)s;
+            if ((unsigned int)s > *best)
+                *best = (unsigned int)s;
         }
+    }
+    return(total);
+}
 
-        /* compute mean descriptor for the right row
-         * this will be used to create eigendescriptors */
-        meandescR = 0;
-        memset(meandesc, 0, (SVS_DESCRIPTOR_PIXELS)* sizeof(short));
-        for (R = 0; R < no_of_feats_right; R++)
-        {
-            descR = svs_data_received.descriptor[fR + R];
-            n = 1;
-            for (bit = 0; bit < SVS_DESCRIPTOR_PIXELS; bit++, n *= 2)
-            {
-                if (descR & n)
-                    meandesc[bit]++;
-                else
-                    meandesc[bit]--;
-            }
-        }
-        n = 1;
-        for (bit = 0; bit < SVS_DESCRIPTOR_PIXELS; bit++, n *= 2)
+/* Finds the terms of every possible match considered by svs_match with
+ * the given maximum disparity and descriptor threshold, in the order
+ * in which svs_match considers them.  The terms of each left camera
+ * feature start at term_start, which has an entry for every feature and
+ * one more.  The terms are reallocated as needed.  Returns the number
+ * of terms, or -1 if memory could not be allocated */
+static int svs_learn_terms(
+    struct svs_context* ctx,           /* context for the left camera */
+    int rows,                          /* number of sampled rows */
+    int max_disp,                      /* maximum disparity in pixels */
+    int threshold,                     /* minimum number of correlated bits */
+    struct svs_learn_terms* terms,     /* terms, reallocated as needed */
+    int* term_start)                   /* index of the first term of each left camera feature */
+{
+    int row, L, R, n, r, xL, disp, luma_diff, penalty, first_row, last_row;
+    int fL, fR, no_of_feats_left, no_of_feats_right, no_of_terms = 0, end = 0;
+    int first_R[SVS_MAX_MATCH_ROWS*2 + 1], last_R[SVS_MAX_MATCH_ROWS*2 + 1];
+    int row_end[SVS_MAX_MATCH_ROWS*2 + 1];
+    unsigned int meandescL[SVS_DESCRIPTOR_WORDS];
+    unsigned int descL[SVS_DESCRIPTOR_WORDS], descLanti[SVS_DESCRIPTOR_WORDS];
+    unsigned int correlation, anticorrelation;
+    const unsigned int* eigen;
+
+    for (row = 0; row < rows; row++)
+    {
+        first_row = row - ctx->match_rows;
+        if (first_row < 0)
+            first_row = 0;
+        last_row = row + ctx->match_rows + 1;
+        if (last_row > rows)
+            last_row = rows;
+
+        fL = ctx->feature_offset[row];
+        fR = ctx->received_offset[first_row];
+        no_of_feats_left = ctx->svs_data.features_per_row[row];
+        end = fL + no_of_feats_left;
+
+        no_of_feats_right = 0;
+        for (n = 0; n < last_row - first_row; n++)
         {
-            if (meandesc[bit] > 0)
-                meandescR |= n;
+            first_R[n] = no_of_feats_right;
+            last_R[n] = no_of_feats_right;
+            no_of_feats_right += ctx->svs_data_received.features_per_row[first_row + n];
+            row_end[n] = no_of_feats_right;
         }
 
-        /* features along the row in the left camera */
+        svs_left_mean(ctx, fL, no_of_feats_left, meandescL);
         for (L = 0; L < no_of_feats_left; L++)
         {
+            term_start[fL + L] = no_of_terms;
+            xL = ctx->svs_data.feature_x[fL + L];
+            svs_left_eigen(&ctx->svs_data.descriptor[(fL + L)*SVS_DESCRIPTOR_WORDS],
+                           meandescL, descL, descLanti);
 
-            /* x coordinate of the feature in the left camera */
-            xL = svs_data.feature_x[fL + L];
-
-            /* mean luminance and eigendescriptor for the left camera feature */
-            meanL = svs_data.mean[fL + L];
-            descL = svs_data.descriptor[fL + L] & meandescL;
-
-            /* invert bits of the descriptor for anti-correlation matching */
-            n = descL;
-            descLanti = 0;
-            for (bit = 0; bit < SVS_DESCRIPTOR_PIXELS; bit++)
-            {
-                /* Shift result vector to higher significance. */
-                descLanti <<= 1;
-                /* Get least significant input bit. */
-                descLanti |= n & 1;
-                /* Shift input vector to lower significance. */
-                n >>= 1;
-            }
-
-            total = 0;
-
-            /* features along the row in the right camera */
-            for (R = 0; R < no_of_feats_right; R++)
+            for (n = 0; n < last_row - first_row; n++)
             {
+                svs_match_window(ctx, xL, fR, -max_disp + 1, max_disp - 1, row_end[n], &first_R[n], &last_R[n]);
+                r = first_row + n;
+                penalty = ctx->row_penalty * ((r > row) ? (r - row) : (row - r));
 
-                /* set matching score to zero */
-                row_peaks[R] = 0;
-
-                /* x coordinate of the feature in the right camera */
-                xR = svs_data_received.feature_x[fR + R];
+                /* make room for every feature within range */
+                if ((no_of_terms + last_R[n] - first_R[n] > terms->capacity) &&
+                        (!svs_learn_grow(terms, (terms->capacity + last_R[n] - first_R[n]) * 2)))
+                    return(-1);
 
-                /* compute disparity */
-                disp = xL - xR;
-
-                /* is the disparity within range? */
-                if ((disp >= -10) && (disp < max_disp))
+                for (R = first_R[n]; R < last_R[n]; R++)
                 {
-                    if (disp < 0)
-                        disp = 0;
-
-
-                    /* mean luminance for the right camera feature */
-                    meanR = svs_data_received.mean[fR + R];
-
-                    /* is the mean luminance similar? */
-                    luma_diff = meanR - meanL;
-
-                    /* right camera feature eigendescriptor */
-                    descR = svs_data_received.descriptor[fR + R] & meandescR;
-
-                    /* bitwise descriptor correlation match */
-                    desc_match = descL & descR;
-
-                    /* count the number of correlation bits */
-                    correlation =
-                        BitsSetTable256[desc_match & 0xff] +
-                        BitsSetTable256[(desc_match >> 8) & 0xff] +
-                        BitsSetTable256[(desc_match >> 16) & 0xff] +
-                        BitsSetTable256[desc_match >> 24];
-
-                    /* were enough bits matched ? */
-                    if ((int)correlation > descriptor_match_threshold)
+                    disp = xL - ctx->svs_data_received.feature_x[fR + R];
+                    if ((disp >= -10) && (disp < max_disp))
                     {
+                        if (disp < 0)
+                            disp = 0;
 
-                        /* bitwise descriptor anti-correlation match */
-                        desc_match = descLanti & descR;
-
-                        /* count the number of anti-correlation bits */
-                        anticorrelation =
-                            BitsSetTable256[desc_match & 0xff] +
-                            BitsSetTable256[(desc_match >> 8) & 0xff] +
-                            BitsSetTable256[(desc_match >> 16) & 0xff] +
-                            BitsSetTable256[desc_match >> 24];
-
+                        /* features with too few bits in common always score zero */
+                        eigen = &ctx->eigen_descriptor[(fR + R)*SVS_DESCRIPTOR_WORDS];
+                        correlation = svs_descriptor_bits(ctx->simd, descL, eigen);
+                        if ((int)correlation <= threshold)
+                            continue;
+                        anticorrelation = svs_descriptor_bits(ctx->simd, descLanti, eigen);
+                        luma_diff = ctx->svs_data_received.mean[fR + R] - ctx->svs_data.mean[fL + L];
                         if (luma_diff < 0)
                             luma_diff = -luma_diff;
-                        int score =
-                            10000 +
-                            (max_disp * learnDisp) +
-                            (((int)correlation + (int)(SVS_DESCRIPTOR_PIXELS - anticorrelation)) * learnDesc) -
-                            (luma_diff * learnLuma) -
-                            (disp * learnDisp);
-                        if (score < 0)
-                            score = 0;
-
-                        /* store overall matching score */
-                        row_peaks[R] = (unsigned int)score;
-                        total += row_peaks[R];
+
+                        terms->base[no_of_terms] = 10000 - penalty;
+                        terms->desc[no_of_terms] = (int)correlation + (int)(SVS_DESCRIPTOR_PIXELS - anticorrelation);
+                        terms->luma[no_of_terms] = luma_diff;
+                        terms->disp[no_of_terms] = max_disp - disp;
                     }
-                }
-                else
-                {
-                    if ((disp < 0) && (disp > -max_disp))
+                    else
                     {
-                        row_peaks[R] = (unsigned int)((max_disp - disp) * learnDisp);
-                        total += row_peaks[R];
+                        if ((disp >= 0) || (disp <= -max_disp))
+                            continue;
+
+                        /* scored on the disparity alone */
+                        terms->base[no_of_terms] = -penalty;
+                        terms->desc[no_of_terms] = 0;
+                        terms->luma[no_of_terms] = 0;
+                        terms->disp[no_of_terms] = max_disp - disp;
                     }
+                    terms->fR[no_of_terms] = fR + R;
+                    no_of_terms++;
                 }
             }
+        }
+    }
+    term_start[end] = no_of_terms;
+    return(no_of_terms);
+}
 
-            /* non-zero total matching score */
-            if (total > 0)
+/* Returns the matches which svs_match would return for the given weights,
+ * using the terms found by svs_learn_terms, and the buffers of a worker */
+static int svs_learn_matches(
+    const struct svs_learn_params* params,   /* parameters of svs_learn */
+    struct svs_learn_worker* worker,         /* buffers of the worker */
+    const int* weights)                      /* learnDesc, learnLuma and learnDisp */
+{
+    struct svs_context* ctx = params->ctx;
+    const struct svs_learn_terms* terms = params->terms;
+    int row, f, k, end, s, y, no_of_possible_matches = 0;
+    unsigned int total, best_score, best_prob, threshold;
+
+    for (row = 0; row < params->rows; row++)
+    {
+        y = 4 + row * SVS_VERTICAL_SAMPLING;
+        end = ctx->feature_offset[row] + ctx->svs_data.features_per_row[row];
+        for (f = ctx->feature_offset[row]; f < end; f++)
+        {
+            total = svs_learn_scores(ctx->simd, terms, params->term_start[f], params->term_start[f + 1],
+                                     weights, &best_score);
+            if (total == 0)
+                continue;
+
+            /* the first feature with the highest probability, as in svs_match_row */
+            best_prob = best_score * 1000 / total;
+            if ((best_prob == 0) || (best_prob > 999) ||
+                    (no_of_possible_matches >= ctx->max_features))
+                continue;
+            threshold = best_prob * total;
+            for (k = params->term_start[f]; k < params->term_start[f + 1]; k++)
             {
+                s = terms->base[k] + terms->desc[k] * weights[0] - terms->luma[k] * weights[1] + terms->disp[k] * weights[2];
+                if ((s > 0) && ((unsigned int)s * 1000 >= threshold))
+                    break;
+            }
+            no_of_possible_matches = svs_add_match(ctx, f, terms->fR[k], y, best_prob,
+                                                   worker->matches, no_of_possible_matches);
+        }
+    }
 
-                /* convert matching scores to probabilities */
-                best_prob = 0;
-                for (R = 0; R < no_of_feats_right; R++)
-                {
-                    if (row_peaks[R] > 0)
-                    {
-                        match_prob = row_peaks[R] * 1000 / total;
-                        if (match_prob > best_prob)
-                        {
-                            best_prob = match_prob;
-                            bestR = R;
-                        }
-                    }
-                }
+    if (no_of_possible_matches <= 1)
+        return(0);
+    svs_filter_candidates(ctx, worker->matches, worker->disparity_histogram,
+                          worker->plane_points, worker->plane_index,
+                          no_of_possible_matches, params->max_disp, 3);
+    return(svs_select_matches(ctx, worker->matches, worker->heap, worker->sorted,
+                              no_of_possible_matches, params->ideal_no_of_matches));
+}
 
-                if ((best_prob > 0) &&
-                        (best_prob < 1000) &&
-                        (no_of_possible_matches < SVS_MAX_FEATURES))
-                {
+/* evaluates every combination of weights assigned to one worker */
+static void svs_learn_task(
+    void* arg,   /* svs_learn_params */
+    int index)   /* index of the worker */
+{
+    struct svs_learn_params* params = (struct svs_learn_params*)arg;
+    int cell, matches, weights[3];
 
-                    /* x coordinate of the feature in the right camera */
-                    xR = svs_data_received.feature_x[fR + bestR];
+    for (cell = index; cell < params->cells; cell += params->workers_count)
+    {
+        weights[0] = params->min_weights[0] + cell / (params->grid[1] * params->grid[2]);
+        weights[1] = params->min_weights[1] + (cell / params->grid[2]) % params->grid[1];
+        weights[2] = params->min_weights[2] + cell % params->grid[2];
+
+        params->cell_quality[cell] = 0;
+        matches = svs_learn_matches(params, &params->workers[index], weights);
+        if (matches > params->minimum_matches)
+            params->cell_quality[cell] = params->quality(params->ctx, params->workers[index].matches,
+                                                         matches, params->workers[index].crossings,
+                                                         params->arg);
+    }
+}
 
-                    /* possible disparity */
-                    disp = xL - xR;
+/* Points the buffers of each worker of svs_learn into the given arena,
+ * following the workers themselves, and returns the number of bytes used.
+ * Called with a NULL arena to find the size */
+static size_t svs_learn_buffers(
+    struct svs_context* ctx,
+    unsigned char* arena,
+    struct svs_learn_params* params)
+{
+    size_t offset = 0;
+    int max_features = ctx->max_features;
+    int w;
 
-                    if (disp >= -10)
-                    {
-                        if (disp < 0)
-                            disp = 0;
-                        /* add the best result to the list of possible matches */
-                        svs_matches[no_of_possible_matches*4] = best_prob;
-                        svs_matches[no_of_possible_matches*4 + 1] = (unsigned int)xL;
-                        svs_matches[no_of_possible_matches*4 + 2] = (unsigned int)y;
-                        svs_matches[no_of_possible_matches*4 + 3] = (unsigned int)disp;
-                        no_of_possible_matches++;
-                    }
-                }
-            }
-        }
+    params->workers = (struct svs_learn_worker*)svs_arena_buffer(arena, &offset, params->workers_count * sizeof(struct svs_learn_worker));
+    for (w = 0; w < params->workers_count; w++)
+    {
+        struct svs_learn_worker dummy;
+        struct svs_learn_worker* worker = (arena != NULL) ? &params->workers[w] : &dummy;
+        worker->matches = (unsigned int*)svs_arena_buffer(arena, &offset, max_features * 4 * sizeof(unsigned int));
+        worker->disparity_histogram = (int*)svs_arena_buffer(arena, &offset, SVS_MAX_FILTER_ZONES * svs_histogram_length(ctx, params->max_disp) * sizeof(int));
+        worker->plane_points = (float*)svs_arena_buffer(arena, &offset, max_features * 3 * sizeof(float));
+        worker->plane_index = (int*)svs_arena_buffer(arena, &offset, max_features * sizeof(int));
+        worker->heap = (int*)svs_arena_buffer(arena, &offset, max_features * sizeof(int));
+        worker->sorted = (unsigned int*)svs_arena_buffer(arena, &offset, max_features * 4 * sizeof(unsigned int));
+        worker->crossings = (int*)svs_arena_buffer(arena, &offset, SVS_CROSSINGS_BUFFER(max_features) * sizeof(int));
+    }
+    params->cell_quality = (float*)svs_arena_buffer(arena, &offset, params->cells * sizeof(float));
+    params->term_start = (int*)svs_arena_buffer(arena, &offset, (max_features + 1) * sizeof(int));
+    return(offset);
+}
 
-        /* increment feature indexes */
-        fL += no_of_feats_left;
-        fR += no_of_feats_right;
+/* Searches a grid of matching weights for the combination giving the
+ * highest quality of matches, as estimated by the given function, for
+ * the features currently held by the context.  Rather than calling
+ * svs_match for every combination, the terms of each possible match
+ * which are multiplied by the weights are found once, and the matches
+ * are then scored again for each combination.  The grid is divided
+ * between the given number of threads, each calling the quality function
+ * with its own matches.  These are created for the call, leaving the
+ * threads and band buffers of the context unchanged.  The greedy matcher
+ * is evaluated, without a temporal prior or consistency check.  Returns
+ * the highest quality, with the weights in learnt, or -1 if memory could
+ * not be allocated */
+float svs_learn(
+    struct svs_context* ctx,          /* context for the left camera */
+    int ideal_no_of_matches,          /* ideal number of matches to be returned */
+    int max_disparity_percent,        /* max disparity as a percent of image width */
+    int descriptor_match_threshold,   /* minimum no of descriptor bits to be matched */
+    const int* min_weights,           /* smallest learnDesc, learnLuma and learnDisp */
+    const int* max_weights,           /* weights following the largest of each */
+    int minimum_matches,              /* quality is only estimated with more matches than this */
+    int threads,                      /* number of threads, including the calling thread */
+    svs_quality quality,              /* estimates the quality of a set of matches */
+    void* arg,                        /* passed to the quality function */
+    int* learnt)                      /* returned learnDesc, learnLuma and learnDisp */
+{
+    struct svs_learn_params params;
+    struct svs_learn_terms terms;
+    void* block;
+    unsigned char* arena;
+    struct svs_pool* pool;
+    int i, row;
+    float max_quality = 0;
+
+    for (i = 0; i < 3; i++)
+    {
+        learnt[i] = min_weights[i];
+        params.grid[i] = max_weights[i] - min_weights[i];
+        if (params.grid[i] < 1)
+            params.grid[i] = 1;
     }
 
-    if (no_of_possible_matches > 1)
+    params.ctx = ctx;
+    params.rows = svs_match_rows(ctx);
+    params.ideal_no_of_matches = ideal_no_of_matches;
+    params.max_disp = max_disparity_percent * ctx->imgWidth / 100;
+    params.minimum_matches = minimum_matches;
+    params.min_weights = min_weights;
+    params.cells = params.grid[0] * params.grid[1] * params.grid[2];
+    params.quality = quality;
+    params.arg = arg;
+    params.workers_count = (threads > 1) ? threads : 1;
+
+    arena = svs_arena_alloc(svs_learn_buffers(ctx, NULL, &params), &block);
+    if (arena == NULL)
+        return(-1);
+    svs_learn_buffers(ctx, arena, &params);
+
+    /* the terms of every possible match are found once */
+    for (row = 0; row < params.rows; row++)
+        svs_received_eigen(ctx, row);
+    memset(&terms, 0, sizeof(terms));
+    if (svs_learn_terms(ctx, params.rows, params.max_disp, descriptor_match_threshold,
+                        &terms, params.term_start) < 0)
     {
+        svs_learn_free(&terms);
+        free(block);
+        return(-1);
+    }
+    params.terms = &terms;
 
-        /* filter the results */
-        svs_filter(no_of_possible_matches, max_disp, 3);
+    pool = (params.workers_count > 1) ? svs_pool_create(params.workers_count) : NULL;
+    svs_pool_run(pool, svs_learn_task, &params, params.workers_count);
+    svs_pool_free(pool);
 
-        /* sort matches in descending order of probability */
-        if (no_of_possible_matches < ideal_no_of_matches)
+    /* the first combination with the highest quality */
+    for (i = 0; i < params.cells; i++)
+    {
+        if (params.cell_quality[i] > max_quality)
         {
-            ideal_no_of_matches = no_of_possible_matches;
+            max_quality = params.cell_quality[i];
+            learnt[0] = min_weights[0] + i / (params.grid[1] * params.grid[2]);
+            learnt[1] = min_weights[1] + (i / params.grid[2]) % params.grid[1];
+            learnt[2] = min_weights[2] + i % params.grid[2];
         }
-        curr_idx = 0;
-        search_idx = 0;
-        for (matches = 0; matches < ideal_no_of_matches; matches++, curr_idx += 4)
-        {
-
-            match_prob =  svs_matches[curr_idx];
-            winner_idx = -1;
-
-            search_idx = curr_idx + 4;
-            max = no_of_possible_matches * 4;
-            while (search_idx < max)
-            {
-                if (svs_matches[search_idx] > match_prob)
-                {
-                    match_prob = svs_matches[search_idx];
-                    winner_idx = search_idx;
-                }
-                search_idx += 4;
-            }
-            if (winner_idx > -1)
-            {
+    }
 
-                /* swap */
-                best_prob = svs_matches[winner_idx];
-                xL = svs_matches[winner_idx + 1];
-                y = svs_matches[winner_idx + 2];
-                disp = svs_matches[winner_idx + 3];
+    svs_learn_free(&terms);
+    free(block);
+    return(max_quality);
+}
 
-                svs_matches[winner_idx] = svs_matches[curr_idx];
-                svs_matches[winner_idx + 1] = svs_matches[curr_idx + 1];
-                svs_matches[winner_idx + 2] = svs_matches[curr_idx + 2];
-                svs_matches[winner_idx + 3] = svs_matches[curr_idx + 3];
+#endif
 
-                svs_matches[curr_idx] = best_prob;
-                svs_matches[curr_idx + 1] = xL;
-                svs_matches[curr_idx + 2] = y;
-                svs_matches[curr_idx + 3] = disp;
-            }
+/* Sets the positions within the raw image of the pixels along one row of
+ * the rectified image, in units of 1/SVS_RECTIFY_SCALE pixels.  Positions
+ * are clamped to the image, and stored as offsets from each pixel within
+ * the limits of a short int.  Different rows may be set by different
+ * threads at the same time */
+void svs_rectify_row(
+    struct svs_context* ctx,      /* context for this camera */
+    int y,                        /* row of the rectified image */
+    const int* source_x,          /* x coordinate within the raw image of each pixel */
+    const int* source_y)          /* y coordinate within the raw image of each pixel */
+{
+    int max_x = ((int)ctx->imgWidth - 1) << SVS_RECTIFY_BITS;
+    int max_y = ((int)ctx->imgHeight - 1) << SVS_RECTIFY_BITS;
+    short int* map = &ctx->rectify_map[y * ctx->imgWidth * 2];
+    int x, dx, dy;
 
-            if (svs_matches[curr_idx] == 0)
-            {
-                break;
-            }
-        }
+    for (x = 0; x < (int)ctx->imgWidth; x++)
+    {
+        dx = source_x[x];
+        dy = source_y[x];
+        if (dx < 0) dx = 0;
+        if (dx > max_x) dx = max_x;
+        if (dy < 0) dy = 0;
+        if (dy > max_y) dy = max_y;
+
+        dx -= x << SVS_RECTIFY_BITS;
+        dy -= y << SVS_RECTIFY_BITS;
+        if (dx < -32768) dx = -32768;
+        if (dx > 32767) dx = 32767;
+        if (dy < -32768) dy = -32768;
+        if (dy > 32767) dy = 32767;
+        map[x*2] = (short int)dx;
+        map[x*2 + 1] = (short int)dy;
     }
-    return(matches);
 }
 
-
-/* filtering function removes noise by searching for a peak in the disparity histogram */
-void svs_filter(
-    int no_of_possible_matches, /* the number of stereo matches */
-    int max_disparity_pixels,   /*maximum disparity in pixels */
-    int tolerance)              /* tolerance around the peak in pixels of disparity */
+/* interpolates between four raw pixels a b / c d, given the fractional position */
+static inline int svs_rectify_bilinear(
+    int a, int b, int c, int d,   /* raw pixels */
+    int fx, int fy)               /* fractional position */
 {
+    int top = a * (SVS_RECTIFY_SCALE - fx) + b * fx;
+    int bottom = c * (SVS_RECTIFY_SCALE - fx) + d * fx;
+    int v = top * (SVS_RECTIFY_SCALE - fy) + bottom * fy;
+    return((v + (1 << (SVS_RECTIFY_BITS*2 - 1))) >> (SVS_RECTIFY_BITS*2));
+}
 
-    int i, hf;
-    unsigned int tx=0, ty=0, bx=0, by=0;
+/* Returns the index of the upper left of the four raw pixels interpolated
+ * for a rectified pixel, such that all four lie within the image, and the
+ * fractional position between them */
+static inline int svs_rectify_source(
+    struct svs_context* ctx,      /* context for this camera */
+    const short int* map,         /* offsets of the pixels of the row */
+    int x,                        /* x coordinate of the rectified pixel */
+    int y,                        /* y coordinate of the rectified pixel */
+    int* fx,                      /* returned x fraction */
+    int* fy)                      /* returned y fraction */
+{
+    int sx = (x << SVS_RECTIFY_BITS) + map[x*2];
+    int sy = (y << SVS_RECTIFY_BITS) + map[x*2 + 1];
+    int ix = sx >> SVS_RECTIFY_BITS;
+    int iy = sy >> SVS_RECTIFY_BITS;
+
+    if (ix > (int)ctx->imgWidth - 2) ix = (int)ctx->imgWidth - 2;
+    if (iy > (int)ctx->imgHeight - 2) iy = (int)ctx->imgHeight - 2;
+    *fx = sx - (ix << SVS_RECTIFY_BITS);
+    *fy = sy - (iy << SVS_RECTIFY_BITS);
+    return(iy * (int)ctx->imgWidth + ix);
+}
 
-    /* clear quadrants */
-    memset(valid_quadrants, 0, SVS_MAX_IMAGE_WIDTH * sizeof(unsigned char));
+/* rectifies one row of the image */
+static void svs_rectify_line(
+    struct svs_context* ctx,      /* context for this camera */
+    unsigned char* raw_image,     /* raw image grabbed from camera */
+    unsigned char* rectified_row, /* returned row of the rectified image */
+    int y,                        /* row of the rectified image */
+    int* index)                   /* buffer of imgWidth entries */
+{
+    int width = (int)ctx->imgWidth;
+    int half = SVS_RECTIFY_SCALE / 2;
+    const short int* map = &ctx->rectify_map[y * width * 2];
+    int x, fx, fy, p, col;
 
-    /* create disparity histograms within different
-     * zones of the image */
-    for (hf = 0; hf < 4; hf++)
+    if (ctx->interpolation == SVS_RECTIFY_BILINEAR)
     {
-
-        switch(hf)
+#ifdef SVS_SIMD_X86
+        /* the SIMD version only handles the luma formats */
+        if ((ctx->simd == SVS_SIMD_AVX2) && (ctx->format != SVS_FORMAT_RGB))
         {
-            /* left hemifield */
-        case 0:
-            {
-                tx = 0;
-                ty = 0;
-                bx = imgWidth/2;
-                by = imgHeight;
-                break;
-            }
-            /* right hemifield */
-        case 1:
-            {
-                tx = bx;
-                bx = imgWidth;
-                break;
-            }
-            /* upper hemifield */
-        case 2:
+            int bytes_per_sample = (ctx->format == SVS_FORMAT_LUMA16) ? 2 : 1;
+            svs_rectify_bilinear_avx2(raw_image, bytes_per_sample, width, ctx->imgHeight, map,
+                                      SVS_RECTIFY_BITS, y, rectified_row);
+            return;
+        }
+#endif
+        switch(ctx->format)
+        {
+        case SVS_FORMAT_LUMA8:
             {
-                tx = 0;
-                ty = 0;
-                bx = imgWidth;
-                by = imgHeight/2;
+                unsigned char* rectified = rectified_row;
+                for (x = 0; x < width; x++)
+                {
+                    p = svs_rectify_source(ctx, map, x, y, &fx, &fy);
+                    rectified[x] = (unsigned char)svs_rectify_bilinear(
+                                       raw_image[p], raw_image[p + 1], raw_image[p + width], raw_image[p + width + 1], fx, fy);
+                }
                 break;
             }
-            /* lower hemifield */
-        case 3:
+        case SVS_FORMAT_LUMA16:
             {
-                ty = by;
-                by = imgHeight;
+                unsigned short* raw = (unsigned short*)raw_image;
+                unsigned short* rectified = (unsigned short*)rectified_row;
+                for (x = 0; x < width; x++)
+                {
+                    p = svs_rectify_source(ctx, map, x, y, &fx, &fy);
+                    rectified[x] = (unsigned short)svs_rectify_bilinear(
+                                       raw[p], raw[p + 1], raw[p + width], raw[p + width + 1], fx, fy);
+                }
                 break;
             }
-        }
-
-        /* clear the histogram */
-        memset(disparity_histogram, 0, SVS_MAX_IMAGE_WIDTH * sizeof(int));
-        int hist_max = 0;
-
-        /* update the disparity histogram */
-        for (i = 0; i < no_of_possible_matches; i++)
-        {
-            unsigned int x = svs_matches[i*4 + 1];
-            if ((x > tx) && (x < bx))
+        default:
             {
-                unsigned int y = svs_matches[i*4 + 2];
-                if ((y > ty) && (y < by))
+                unsigned char* rectified = rectified_row;
+                for (x = 0; x < width; x++)
                 {
-                    int disp = svs_matches[i*4 + 3];
-                    disparity_histogram[disp]++;
-                    if (disparity_histogram[disp] > hist_max)
-                        hist_max = disparity_histogram[disp];
+                    p = svs_rectify_source(ctx, map, x, y, &fx, &fy) * 3;
+                    for (col = 0; col < 3; col++, p++)
+                        rectified[x*3 + col] = (unsigned char)svs_rectify_bilinear(
+                                                   raw_image[p], raw_image[p + 3], raw_image[p + width*3], raw_image[p + width*3 + 3], fx, fy);
                 }
+                break;
             }
         }
+        return;
+    }
 
-        /* locate the histogram peak */
-        int mass = 0;
-        int disp2 = 0;
-        int hist_thresh = hist_max/4;
-        int hist_mean = 0;
-        int hist_mean_hits = 0;
-        int d;
-        for (d = 3; d < max_disparity_pixels-1; d++)
-        {
-            if (disparity_histogram[d] > hist_thresh)
-            {
-                int m = disparity_histogram[d] + disparity_histogram[d-1] + disparity_histogram[d+1];
-                mass += m;
-                disp2 += m * d;
-            }
-            if (disparity_histogram[d] > 0)
-            {
-                hist_mean += disparity_histogram[d];
-                hist_mean_hits++;
-            }
-        }
-        if (mass > 0)
+    /* find the nearest raw pixel to each pixel, then copy them */
+#ifdef SVS_SIMD_X86
+    if (ctx->simd == SVS_SIMD_AVX2)
+    {
+        svs_rectify_index_avx2(map, SVS_RECTIFY_BITS, width, y, index);
+    }
+    else if (ctx->simd == SVS_SIMD_SSE2)
+    {
+        svs_rectify_index_sse2(map, SVS_RECTIFY_BITS, width, y, index);
+    }
+    else
+#endif
+    {
+        for (x = 0; x < width; x++)
+            index[x] = (((y << SVS_RECTIFY_BITS) + map[x*2 + 1] + half) >> SVS_RECTIFY_BITS) * width +
+                       (((x << SVS_RECTIFY_BITS) + map[x*2] + half) >> SVS_RECTIFY_BITS);
+    }
+
+    switch(ctx->format)
+    {
+    case SVS_FORMAT_LUMA8:
         {
-            disp2 /= mass;
-            hist_mean /= hist_mean_hits;
+            unsigned char* rectified = rectified_row;
+            for (x = 0; x < width; x++)
+                rectified[x] = raw_image[index[x]];
+            break;
         }
-
-        /* simple near/far classification adjusts
-         * the peak disparity that we're interested in */
-        int near = 1;
-        if (hist_mean*4 > disparity_histogram[0])
+    case SVS_FORMAT_LUMA16:
         {
-            near = 0;
+            unsigned short* raw = (unsigned short*)raw_image;
+            unsigned short* rectified = (unsigned short*)rectified_row;
+            for (x = 0; x < width; x++)
+                rectified[x] = raw[index[x]];
+            break;
         }
-
-        /* remove matches too far away from the peak by setting
-         * their probabilities to zero */
-        unsigned int min_disp = disp2 - tolerance;
-        unsigned int max_disp = disp2 + tolerance;
-        for (i = 0; i < no_of_possible_matches; i++)
+    default:
         {
-            unsigned int x = svs_matches[i*4 + 1];
-            if ((x > tx) && (x < bx))
+            unsigned char* rectified = rectified_row;
+            for (x = 0; x < width; x++, rectified += 3)
             {
-                unsigned int y = svs_matches[i*4 + 2];
-                if ((y > ty) && (y < by))
-                {
-                    unsigned int disp = svs_matches[i*4 + 3];
-                    if (near == 1)
-                    {
-                        if (!((disp < min_disp) || (disp > max_disp)))
-                        {
-                            /* near - within stereo ranging resolution */
-                            valid_quadrants[i]++;
-                        }
-                    }
-                    else
-                    {
-                        if (disp <= 2)
-                        {
-                            /* far out man */
-                            valid_quadrants[i]++;
-                        }
-                    }
-                }
+                p = index[x] * 3;
+                rectified[0] = raw_image[p];
+                rectified[1] = raw_image[p + 1];
+                rectified[2] = raw_image[p + 2];
             }
+            break;
         }
     }
+}
 
-    for (i = 0; i < no_of_possible_matches; i++)
+/* Ensures that the rows of the rectified image about row y are held in
+ * the rolling buffer, rectifying rows of the raw image as they are
+ * needed.  Rows which are still needed are kept, and the rest of the
+ * buffer is filled with the rows which follow, up to the last row to be
+ * read.  SVS_RECTIFY_ROWS is at least 2*descriptor_rows + 1 (see svs_init) */
+static void svs_rectified_rows(
+    struct svs_context* ctx,      /* context for this camera */
+    unsigned char* raw_image,     /* raw image grabbed from camera */
+    struct svs_rows* rows,        /* rows held in the buffer */
+    int y,                        /* row of the rectified image */
+    int* index)                   /* buffer of imgWidth entries */
+{
+    int stride = (int)ctx->imgWidth * svs_bytes_per_pixel(ctx);
+    int first = y - ctx->descriptor_rows;
+    int last = y + ctx->descriptor_rows;
+    int r, keep = 0;
+
+    if (first < 0)
+        first = 0;
+    if (last > rows->last)
+        rows->last = last;
+    if (rows->last > (int)ctx->imgHeight - 1)
+        rows->last = (int)ctx->imgHeight - 1;
+
+    if ((first < rows->first) || (last >= rows->first + rows->count))
     {
-        if (valid_quadrants[i] == 0)
+        if ((first >= rows->first) && (first < rows->first + rows->count))
         {
-            /* set probability to zero */
-            svs_matches[i*4] = 0;
+            keep = rows->first + rows->count - first;
+            memmove(rows->buffer, &rows->buffer[(first - rows->first) * stride], keep * stride);
         }
+        rows->first = first;
+        rows->count = SVS_RECTIFY_ROWS;
+        if (rows->count > rows->last - first + 1)
+            rows->count = rows->last - first + 1;
+        for (r = keep; r < rows->count; r++)
+            svs_rectify_line(ctx, raw_image, &rows->buffer[r * stride], first + r, index);
     }
 }
 
-/* takes the raw image and camera calibration parameters and returns a rectified image */
+/* parameters shared by every band of svs_rectify */
+struct svs_rectify_params
+{
+    struct svs_context* ctx;
+    unsigned char* raw_image;
+    unsigned char* rectified_frame_buf;
+    int bands;
+};
+
+/* rectifies one band of rows */
+static void svs_rectify_band(
+    void* arg,   /* svs_rectify_params */
+    int index)   /* index of the band */
+{
+    struct svs_rectify_params* params = (struct svs_rectify_params*)arg;
+    int height = (int)params->ctx->imgHeight;
+    int* buffer = (params->bands > 1) ? params->ctx->bands[index].rectify_index : params->ctx->rectify_index;
+    int stride = (int)params->ctx->imgWidth * svs_bytes_per_pixel(params->ctx);
+    int y;
+
+    for (y = height * index / params->bands; y < height * (index + 1) / params->bands; y++)
+        svs_rectify_line(params->ctx, params->raw_image, &params->rectified_frame_buf[y * stride], y, buffer);
+}
+
+/* Takes the raw image and returns a rectified image, using the map set by
+ * svs_rectify_row.  Bands of rows are rectified in parallel when more
+ * than one thread is used */
 void svs_rectify(
+    struct svs_context* ctx,      /* context for this camera */
     unsigned char* raw_image,     /* raw image grabbed from camera */
     unsigned char* rectified_frame_buf) /* returned rectified image */
 {
+    struct svs_rectify_params params;
+
+    params.ctx = ctx;
+    params.raw_image = raw_image;
+    params.rectified_frame_buf = rectified_frame_buf;
+    params.bands = svs_bands(ctx);
+
+    if (params.bands > 1)
+        svs_pool_run(ctx->pool, svs_rectify_band, &params, params.bands);
+    else
+        svs_rectify_band(&params, 0);
+}
+
+/* converts a raw RGB or mono image into the luma plane used by the
+ * context, so that rectification, feature detection and descriptors
+ * all work on a single channel.  Nothing is done for SVS_FORMAT_RGB */
+void svs_luma(
+    struct svs_context* ctx,      /* context for this camera */
+    unsigned char* raw_image,     /* raw image grabbed from camera */
+    int bytes_per_pixel,          /* 3 for RGB or 1 for mono */
+    unsigned char* luma_buf)      /* returned luma plane */
+{
+    int n, i;
+    int pixels = (int)(ctx->imgWidth * ctx->imgHeight);
+
+    if (ctx->format == SVS_FORMAT_RGB)
+        return;
+
+    if (bytes_per_pixel == 1)
+    {
+        if (ctx->format == SVS_FORMAT_LUMA8)
+        {
+            memcpy(luma_buf, raw_image, pixels);
+        }
+        else
+        {
+            /* keep the same scale as R+G+B */
+            unsigned short* luma = (unsigned short*)luma_buf;
+            for (n = 0; n < pixels; n++)
+                luma[n] = (unsigned short)(raw_image[n] * 3);
+        }
+        return;
+    }
 
-    int i, col, n = 0;
-    int max = imgWidth * imgHeight * 3;
-    for (i = 0; i < max; i += 3, n++)
+    switch(ctx->format)
     {
-        int index = calibration_map[n] * 3;
-        for (col = 0; col < 3; col++)
-            rectified_frame_buf[i + col] = raw_image[index + col];
+    case SVS_FORMAT_LUMA8:
+        {
+#ifdef SVS_SIMD_X86
+            if (ctx->simd != SVS_SIMD_NONE)
+            {
+                svs_rgb_to_luma8_sse2(raw_image, pixels, luma_buf);
+                break;
+            }
+#endif
+            for (n = 0, i = 0; n < pixels; n++, i += 3)
+                luma_buf[n] = (unsigned char)((raw_image[i] + raw_image[i+1] + raw_image[i+2]) / 3);
+            break;
+        }
+    case SVS_FORMAT_LUMA16:
+        {
+            unsigned short* luma = (unsigned short*)luma_buf;
+#ifdef SVS_SIMD_X86
+            if (ctx->simd != SVS_SIMD_NONE)
+            {
+                svs_rgb_to_luma16_sse2(raw_image, pixels, luma);
+                break;
+            }
+#endif
+            for (n = 0, i = 0; n < pixels; n++, i += 3)
+                luma[n] = (unsigned short)(raw_image[i] + raw_image[i+1] + raw_image[i+2]);
+            break;
+        }
     }
 }
 
@@ -4,31 +4,395 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "stereo_simd.h"
+#include "stereo_threads.h"
+#include "stereo_calibration.h"
 
 /* are we running on the blackfin or on a PC ? */
 //#define SVS_EMBEDDED
 
+/* default maximum number of features detected within each image */
 #define SVS_MAX_FEATURES         2000
-#define SVS_MAX_IMAGE_WIDTH      1280
-#define SVS_MAX_IMAGE_HEIGHT     1024
+
 #define SVS_VERTICAL_SAMPLING    2
+
+/* maximum number of horizontal bands adapted by the feature budget
+ * controller, and the limits within which it adjusts the thresholds */
+#define SVS_MAX_CONTROL_BANDS    16
+#define SVS_CONTROL_MIN_RESPONSE 10
+#define SVS_CONTROL_MAX_RESPONSE 65535
+#define SVS_CONTROL_MIN_RADIUS   4
+#define SVS_CONTROL_MAX_RADIUS   32
+
+/* alignment of the buffers within a context, in bytes */
+#define SVS_ARENA_ALIGNMENT      64
+
+/* Number of pixels sampled by each binary descriptor, giving one bit each.
+ * The default of 30 fits within a single word.  Wider descriptors of 64,
+ * 128 or 256 bits give fewer ambiguous matches on highly textured scenes,
+ * at some extra cost in extraction and matching */
+#ifndef SVS_DESCRIPTOR_PIXELS
 #define SVS_DESCRIPTOR_PIXELS    30
+#endif
+
+#if (SVS_DESCRIPTOR_PIXELS != 30) && (SVS_DESCRIPTOR_PIXELS != 64) && \
+    (SVS_DESCRIPTOR_PIXELS != 128) && (SVS_DESCRIPTOR_PIXELS != 256)
+#error "SVS_DESCRIPTOR_PIXELS must be 30, 64, 128 or 256"
+#endif
+
+/* number of 32 bit words in each descriptor */
+#define SVS_DESCRIPTOR_WORDS     ((SVS_DESCRIPTOR_PIXELS + 31) / 32)
+
+/* image formats which the stereo functions can operate upon */
+#define SVS_FORMAT_RGB           0   /* interleaved 3 byte RGB */
+#define SVS_FORMAT_LUMA8         1   /* 8 bit luma plane, (R+G+B)/3 */
+#define SVS_FORMAT_LUMA16        2   /* 16 bit luma plane, R+G+B */
+
+/* non-maximal suppression methods */
+#define SVS_NON_MAX_SCAN         0   /* suppress neighbours while scanning left to right */
+#define SVS_NON_MAX_WINDOW       1   /* sliding window maxima, independent of radius */
+
+/* fractional bits of sub-pixel feature positions and disparities */
+#define SVS_SUBPIXEL_BITS        4
+#define SVS_SUBPIXEL             (1 << SVS_SUBPIXEL_BITS)
+
+/* maximum number of sampled rows above and below searched by svs_match */
+#define SVS_MAX_MATCH_ROWS       8
+
+/* matches returned by svs_match */
+#define SVS_MATCHES_BEST         0   /* the best ideal_no_of_matches, in descending order of probability */
+#define SVS_MATCHES_SORTED       1   /* all matches, in descending order of probability */
+#define SVS_MATCHES_THRESHOLD    2   /* all matches above match_threshold, in order of increasing y */
+
+/* maximum number of grids of zones used by svs_filter, and the
+ * maximum total number of zones within them */
+#define SVS_MAX_FILTER_GRIDS     4
+#define SVS_MAX_FILTER_ZONES     16
+
+/* filters applied by svs_match to the possible matches */
+#define SVS_FILTER_HISTOGRAM     0   /* close to the disparity histogram peak of each zone */
+#define SVS_FILTER_PLANES        1   /* close to planes fitted by RANSAC, PCs only */
+#define SVS_FILTER_NONE          2   /* every possible match is kept */
+
+/* maximum number of plane hypotheses generated by SVS_FILTER_PLANES, and
+ * the number of matches against which they are scored before the worse
+ * half of the hypotheses is discarded */
+#define SVS_MAX_PLANE_HYPOTHESES 256
+#define SVS_PLANE_BLOCK          100
+
+/* methods used by svs_match to choose between possible matches */
+#define SVS_MATCHER_GREEDY       0   /* the best match of each feature independently */
+#define SVS_MATCHER_SCANLINE     1   /* the best ordered matches along each row, by dynamic programming */
+
+/* fractional bits of raw image positions within the rectification map */
+#define SVS_RECTIFY_BITS         6
+#define SVS_RECTIFY_SCALE        (1 << SVS_RECTIFY_BITS)
+
+/* interpolation of the raw image used by svs_rectify */
+#define SVS_RECTIFY_NEAREST      0
+#define SVS_RECTIFY_BILINEAR     1
+
+/* rows held by the rolling buffer used when svs_get_features rectifies
+ * the rows it needs, at least twice the vertical extent of the
+ * descriptor pattern plus one */
+#define SVS_RECTIFY_ROWS         32
+
+#define pixindex(xx, yy, width)  ((((yy) * (width)) + (xx)) * 3)
+
+/* Features detected within a single camera image.  The arrays are
+ * allocated by svs_init, sized for the feature budget and image height
+ * of the context */
+struct svs_data_struct
+{
+    /* array storing x coordinates of detected features */
+    short int* feature_x;
+
+    /* sub-pixel offset of each feature from feature_x, in units of
+     * 1/SVS_SUBPIXEL pixels.  Zero unless sub-pixel localisation is enabled */
+    signed char* feature_subx;
+
+    /* array storing the number of features detected on each row */
+    unsigned short int* features_per_row;
+
+    /* Array storing a binary descriptor, SVS_DESCRIPTOR_WORDS words in length,
+     * for each detected feature.  This will be used for matching purposes.*/
+    unsigned int* descriptor;
+
+    /* mean luminance for each feature */
+    unsigned char* mean;
+};
+
+/* All state belonging to one camera of a stereo rig.
+ * Every svs_* function operates on a context rather than on
+ * file scope globals, so several cameras (or several stereo heads)
+ * can be processed concurrently within the same process, provided
+ * that each thread works on its own context. */
+struct svs_context
+{
+    /* image dimensions */
+    unsigned int imgWidth, imgHeight;
+
+    /* maximum number of features detected within each image */
+    int max_features;
+
+    /* number of sampled rows within features_per_row */
+    int feature_rows;
+
+    /* Every buffer belonging to the context is allocated from this single
+     * block of memory, sized by svs_init for the image dimensions and
+     * feature budget, with each buffer aligned to SVS_ARENA_ALIGNMENT */
+    void* arena;
+
+    /* instruction set used by the vectorised kernels (SVS_SIMD_*).
+     * Detected from the CPU by svs_init, and may be set to
+     * SVS_SIMD_NONE to use the scalar reference code */
+    int simd;
+
+    /* format of the images passed to the stereo functions (SVS_FORMAT_*).
+     * The luma formats move a third of the data of RGB images.  Raw
+     * frames are converted once on arrival using svs_luma */
+    int format;
+
+    /* x,y offsets of the pixels sampled by each descriptor relative
+     * to the feature, and the same offsets as pixel indexes */
+    int descriptor_pattern[SVS_DESCRIPTOR_PIXELS*2];
+    int descriptor_offsets[SVS_DESCRIPTOR_PIXELS];
+
+    /* largest horizontal offset within the descriptor pattern */
+    int descriptor_radius;
+
+    /* largest vertical offset within the descriptor pattern */
+    int descriptor_rows;
+
+    /* features obtained from this camera */
+    struct svs_data_struct svs_data;
+
+    /* features received from the opposite camera */
+    struct svs_data_struct svs_data_received;
 
-#define pixindex(xx, yy)  ((yy * imgWidth + xx) * 3)
+    /* buffer which stores sliding sum */
+    int* row_sum;
 
-extern int svs_update_sums(int y, unsigned char* rectified_frame_buf);
-extern void svs_non_max(int inhibition_radius, unsigned int min_response);
-extern int svs_compute_descriptor(int px, int py, unsigned char* rectified_frame_buf, int no_of_features, int row_mean);
-extern int svs_get_features(unsigned char* rectified_frame_buf, int inhibition_radius, unsigned int minimum_response, int calibration_offset_x, int calibration_offset_y);
-extern int svs_match(int ideal_no_of_matches, int max_disparity_percent, int descriptor_match_threshold, int learnDesc, int learnLuma, int learnDisp);
+    /* buffer used to find peaks in edge space */
+    unsigned int* row_peaks;
 
-extern void svs_filter(int no_of_possible_matches, int max_disparity_pixels, int tolerance);
-extern void svs_rectify(unsigned char* raw_image, unsigned char* rectified_frame_buf);
+    /* If non-zero, feature positions are refined to a fraction of a pixel by
+     * fitting a parabola to the edge responses about each peak.  Disparities
+     * within svs_matches are then fixed point values with SVS_SUBPIXEL_BITS
+     * fractional bits, rather than whole pixels */
+    int subpixel;
+
+    /* non-maximal suppression method (SVS_NON_MAX_*) */
+    int non_max;
+
+    /* padded row and running maxima used by SVS_NON_MAX_WINDOW,
+     * three buffers of svs_window_length(imgWidth) entries */
+    unsigned int* non_max_window;
+
+    /* number of threads used by svs_get_features and svs_match.  With
+     * more than one thread the image is divided into bands of rows, giving
+     * the same features and matches as the single threaded version */
+    int threads;
+
+    /* Desired number of features per frame.  When non-zero the minimum
+     * response passed to svs_get_features is only used as a starting
+     * point, and is adapted from frame to frame within each of
+     * control_bands horizontal bands to approach the target.  If
+     * adapt_radius is set then the inhibition radius is also adapted
+     * once the response reaches its limits */
+    int target_features;
+    int control_bands;
+    int adapt_radius;
+    unsigned int control_response[SVS_MAX_CONTROL_BANDS];
+    int control_radius[SVS_MAX_CONTROL_BANDS];
+
+    /* worker threads and per band buffers, created on first use */
+    struct svs_pool* pool;
+    struct svs_band* bands;
+    int no_of_bands;
+    void* band_arena;
+
+    /* eigendescriptors for the features from the opposite camera, and
+     * matching scores for the features being compared */
+    unsigned int* eigen_descriptor;
+    unsigned int* match_scores;
+
+    /* index of the first feature on each sampled row, for this
+     * camera and for the opposite one */
+    int* feature_offset;
+    int* received_offset;
+
+    /* Number of sampled rows above and below each row, up to
+     * SVS_MAX_MATCH_ROWS, from which svs_match also considers features of
+     * the opposite camera, allowing for errors in the vertical calibration.
+     * Matching scores are reduced by row_penalty for each row of offset */
+    int match_rows;
+    int row_penalty;
+
+    /* If non-zero, svs_match assumes that consecutive images are frames of
+     * a video stream.  On each row, features are first compared within the
+     * range of disparities found on that row of the previous frame, widened
+     * by prior_margin pixels, and only compared over the full disparity
+     * range if no consistent match is found.  Every prior_keyframe frames,
+     * or never if zero, the full range is searched on every row.
+     *
+     * Only the scoring of features is reduced, which is about a third of
+     * the time taken by svs_match, so matching is at best around 1.5 times
+     * faster rather than several times.  A feature with a single candidate
+     * within the predicted range is searched for again, as is one without
+     * a consistent match, so where features are dense compared with the
+     * range most of them are scored twice and matching is slower than
+     * without a prior.  Since each of these features is searched for again
+     * anyway, keyframes only replace matches which were accepted within a
+     * wrong predicted range.  Over 40 frames of a synthetic stream with a
+     * drifting disparity, at least as many matches had the true disparity
+     * without keyframes as with the full range searched on every frame,
+     * so by default there are no keyframes */
+    int temporal;
+    int prior_margin;
+    int prior_keyframe;
+    int prior_frame;
+
+    /* minimum and maximum disparity for each sampled row of the previous frame */
+    int* prior_disp;
+
+    /* If non-zero, svs_match only keeps pairs of features which are each
+     * other's best match in both directions, removing many to one matches */
+    int consistency;
+
+    /* Method used by svs_match to choose between possible matches
+     * (SVS_MATCHER_*).  The scanline matcher chooses the matches along each
+     * row with the highest total probability, such that no two matches
+     * cross and no feature is matched twice.  It only considers features
+     * on the same row, and its matches are always consistent */
+    int matcher;
+
+    /* buffer used by the consistency check and the scanline matcher */
+    int* cross_check;
+
+    /* array stores matching probabilities (prob,x,y,disp).  See subpixel
+     * for the units of disparity */
+    unsigned int* svs_matches;
+
+    /* Matches returned by svs_match (SVS_MATCHES_*), and the minimum
+     * probability in the range 0-1000 used by SVS_MATCHES_THRESHOLD.
+     * Only the best matches are sorted, and unsorted matches are
+     * returned without sorting at all */
+    int match_output;
+    unsigned int match_threshold;
+
+    /* buffers used when sorting matches */
+    int* match_heap;
+    unsigned int* match_sorted;
+
+    /* Zones of the image within which svs_filter looks for a peak in the
+     * disparity histogram.  Each of the filter_grids grids divides the image
+     * into filter_grid[i*2] columns and filter_grid[i*2 + 1] rows, and a
+     * match is kept if it is close to the peak of its zone within any of
+     * the grids.  By default one grid of two columns and one of two rows
+     * give the left and right, and the upper and lower hemifields */
+    int filter_grids;
+    int filter_grid[SVS_MAX_FILTER_GRIDS*2];
+
+    /* array used to store the disparity histogram of each zone, allocated
+     * by svs_filter for histograms of histogram_length disparities */
+    int* disparity_histogram;
+    int histogram_length;
+
+    /* Filter applied by svs_match to the possible matches (SVS_FILTER_*).
+     * Planes within the scene are also planes in (x, y, disparity) space,
+     * so the plane filter fits up to filter_planes of them to the matches
+     * using preemptive RANSAC, and keeps the matches close to any of them.
+     * Up to plane_hypotheses planes through random triples of matches are
+     * tried, fewer once the best so far is close to enough of the matches,
+     * and are scored against successive blocks of matches, discarding the
+     * worse half after each block.  Planes are fitted until one is supported
+     * by fewer than plane_support percent of the matches.  Not available on
+     * the blackfin */
+    int filter;
+    int filter_planes;
+    int plane_hypotheses;
+    int plane_support;
+
+    /* x, y and disparity of the matches being fitted by the plane filter,
+     * each max_features entries in length, and the index of each match */
+    float* plane_points;
+    int* plane_index;
+
+    /* Map from rectified pixels to positions within the raw image, set by
+     * svs_rectify_row or from a stereo camera calibration by svs_calibrate.
+     * For each rectified pixel the x and y offsets to its
+     * raw position, in 1/SVS_RECTIFY_SCALE pixels.  Initially zero, so that
+     * the rectified image is the raw image */
+    short int* rectify_map;
+
+    /* map belonging to the context, which rectify_map points to unless a
+     * cached map has been mapped into memory by svs_calibration_cache, in
+     * which case the mapping is shared with the context of the other camera */
+    short int* rectify_buffer;
+    void* rectify_cache;
+
+    /* raw pixel of each pixel of the row being rectified */
+    int* rectify_index;
+
+    /* interpolation used by svs_rectify (SVS_RECTIFY_*) */
+    int interpolation;
+
+    /* If non-zero, svs_get_features is given the raw image rather than the
+     * rectified one.  Only the rows about each sampled row are rectified,
+     * as they are reached, into a rolling buffer of SVS_RECTIFY_ROWS rows,
+     * so that a rectified image is never written to memory and read back.
+     * The features are the same as those of the rectified image */
+    int rectify_rows;
+
+    /* rolling buffer of rectified rows */
+    unsigned char* rectify_window;
+};
+
+/* length of each of the buffers used by SVS_NON_MAX_WINDOW */
+#define svs_window_length(width)  (((width) * 3 + 16 + 15) & ~15)
+
+/* length of the rolling buffer of rectified rows used by svs_get_features */
+#define svs_rectify_window_bytes(width)  ((width) * 3 * SVS_RECTIFY_ROWS)
+
+extern int svs_init(struct svs_context* ctx, unsigned int width, unsigned int height, int max_features);
+extern void svs_release(struct svs_context* ctx);
+extern struct svs_context* svs_create(unsigned int width, unsigned int height, int max_features);
+extern void svs_free(struct svs_context* ctx);
+extern int svs_data_size(struct svs_context* ctx);
+extern void svs_receive(struct svs_context* ctx, struct svs_data_struct* received);
+
+extern int svs_update_sums(struct svs_context* ctx, int y, unsigned char* rectified_frame_buf);
+extern void svs_non_max(struct svs_context* ctx, int inhibition_radius, unsigned int min_response);
+extern int svs_compute_descriptor(struct svs_context* ctx, int px, int py, unsigned char* rectified_frame_buf, int no_of_features, int row_mean);
+extern int svs_get_features(struct svs_context* ctx, unsigned char* rectified_frame_buf, int inhibition_radius, unsigned int minimum_response, int calibration_offset_x, int calibration_offset_y);
+extern int svs_match(struct svs_context* ctx, int ideal_no_of_matches, int max_disparity_percent, int descriptor_match_threshold, int learnDesc, int learnLuma, int learnDisp);
+
+extern void svs_filter(struct svs_context* ctx, int no_of_possible_matches, int max_disparity_pixels, int tolerance);
+
+#ifndef SVS_EMBEDDED
+/* number of ints in the buffer used by svs_crossings for the given number of matches */
+#define SVS_CROSSINGS_BUFFER(no_of_matches)  ((no_of_matches) * 4)
+
+extern long long svs_crossings(struct svs_context* ctx, const unsigned int* matches, int no_of_matches, int* pairs);
+
+/* estimates the quality of a set of matches for svs_learn.  Called from
+ * several threads at once, each with its own matches, and with its own
+ * buffer of SVS_CROSSINGS_BUFFER(max_features) ints for svs_crossings */
+typedef float (*svs_quality)(struct svs_context* ctx, const unsigned int* matches, int no_of_matches, int* pairs, void* arg);
+
+extern float svs_learn(struct svs_context* ctx, int ideal_no_of_matches, int max_disparity_percent, int descriptor_match_threshold,
+                       const int* min_weights, const int* max_weights, int minimum_matches, int threads,
+                       svs_quality quality, void* arg, int* learnt);
+#endif
+extern void svs_rectify_row(struct svs_context* ctx, int y, const int* source_x, const int* source_y);
+extern void svs_rectify(struct svs_context* ctx, unsigned char* raw_image, unsigned char* rectified_frame_buf);
+extern void svs_luma(struct svs_context* ctx, unsigned char* raw_image, int bytes_per_pixel, unsigned char* luma_buf);
 
 #ifdef SVS_EMBEDDED
 void svs_master(unsigned short *outbuf16, unsigned short *inbuf16, int bufsize);
 void svs_slave(unsigned short *inbuf16, unsigned short *outbuf16, int bufsize);
-extern int svs_grab(int calibration_offset_x, int calibration_offset_y);
+extern int svs_grab(struct svs_context* ctx, int calibration_offset_x, int calibration_offset_y);
 #endif
 
 #endif
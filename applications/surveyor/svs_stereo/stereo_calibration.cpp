@@ -0,0 +1,526 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *  stereo_calibration.cpp - rectification maps from stereo camera calibration
+ *    Copyright (C) 2009  Surveyor Corporation
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details (www.gnu.org/licenses)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <math.h>
+#include "stereo.h"
+
+#ifndef SVS_EMBEDDED
+
+#ifdef SVS_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* first word of a cached map file, "SVSM" */
+#define SVS_CALIBRATION_MAGIC    0x4d535653
+
+/* header at the start of a cached map file, followed by
+ * the maps of the left and right cameras */
+struct svs_calibration_header
+{
+    unsigned int magic;          /* SVS_CALIBRATION_MAGIC */
+    unsigned int version;        /* SVS_CALIBRATION_VERSION */
+    unsigned int hash;           /* hash of the calibration the maps were built from */
+    int width, height;           /* dimensions of the maps */
+    int bits;                    /* SVS_RECTIFY_BITS */
+    int reserved[10];
+};
+
+/* Returns the text of the first element with the given name at or after
+ * the given position within an xml document, and starting before the given
+ * end of the search, or NULL if there is none */
+static const char* svs_xml_element(
+    const char* xml,    /* position to search from */
+    const char* end,    /* end of the search, or NULL for the end of the document */
+    const char* name)   /* name of the element */
+{
+    size_t length = strlen(name);
+    const char* p = xml;
+
+    while (((p = strchr(p, '<')) != NULL) && ((end == NULL) || (p < end)))
+    {
+        p++;
+        if ((strncmp(p, name, length) == 0) && (p[length] == '>'))
+            return(p + length + 1);
+    }
+    return(NULL);
+}
+
+/* returns non-zero if the given element contains "True" */
+static int svs_xml_true(
+    const char* xml,
+    const char* name)
+{
+    const char* text = svs_xml_element(xml, NULL, name);
+    return((text != NULL) && (strncmp(text, "True", 4) == 0));
+}
+
+/* reads the whole of a file into a buffer terminated by a zero,
+ * which should be freed by the caller */
+static char* svs_read_file(
+    const char* filename)
+{
+    FILE* file = fopen(filename, "rb");
+    char* buffer = NULL;
+    long length;
+
+    if (file == NULL)
+        return(NULL);
+    if ((fseek(file, 0, SEEK_END) == 0) &&
+            ((length = ftell(file)) >= 0) &&
+            (fseek(file, 0, SEEK_SET) == 0))
+    {
+        buffer = (char*)malloc(length + 1);
+        if ((buffer != NULL) &&
+                (fread(buffer, 1, length, file) != (size_t)length))
+        {
+            free(buffer);
+            buffer = NULL;
+        }
+        if (buffer != NULL)
+            buffer[length] = 0;
+    }
+    fclose(file);
+    return(buffer);
+}
+
+/* Loads the calibration of a stereo camera from an xml file saved by
+ * stereoserver.  Returns zero on success, or -1 if the file could not
+ * be read or does not contain the calibration of two cameras */
+int svs_calibration_load(
+    struct svs_calibration* calib,   /* returned calibration */
+    const char* filename)            /* xml file to be loaded */
+{
+    const char* text;
+    const char* camera;
+    const char* camera_end;
+    char* end;
+    int cam, result = -1;
+
+    memset(calib, 0, sizeof(struct svs_calibration));
+    calib->scale = 1;
+
+    char* xml = svs_read_file(filename);
+    if (xml == NULL)
+        return(-1);
+
+    text = svs_xml_element(xml, NULL, "ImageDimensions");
+    if ((text != NULL) &&
+            (sscanf(text, "%dx%d", &calib->image_width, &calib->image_height) == 2) &&
+            (calib->image_width > 0) && (calib->image_height > 0))
+    {
+        text = svs_xml_element(xml, NULL, "Offsets");
+        if (text != NULL)
+            sscanf(text, "%f %f", &calib->offset_x, &calib->offset_y);
+        text = svs_xml_element(xml, NULL, "RelativeRotationDegrees");
+        if (text != NULL)
+            calib->rotation = (float)(strtod(text, NULL) * M_PI / 180.0);
+        text = svs_xml_element(xml, NULL, "RelativeImageScale");
+        if ((text != NULL) && (strtod(text, NULL) > 0))
+            calib->scale = (float)strtod(text, NULL);
+        calib->disable_rectification = svs_xml_true(xml, "DisableRectification");
+        calib->disable_radial_correction = svs_xml_true(xml, "DisableRadialCorrection");
+
+        /* each camera has its own centre of distortion and polynomial,
+         * which are only searched for up to the end of its element, so
+         * that those of the next camera are never used in their place */
+        camera = xml;
+        for (cam = 0; cam < 2; cam++)
+        {
+            struct svs_camera_calibration* c = &calib->camera[cam];
+            camera = svs_xml_element(camera, NULL, "Camera");
+            if (camera == NULL)
+                break;
+            camera_end = strstr(camera, "</Camera>");
+            if (camera_end == NULL)
+                break;
+
+            text = svs_xml_element(camera, camera_end, "CentreOfDistortion");
+            if ((text == NULL) ||
+                    (sscanf(text, "%f %f", &c->centre_x, &c->centre_y) != 2))
+                break;
+
+            /* cameras without a polynomial are not corrected for distortion */
+            c->degree = -1;
+            text = svs_xml_element(camera, camera_end, "DistortionCoefficients");
+            while ((text != NULL) && (c->degree < SVS_CALIBRATION_MAX_DEGREE))
+            {
+                double coefficient = strtod(text, &end);
+                if (end == text)
+                    break;
+                c->coefficient[++c->degree] = coefficient;
+                text = end;
+            }
+            if (c->degree < 1)
+            {
+                memset(c->coefficient, 0, sizeof(c->coefficient));
+                c->degree = 1;
+                c->coefficient[1] = 1;
+            }
+        }
+        if (cam == 2)
+            result = 0;
+    }
+
+    free(xml);
+    return(result);
+}
+
+/* parameters shared by every task of svs_calibration_maps */
+struct svs_calibration_params
+{
+    const struct svs_calibration* calib;
+    struct svs_context* ctx[2];
+    int bands;           /* bands of rows for each camera */
+    int* source;         /* source positions of a row, for each task */
+};
+
+/* Builds the map of one band of rows for one camera.  The map gives the
+ * position of each rectified pixel within the raw image, found as within
+ * stereoserver by correcting the lens distortion about the centre of
+ * distortion, then scaling and rotating about the centre of the image.
+ * Calibration pixels are scaled to the dimensions of the context */
+static void svs_calibration_band(
+    void* arg,   /* svs_calibration_params */
+    int index)   /* camera * bands + band */
+{
+    struct svs_calibration_params* params = (struct svs_calibration_params*)arg;
+    const struct svs_calibration* calib = params->calib;
+    int cam = index / params->bands;
+    int band = index % params->bands;
+    struct svs_context* ctx = params->ctx[cam];
+    const struct svs_camera_calibration* c = &calib->camera[cam];
+    int width = (int)ctx->imgWidth;
+    int height = (int)ctx->imgHeight;
+    int* source_x = &params->source[index * width * 2];
+    int* source_y = &source_x[width];
+    int x, y, i;
+
+    /* calibration pixels per pixel of the context */
+    double scale_x = calib->image_width / (double)width;
+    double scale_y = calib->image_height / (double)height;
+    int half_width = calib->image_width / 2;
+    int half_height = calib->image_height / 2;
+
+    /* the left image is scaled down when the right image is larger,
+     * and otherwise both are scaled by the inverse of the relative scale */
+    double scale = 1.0 / calib->scale;
+    if ((cam == 0) && (scale > 1))
+        scale = calib->scale;
+    else if ((cam == 1) && (1.0 / calib->scale > 1))
+        scale = 1;
+
+    /* only the right image is rotated */
+    double rotation = (cam == 1) ? calib->rotation : 0;
+    double cos_rotation = cos(rotation);
+    double sin_rotation = sin(rotation);
+
+    for (y = height * band / params->bands; y < height * (band + 1) / params->bands; y++)
+    {
+        double v = (y + 0.5) * scale_y - 0.5;
+        double dy = v - c->centre_y;
+        for (x = 0; x < width; x++)
+        {
+            double u = (x + 0.5) * scale_x - 0.5;
+            double raw_u = u, raw_v = v;
+            if (calib->disable_rectification == 0)
+            {
+                double dx = u - c->centre_x;
+                double ratio = 1;
+                double radius = sqrt(dx*dx + dy*dy);
+                if ((calib->disable_radial_correction == 0) && (radius >= 0.01))
+                {
+                    double raw_radius = 0;
+                    for (i = c->degree; i >= 0; i--)
+                        raw_radius = raw_radius * radius + c->coefficient[i];
+                    if (raw_radius > 0)
+                        ratio = raw_radius / radius;
+                }
+                double a = (c->centre_x + dx * ratio - half_width) * scale;
+                double b = (c->centre_y + dy * ratio - half_height) * scale;
+                raw_u = a * cos_rotation + b * sin_rotation + half_width;
+                raw_v = b * cos_rotation - a * sin_rotation + half_height;
+            }
+            source_x[x] = (int)floor(((raw_u + 0.5) / scale_x - 0.5) * SVS_RECTIFY_SCALE + 0.5);
+            source_y[x] = (int)floor(((raw_v + 0.5) / scale_y - 0.5) * SVS_RECTIFY_SCALE + 0.5);
+        }
+        svs_rectify_row(ctx, y, source_x, source_y);
+    }
+}
+
+/* Builds the rectification maps of the left and right cameras from their
+ * calibration.  Bands of rows of both maps are built in parallel, using
+ * as many threads as the two contexts use between them */
+void svs_calibration_maps(
+    const struct svs_calibration* calib,   /* calibration of the stereo camera */
+    struct svs_context* left,              /* context for the left camera */
+    struct svs_context* right)             /* context for the right camera */
+{
+    struct svs_calibration_params params;
+    int threads = left->threads + right->threads;
+    int width = (left->imgWidth > right->imgWidth) ? (int)left->imgWidth : (int)right->imgWidth;
+
+    svs_calibration_unmap(left);
+    svs_calibration_unmap(right);
+
+    params.calib = calib;
+    params.ctx[0] = left;
+    params.ctx[1] = right;
+    params.bands = (threads + 1) / 2;
+    params.source = (int*)malloc(2 * params.bands * width * 2 * sizeof(int));
+    if (params.source == NULL)
+    {
+        /* build the maps a row at a time without threads */
+        params.bands = 1;
+        params.source = (int*)malloc(2 * width * 2 * sizeof(int));
+        if (params.source == NULL)
+            return;
+        threads = 1;
+    }
+
+    struct svs_pool* pool = (threads > 1) ? svs_pool_create(threads) : NULL;
+    svs_pool_run(pool, svs_calibration_band, &params, 2 * params.bands);
+    svs_pool_free(pool);
+    free(params.source);
+}
+
+/* updates a 32 bit FNV-1a hash with the given bytes */
+static unsigned int svs_hash(
+    unsigned int hash,
+    const void* data,
+    size_t bytes)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    while (bytes-- > 0)
+        hash = (hash ^ *p++) * 16777619u;
+    return(hash);
+}
+
+/* Returns a hash of the parts of the calibration used to build the maps,
+ * so that maps cached for a different calibration are not used */
+static unsigned int svs_calibration_hash(
+    const struct svs_calibration* calib)
+{
+    unsigned int hash = 2166136261u;
+    int cam;
+
+    hash = svs_hash(hash, &calib->image_width, sizeof(int));
+    hash = svs_hash(hash, &calib->image_height, sizeof(int));
+    hash = svs_hash(hash, &calib->rotation, sizeof(float));
+    hash = svs_hash(hash, &calib->scale, sizeof(float));
+    hash = svs_hash(hash, &calib->disable_rectification, sizeof(int));
+    hash = svs_hash(hash, &calib->disable_radial_correction, sizeof(int));
+    for (cam = 0; cam < 2; cam++)
+    {
+        const struct svs_camera_calibration* c = &calib->camera[cam];
+        hash = svs_hash(hash, &c->centre_x, sizeof(float));
+        hash = svs_hash(hash, &c->centre_y, sizeof(float));
+        hash = svs_hash(hash, &c->degree, sizeof(int));
+        hash = svs_hash(hash, c->coefficient, (c->degree + 1) * sizeof(double));
+    }
+    return(hash);
+}
+
+/* fills in the header expected for the maps of the given contexts */
+static void svs_calibration_header(
+    const struct svs_calibration* calib,
+    struct svs_context* ctx,
+    struct svs_calibration_header* header)
+{
+    memset(header, 0, sizeof(struct svs_calibration_header));
+    header->magic = SVS_CALIBRATION_MAGIC;
+    header->version = SVS_CALIBRATION_VERSION;
+    header->hash = svs_calibration_hash(calib);
+    header->width = (int)ctx->imgWidth;
+    header->height = (int)ctx->imgHeight;
+    header->bits = SVS_RECTIFY_BITS;
+}
+
+/* Saves the maps of the left and right cameras, built from the given
+ * calibration, to a cache file.  The file is written under a temporary
+ * name and then renamed, so that other processes never see part of it.
+ * Returns zero on success, or -1 if the file could not be written */
+int svs_calibration_save(
+    const struct svs_calibration* calib,   /* calibration the maps were built from */
+    struct svs_context* left,              /* context for the left camera */
+    struct svs_context* right,             /* context for the right camera */
+    const char* filename)                  /* cache file */
+{
+    struct svs_calibration_header header;
+    size_t map_length = left->imgWidth * left->imgHeight * 2;
+    int result = -1;
+
+    if ((left->imgWidth != right->imgWidth) || (left->imgHeight != right->imgHeight))
+        return(-1);
+
+    char* temporary = (char*)malloc(strlen(filename) + 5);
+    if (temporary == NULL)
+        return(-1);
+    sprintf(temporary, "%s.tmp", filename);
+
+    FILE* file = fopen(temporary, "wb");
+    if (file != NULL)
+    {
+        svs_calibration_header(calib, left, &header);
+        if ((fwrite(&header, sizeof(header), 1, file) == 1) &&
+                (fwrite(left->rectify_map, sizeof(short int), map_length, file) == map_length) &&
+                (fwrite(right->rectify_map, sizeof(short int), map_length, file) == map_length))
+            result = 0;
+        if (fclose(file) != 0)
+            result = -1;
+
+#ifdef _WIN32
+        if (result == 0)
+            remove(filename);
+#endif
+        if ((result == 0) && (rename(temporary, filename) != 0))
+            result = -1;
+        if (result != 0)
+            remove(temporary);
+    }
+
+    free(temporary);
+    return(result);
+}
+
+#ifdef SVS_MMAP
+/* a cache file mapped into memory, containing the maps of both cameras */
+struct svs_calibration_mapping
+{
+    void* address;
+    size_t bytes;
+    int users;   /* contexts whose map is within the mapping */
+};
+#endif
+
+/* releases a cached map mapped by svs_calibration_cache, after which the
+ * context uses its own map again.  The file is unmapped once neither
+ * camera uses it */
+void svs_calibration_unmap(
+    struct svs_context* ctx)   /* context for the camera */
+{
+#ifdef SVS_MMAP
+    struct svs_calibration_mapping* mapping = (struct svs_calibration_mapping*)ctx->rectify_cache;
+    if ((mapping != NULL) && (--mapping->users == 0))
+    {
+        munmap(mapping->address, mapping->bytes);
+        free(mapping);
+    }
+#endif
+    ctx->rectify_cache = NULL;
+    ctx->rectify_map = ctx->rectify_buffer;
+}
+
+/* Uses the maps within a cache file saved by svs_calibration_save, if it
+ * was saved by this version for the given calibration and image size.
+ * The file is mapped into memory once for both cameras, so that only the
+ * pages which are used are read, and the maps may still be changed with
+ * svs_rectify_row without changing the file.  Where mmap is unavailable
+ * the maps are read instead.  Returns zero on success, or -1 if the maps
+ * need to be built with svs_calibration_maps */
+int svs_calibration_cache(
+    const struct svs_calibration* calib,   /* calibration of the stereo camera */
+    struct svs_context* left,              /* context for the left camera */
+    struct svs_context* right,             /* context for the right camera */
+    const char* filename)                  /* cache file */
+{
+    struct svs_calibration_header expected, header;
+    size_t map_bytes = left->imgWidth * left->imgHeight * 2 * sizeof(short int);
+    size_t bytes = sizeof(header) + 2 * map_bytes;
+    int result = -1;
+
+    if ((left->imgWidth != right->imgWidth) || (left->imgHeight != right->imgHeight))
+        return(-1);
+    svs_calibration_header(calib, left, &expected);
+
+#ifdef SVS_MMAP
+    struct stat status;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return(-1);
+    if ((fstat(fd, &status) == 0) && ((size_t)status.st_size == bytes) &&
+            (read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header)) &&
+            (memcmp(&header, &expected, sizeof(header)) == 0))
+    {
+        struct svs_calibration_mapping* mapping =
+            (struct svs_calibration_mapping*)malloc(sizeof(struct svs_calibration_mapping));
+        if (mapping != NULL)
+        {
+            mapping->address = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (mapping->address != MAP_FAILED)
+            {
+                svs_calibration_unmap(left);
+                svs_calibration_unmap(right);
+                mapping->bytes = bytes;
+                mapping->users = 2;
+                left->rectify_cache = mapping;
+                right->rectify_cache = mapping;
+                left->rectify_map = (short int*)((unsigned char*)mapping->address + sizeof(header));
+                right->rectify_map = (short int*)((unsigned char*)mapping->address + sizeof(header) + map_bytes);
+                result = 0;
+            }
+            else
+                free(mapping);
+        }
+    }
+    close(fd);
+#else
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL)
+        return(-1);
+    if ((fread(&header, sizeof(header), 1, file) == 1) &&
+            (memcmp(&header, &expected, sizeof(header)) == 0))
+    {
+        svs_calibration_unmap(left);
+        svs_calibration_unmap(right);
+        if ((fread(left->rectify_map, 1, map_bytes, file) == map_bytes) &&
+                (fread(right->rectify_map, 1, map_bytes, file) == map_bytes))
+            result = 0;
+    }
+    fclose(file);
+#endif
+
+    return(result);
+}
+
+/* Loads the calibration of a stereo camera from an xml file saved by
+ * stereoserver and sets the rectification maps of both cameras.  The maps
+ * are taken from the cache file if it matches the calibration, and are
+ * otherwise built and saved to it for next time.  The cache file may be
+ * NULL.  Returns zero on success, or -1 if the calibration could not be
+ * loaded */
+int svs_calibrate(
+    struct svs_calibration* calib,   /* returned calibration */
+    struct svs_context* left,        /* context for the left camera */
+    struct svs_context* right,       /* context for the right camera */
+    const char* xml_filename,        /* calibration saved by stereoserver */
+    const char* cache_filename)      /* cache of the maps, or NULL */
+{
+    if (svs_calibration_load(calib, xml_filename) != 0)
+        return(-1);
+
+    if ((cache_filename != NULL) &&
+            (svs_calibration_cache(calib, left, right, cache_filename) == 0))
+        return(0);
+
+    svs_calibration_maps(calib, left, right);
+    if (cache_filename != NULL)
+        svs_calibration_save(calib, left, right, cache_filename);
+    return(0);
+}
+
+#endif
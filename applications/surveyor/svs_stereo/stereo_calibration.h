@@ -0,0 +1,83 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *  stereo_calibration.h - rectification maps from stereo camera calibration
+ *    Copyright (C) 2009  Surveyor Corporation
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details (www.gnu.org/licenses)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef STEREO_CALIBRATION_H_
+#define STEREO_CALIBRATION_H_
+
+/* calibration files are only read on PCs */
+#ifndef SVS_EMBEDDED
+
+/* cached maps are mapped into memory where mmap is available */
+#ifndef _WIN32
+#define SVS_MMAP
+#endif
+
+/* highest degree of the lens distortion polynomial */
+#define SVS_CALIBRATION_MAX_DEGREE     8
+
+/* changed whenever the layout of cached maps changes */
+#define SVS_CALIBRATION_VERSION        1
+
+/* lens distortion of one camera */
+struct svs_camera_calibration
+{
+    float centre_x, centre_y;   /* centre of distortion in pixels */
+
+    /* coefficients of the polynomial giving the radial distance of a
+     * raw pixel from the centre of distortion, given the radial distance
+     * of the rectified pixel */
+    int degree;
+    double coefficient[SVS_CALIBRATION_MAX_DEGREE + 1];
+};
+
+/* Calibration of a stereo camera, as saved by stereoserver.  Pixel
+ * positions are within images of image_width x image_height pixels, and
+ * are scaled to the dimensions of the contexts being calibrated */
+struct svs_calibration
+{
+    int image_width, image_height;
+
+    /* offsets in pixels due to the cameras not being parallel, which
+     * are passed to svs_get_features rather than held in the maps */
+    float offset_x, offset_y;
+
+    /* rotation in radians and scale of the right image relative to the left */
+    float rotation;
+    float scale;
+
+    /* non-zero if the raw images are not to be rectified at all, or
+     * if only the rotation and scale are to be corrected */
+    int disable_rectification;
+    int disable_radial_correction;
+
+    /* left and right cameras */
+    struct svs_camera_calibration camera[2];
+};
+
+struct svs_context;
+
+extern int svs_calibration_load(struct svs_calibration* calib, const char* filename);
+extern void svs_calibration_maps(const struct svs_calibration* calib, struct svs_context* left, struct svs_context* right);
+extern int svs_calibration_save(const struct svs_calibration* calib, struct svs_context* left, struct svs_context* right,
+                                const char* filename);
+extern int svs_calibration_cache(const struct svs_calibration* calib, struct svs_context* left, struct svs_context* right,
+                                 const char* filename);
+extern int svs_calibrate(struct svs_calibration* calib, struct svs_context* left, struct svs_context* right,
+                         const char* xml_filename, const char* cache_filename);
+extern void svs_calibration_unmap(struct svs_context* ctx);
+
+#endif
+
+#endif
@@ -0,0 +1,1015 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *  stereo_simd.c - SIMD kernels for the SVS stereo functions
+ *    Copyright (C) 2009  Surveyor Corporation
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details (www.gnu.org/licenses)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <string.h>
+#include "stereo_simd.h"
+
+#ifdef SVS_SIMD_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+/* returns the best instruction set available on this CPU */
+int svs_simd_detect()
+{
+#ifdef SVS_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+        return(SVS_SIMD_AVX2);
+    return(SVS_SIMD_SSE2);
+#else
+    return(SVS_SIMD_NONE);
+#endif
+}
+
+#ifdef SVS_SIMD_X86
+
+/* separates 32 interleaved RGB pixels, held in six registers,
+ * into planar form.  On return v0,v1 hold the red values,
+ * v2,v3 the green values and v4,v5 the blue values */
+static inline void svs_deinterleave_rgb(
+    __m128i& v0, __m128i& v1, __m128i& v2,
+    __m128i& v3, __m128i& v4, __m128i& v5)
+{
+    /* each round of byte unpacking performs a perfect shuffle,
+     * and five rounds separate the three channels */
+    for (int round = 0; round < 5; round++)
+    {
+        __m128i c0 = _mm_unpacklo_epi8(v0, v3);
+        __m128i c1 = _mm_unpackhi_epi8(v0, v3);
+        __m128i c2 = _mm_unpacklo_epi8(v1, v4);
+        __m128i c3 = _mm_unpackhi_epi8(v1, v4);
+        __m128i c4 = _mm_unpacklo_epi8(v2, v5);
+        __m128i c5 = _mm_unpackhi_epi8(v2, v5);
+        v0 = c0; v1 = c1; v2 = c2;
+        v3 = c3; v4 = c4; v5 = c5;
+    }
+}
+
+/* adds a prefix sum of eight 16 bit pixel sums to the running
+ * total and stores the resulting eight 32 bit sliding sums */
+static inline __m128i svs_prefix_sum_epi16(
+    __m128i v,        /* eight pixel sums */
+    __m128i carry,    /* running total broadcast to all lanes */
+    int* row_sum)     /* returned sliding sums */
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    /* 8 x 765 fits within 16 bits */
+    v = _mm_add_epi16(v, _mm_slli_si128(v, 2));
+    v = _mm_add_epi16(v, _mm_slli_si128(v, 4));
+    v = _mm_add_epi16(v, _mm_slli_si128(v, 8));
+
+    __m128i lo = _mm_add_epi32(_mm_unpacklo_epi16(v, zero), carry);
+    __m128i hi = _mm_add_epi32(_mm_unpackhi_epi16(v, zero), carry);
+    _mm_storeu_si128((__m128i*)row_sum, lo);
+    _mm_storeu_si128((__m128i*)(row_sum + 4), hi);
+    return(_mm_shuffle_epi32(hi, 0xff));
+}
+
+/* loads 32 interleaved RGB pixels and returns R+G+B for each
+ * of them as four registers of eight 16 bit values */
+static inline void svs_rgb_sums(
+    const unsigned char* rgb,
+    __m128i& s0, __m128i& s1, __m128i& s2, __m128i& s3)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i v0 = _mm_loadu_si128((const __m128i*)rgb);
+    __m128i v1 = _mm_loadu_si128((const __m128i*)(rgb + 16));
+    __m128i v2 = _mm_loadu_si128((const __m128i*)(rgb + 32));
+    __m128i v3 = _mm_loadu_si128((const __m128i*)(rgb + 48));
+    __m128i v4 = _mm_loadu_si128((const __m128i*)(rgb + 64));
+    __m128i v5 = _mm_loadu_si128((const __m128i*)(rgb + 80));
+    svs_deinterleave_rgb(v0, v1, v2, v3, v4, v5);
+
+    s0 = _mm_add_epi16(_mm_add_epi16(
+             _mm_unpacklo_epi8(v0, zero), _mm_unpacklo_epi8(v2, zero)),
+             _mm_unpacklo_epi8(v4, zero));
+    s1 = _mm_add_epi16(_mm_add_epi16(
+             _mm_unpackhi_epi8(v0, zero), _mm_unpackhi_epi8(v2, zero)),
+             _mm_unpackhi_epi8(v4, zero));
+    s2 = _mm_add_epi16(_mm_add_epi16(
+             _mm_unpacklo_epi8(v1, zero), _mm_unpacklo_epi8(v3, zero)),
+             _mm_unpacklo_epi8(v5, zero));
+    s3 = _mm_add_epi16(_mm_add_epi16(
+             _mm_unpackhi_epi8(v1, zero), _mm_unpackhi_epi8(v3, zero)),
+             _mm_unpackhi_epi8(v5, zero));
+}
+
+/* computes the sliding sum of R+G+B along a row of interleaved RGB pixels.
+ * Produces the same values as the scalar loop within svs_update_sums */
+void svs_row_sum_sse2(
+    const unsigned char* rgb,  /* start of the row */
+    int width,                 /* row width in pixels */
+    int* row_sum)              /* returned sliding sums */
+{
+    __m128i carry = _mm_setzero_si128();
+    __m128i s0, s1, s2, s3;
+    int x = 0;
+
+    for (; x + 32 <= width; x += 32, rgb += 96)
+    {
+        svs_rgb_sums(rgb, s0, s1, s2, s3);
+        carry = svs_prefix_sum_epi16(s0, carry, &row_sum[x]);
+        carry = svs_prefix_sum_epi16(s1, carry, &row_sum[x + 8]);
+        carry = svs_prefix_sum_epi16(s2, carry, &row_sum[x + 16]);
+        carry = svs_prefix_sum_epi16(s3, carry, &row_sum[x + 24]);
+    }
+
+    /* remaining pixels */
+    int sum = _mm_cvtsi128_si32(carry);
+    for (; x < width; x++, rgb += 3)
+    {
+        sum += rgb[0] + rgb[1] + rgb[2];
+        row_sum[x] = sum;
+    }
+}
+
+/* computes the sliding sum along a row of an 8 bit luma plane */
+void svs_row_sum_luma8_sse2(
+    const unsigned char* luma,  /* start of the row */
+    int width,                  /* row width in pixels */
+    int* row_sum)               /* returned sliding sums */
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i carry = zero;
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)&luma[x]);
+        carry = svs_prefix_sum_epi16(_mm_unpacklo_epi8(v, zero), carry, &row_sum[x]);
+        carry = svs_prefix_sum_epi16(_mm_unpackhi_epi8(v, zero), carry, &row_sum[x + 8]);
+    }
+
+    int sum = _mm_cvtsi128_si32(carry);
+    for (; x < width; x++)
+    {
+        sum += luma[x];
+        row_sum[x] = sum;
+    }
+}
+
+/* computes the sliding sum along a row of a 16 bit luma plane
+ * whose values are no greater than 765 */
+void svs_row_sum_luma16_sse2(
+    const unsigned short* luma,  /* start of the row */
+    int width,                   /* row width in pixels */
+    int* row_sum)                /* returned sliding sums */
+{
+    __m128i carry = _mm_setzero_si128();
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8)
+        carry = svs_prefix_sum_epi16(_mm_loadu_si128((const __m128i*)&luma[x]), carry, &row_sum[x]);
+
+    int sum = _mm_cvtsi128_si32(carry);
+    for (; x < width; x++)
+    {
+        sum += luma[x];
+        row_sum[x] = sum;
+    }
+}
+
+/* converts interleaved RGB pixels to an 8 bit luma plane, (R+G+B)/3 */
+void svs_rgb_to_luma8_sse2(
+    const unsigned char* rgb,  /* RGB image */
+    int pixels,                /* number of pixels */
+    unsigned char* luma)       /* returned luma plane */
+{
+    /* (v * 0xaaab) >> 17 equals v / 3 for all v up to 765 */
+    const __m128i third = _mm_set1_epi16((short)0xaaab);
+    __m128i s0, s1, s2, s3;
+    int n = 0;
+
+    for (; n + 32 <= pixels; n += 32, rgb += 96)
+    {
+        svs_rgb_sums(rgb, s0, s1, s2, s3);
+        s0 = _mm_srli_epi16(_mm_mulhi_epu16(s0, third), 1);
+        s1 = _mm_srli_epi16(_mm_mulhi_epu16(s1, third), 1);
+        s2 = _mm_srli_epi16(_mm_mulhi_epu16(s2, third), 1);
+        s3 = _mm_srli_epi16(_mm_mulhi_epu16(s3, third), 1);
+        _mm_storeu_si128((__m128i*)&luma[n], _mm_packus_epi16(s0, s1));
+        _mm_storeu_si128((__m128i*)&luma[n + 16], _mm_packus_epi16(s2, s3));
+    }
+
+    for (; n < pixels; n++, rgb += 3)
+        luma[n] = (unsigned char)((rgb[0] + rgb[1] + rgb[2]) / 3);
+}
+
+/* converts interleaved RGB pixels to a 16 bit luma plane, R+G+B */
+void svs_rgb_to_luma16_sse2(
+    const unsigned char* rgb,  /* RGB image */
+    int pixels,                /* number of pixels */
+    unsigned short* luma)      /* returned luma plane */
+{
+    __m128i s0, s1, s2, s3;
+    int n = 0;
+
+    for (; n + 32 <= pixels; n += 32, rgb += 96)
+    {
+        svs_rgb_sums(rgb, s0, s1, s2, s3);
+        _mm_storeu_si128((__m128i*)&luma[n], s0);
+        _mm_storeu_si128((__m128i*)&luma[n + 8], s1);
+        _mm_storeu_si128((__m128i*)&luma[n + 16], s2);
+        _mm_storeu_si128((__m128i*)&luma[n + 24], s3);
+    }
+
+    for (; n < pixels; n++, rgb += 3)
+        luma[n] = (unsigned short)(rgb[0] + rgb[1] + rgb[2]);
+}
+
+/* computes edge responses at 2 and 4 pixel radii from the sliding sums.
+ * Produces the same values as the scalar loop within svs_update_sums */
+void svs_row_peaks_sse2(
+    const int* row_sum,       /* sliding sums */
+    int width,                /* row width in pixels */
+    unsigned int* row_peaks)  /* returned edge responses */
+{
+    int x = 4;
+    for (; x + 4 <= width - 4; x += 4)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i*)&row_sum[x]);
+        __m128i c2 = _mm_add_epi32(c, c);
+
+        /* edge using 2 pixel radius */
+        __m128i p0 = _mm_sub_epi32(_mm_sub_epi32(c2,
+                         _mm_loadu_si128((const __m128i*)&row_sum[x - 2])),
+                         _mm_loadu_si128((const __m128i*)&row_sum[x + 2]));
+        __m128i sign = _mm_srai_epi32(p0, 31);
+        p0 = _mm_sub_epi32(_mm_xor_si128(p0, sign), sign);
+
+        /* edge using 4 pixel radius */
+        __m128i p1 = _mm_sub_epi32(_mm_sub_epi32(c2,
+                         _mm_loadu_si128((const __m128i*)&row_sum[x - 4])),
+                         _mm_loadu_si128((const __m128i*)&row_sum[x + 4]));
+        sign = _mm_srai_epi32(p1, 31);
+        p1 = _mm_sub_epi32(_mm_xor_si128(p1, sign), sign);
+
+        /* overall edge response */
+        _mm_storeu_si128((__m128i*)&row_peaks[x], _mm_add_epi32(p0, p1));
+    }
+
+    for (; x < width - 4; x++)
+    {
+        int p0 = (row_sum[x] - row_sum[x - 2]) - (row_sum[x + 2] - row_sum[x]);
+        int p1 = (row_sum[x] - row_sum[x - 4]) - (row_sum[x + 4] - row_sum[x]);
+        if (p0 < 0) p0 = -p0;
+        if (p1 < 0) p1 = -p1;
+        row_peaks[x] = p0 + p1;
+    }
+}
+
+/* returns the sum of the given edge responses */
+unsigned int svs_row_total_sse2(
+    const unsigned int* row_peaks,  /* edge responses */
+    int length)                     /* number of responses */
+{
+    __m128i total = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 8 <= length; x += 8)
+    {
+        total = _mm_add_epi32(total, _mm_loadu_si128((const __m128i*)&row_peaks[x]));
+        total = _mm_add_epi32(total, _mm_loadu_si128((const __m128i*)&row_peaks[x + 4]));
+    }
+    total = _mm_add_epi32(total, _mm_shuffle_epi32(total, 0x4e));
+    total = _mm_add_epi32(total, _mm_shuffle_epi32(total, 0xb1));
+
+    unsigned int sum = (unsigned int)_mm_cvtsi128_si32(total);
+    for (; x < length; x++)
+        sum += row_peaks[x];
+    return(sum);
+}
+
+/* AVX2 version of svs_row_peaks_sse2 */
+__attribute__((target("avx2")))
+void svs_row_peaks_avx2(
+    const int* row_sum,       /* sliding sums */
+    int width,                /* row width in pixels */
+    unsigned int* row_peaks)  /* returned edge responses */
+{
+    int x = 4;
+    for (; x + 8 <= width - 4; x += 8)
+    {
+        __m256i c = _mm256_loadu_si256((const __m256i*)&row_sum[x]);
+        __m256i c2 = _mm256_add_epi32(c, c);
+
+        /* edge using 2 pixel radius */
+        __m256i p0 = _mm256_abs_epi32(_mm256_sub_epi32(_mm256_sub_epi32(c2,
+                         _mm256_loadu_si256((const __m256i*)&row_sum[x - 2])),
+                         _mm256_loadu_si256((const __m256i*)&row_sum[x + 2])));
+
+        /* edge using 4 pixel radius */
+        __m256i p1 = _mm256_abs_epi32(_mm256_sub_epi32(_mm256_sub_epi32(c2,
+                         _mm256_loadu_si256((const __m256i*)&row_sum[x - 4])),
+                         _mm256_loadu_si256((const __m256i*)&row_sum[x + 4])));
+
+        /* overall edge response */
+        _mm256_storeu_si256((__m256i*)&row_peaks[x], _mm256_add_epi32(p0, p1));
+    }
+
+    for (; x < width - 4; x++)
+    {
+        int p0 = (row_sum[x] - row_sum[x - 2]) - (row_sum[x + 2] - row_sum[x]);
+        int p1 = (row_sum[x] - row_sum[x - 4]) - (row_sum[x + 4] - row_sum[x]);
+        if (p0 < 0) p0 = -p0;
+        if (p1 < 0) p1 = -p1;
+        row_peaks[x] = p0 + p1;
+    }
+}
+
+/* AVX2 version of the sliding window non-maximal suppression within
+ * svs_non_max_window, giving identical results.  Responses must be below
+ * 65536, which is always the case for those computed by svs_update_sums.
+ * The running maxima within blocks are computed as ordinary prefix maxima
+ * along the whole row by placing the block index in the upper 16 bits of
+ * each value, so that every block dominates the blocks before it */
+__attribute__((target("avx2")))
+void svs_non_max_window_avx2(
+    unsigned int* peaks,      /* responses, starting at the first pixel examined */
+    int length,               /* number of responses */
+    int k,                    /* inhibition radius - 1, no greater than length */
+    unsigned int threshold,   /* minimum response, at least one */
+    unsigned int* t,          /* padded row, length*3 + 16 entries */
+    unsigned int* fwd,        /* forward maxima, length*3 + 16 entries */
+    unsigned int* bwd)        /* backward maxima, length*3 + 16 entries */
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lower16 = _mm256_set1_epi32(0xffff);
+    int i, p, j;
+
+    /* padded row, rounded up to a whole number of vectors */
+    int n = length + k*2;
+    int n8 = (n + 7) & ~7;
+
+    /* apply the threshold */
+    for (p = 0; p < k; p++)
+        t[p] = 0;
+    __m256i thresh = _mm256_set1_epi32((int)threshold - 1);
+    for (i = 0; i + 8 <= length; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)&peaks[i]);
+        v = _mm256_and_si256(v, _mm256_cmpgt_epi32(v, thresh));
+        _mm256_storeu_si256((__m256i*)&t[k + i], v);
+    }
+    for (; i < length; i++)
+        t[k + i] = (peaks[i] < threshold) ? 0 : peaks[i];
+    for (p = k + length; p < n8 + 16; p++)
+        t[p] = 0;
+
+    /* block index and offset within the block for each lane.
+     * Moving eight pixels advances q blocks and s pixels */
+    int q = 8 / k, s = 8 % k;
+    __m256i vk = _mm256_set1_epi32(k);
+    __m256i vq = _mm256_set1_epi32(q);
+    __m256i vs = _mm256_set1_epi32(s);
+    __m256i block = _mm256_setr_epi32(0/k, 1/k, 2/k, 3/k, 4/k, 5/k, 6/k, 7/k);
+    __m256i offset = _mm256_setr_epi32(0%k, 1%k, 2%k, 3%k, 4%k, 5%k, 6%k, 7%k);
+
+    /* forward maxima */
+    __m256i carry = zero;
+    for (p = 0; p < n8; p += 8)
+    {
+        __m256i x = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)&t[p]),
+                                    _mm256_slli_epi32(block, 16));
+        x = _mm256_max_epi32(x, _mm256_slli_si256(x, 4));
+        x = _mm256_max_epi32(x, _mm256_slli_si256(x, 8));
+        x = _mm256_max_epi32(x, _mm256_blend_epi32(zero,
+                                _mm256_permutevar8x32_epi32(x, _mm256_set1_epi32(3)), 0xf0));
+        x = _mm256_max_epi32(x, carry);
+        carry = _mm256_permutevar8x32_epi32(x, _mm256_set1_epi32(7));
+        _mm256_storeu_si256((__m256i*)&fwd[p], _mm256_and_si256(x, lower16));
+
+        /* advance to the next eight pixels */
+        block = _mm256_add_epi32(block, vq);
+        offset = _mm256_add_epi32(offset, vs);
+        __m256i wrap = _mm256_cmpgt_epi32(offset, _mm256_sub_epi32(vk, _mm256_set1_epi32(1)));
+        offset = _mm256_sub_epi32(offset, _mm256_and_si256(wrap, vk));
+        block = _mm256_sub_epi32(block, wrap);
+    }
+
+    /* backward maxima, with block indices counting down from the end */
+    __m256i last = _mm256_set1_epi32((n8 - 1) / k);
+    int first[8], rem[8];
+    for (j = 0; j < 8; j++)
+    {
+        first[j] = (n8 - 8 + j) / k;
+        rem[j] = (n8 - 8 + j) % k;
+    }
+    block = _mm256_loadu_si256((const __m256i*)first);
+    offset = _mm256_loadu_si256((const __m256i*)rem);
+    carry = zero;
+    for (p = n8 - 8; p >= 0; p -= 8)
+    {
+        __m256i x = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)&t[p]),
+                                    _mm256_slli_epi32(_mm256_sub_epi32(last, block), 16));
+        x = _mm256_max_epi32(x, _mm256_srli_si256(x, 4));
+        x = _mm256_max_epi32(x, _mm256_srli_si256(x, 8));
+        x = _mm256_max_epi32(x, _mm256_blend_epi32(
+                                _mm256_permutevar8x32_epi32(x, _mm256_set1_epi32(4)), zero, 0xf0));
+        x = _mm256_max_epi32(x, carry);
+        carry = _mm256_permutevar8x32_epi32(x, zero);
+        _mm256_storeu_si256((__m256i*)&bwd[p], _mm256_and_si256(x, lower16));
+
+        /* move back to the previous eight pixels */
+        block = _mm256_sub_epi32(block, vq);
+        offset = _mm256_sub_epi32(offset, vs);
+        __m256i wrap = _mm256_cmpgt_epi32(zero, offset);
+        offset = _mm256_add_epi32(offset, _mm256_and_si256(wrap, vk));
+        block = _mm256_add_epi32(block, wrap);
+    }
+    for (p = n8; p < n8 + 16; p++)
+    {
+        fwd[p] = 0;
+        bwd[p] = 0;
+    }
+
+    /* compare each response against the windows on either side */
+    for (i = 0; i + 8 <= length; i += 8)
+    {
+        p = k + i;
+        __m256i v = _mm256_loadu_si256((const __m256i*)&t[p]);
+        __m256i left = _mm256_max_epi32(_mm256_loadu_si256((const __m256i*)&bwd[p - k]),
+                                        _mm256_loadu_si256((const __m256i*)&fwd[p - 1]));
+        __m256i right = _mm256_max_epi32(_mm256_loadu_si256((const __m256i*)&bwd[p + 1]),
+                                         _mm256_loadu_si256((const __m256i*)&fwd[p + k]));
+        __m256i keep = _mm256_andnot_si256(_mm256_cmpgt_epi32(left, v),
+                                           _mm256_cmpgt_epi32(v, right));
+        _mm256_storeu_si256((__m256i*)&peaks[i], _mm256_and_si256(v, keep));
+    }
+    for (; i < length; i++)
+    {
+        p = k + i;
+        unsigned int v = t[p];
+        unsigned int left = (bwd[p - k] > fwd[p - 1]) ? bwd[p - k] : fwd[p - 1];
+        unsigned int right = (bwd[p + 1] > fwd[p + k]) ? bwd[p + 1] : fwd[p + k];
+        peaks[i] = ((v >= left) && (v > right)) ? v : 0;
+    }
+}
+
+/* Computes binary descriptors for eight features at once.  Each sample is
+ * gathered for all eight features with a single instruction, using the
+ * given offsets relative to the pixel index of each feature.  Samples are
+ * single bytes, 16 bit values, or the sum of three RGB bytes depending
+ * upon bytes_per_sample.  Returns the descriptor bits, one group of
+ * (samples+31)/32 words per feature, and the mean sample value */
+__attribute__((target("avx2")))
+void svs_descriptors_avx2(
+    const unsigned char* image,   /* image data */
+    int bytes_per_sample,         /* 1, 2 or 3 (RGB) */
+    const int* pixel_index,       /* pixel index of each of the eight features */
+    const int* offsets,           /* offset of each sample in pixels */
+    int samples,                  /* number of samples, up to 256 */
+    unsigned int* descriptor,     /* returned descriptors */
+    int* mean)                    /* returned mean sample values */
+{
+    __m256i sample[256];
+    __m256i base = _mm256_loadu_si256((const __m256i*)pixel_index);
+    __m256i scale = _mm256_set1_epi32(bytes_per_sample);
+    __m256i byte_mask = _mm256_set1_epi32(0xff);
+    __m256i mask = _mm256_set1_epi32((bytes_per_sample == 2) ? 0xffff : 0xff);
+    __m256i total = _mm256_setzero_si256();
+    unsigned int word[8];
+    int i, w, lane;
+    int words = (samples + 31) / 32;
+
+    for (i = 0; i < samples; i++)
+    {
+        __m256i idx = _mm256_mullo_epi32(_mm256_add_epi32(base, _mm256_set1_epi32(offsets[i])), scale);
+        __m256i v = _mm256_i32gather_epi32((const int*)image, idx, 1);
+        __m256i s = _mm256_and_si256(v, mask);
+        if (bytes_per_sample == 3)
+        {
+            s = _mm256_add_epi32(s, _mm256_and_si256(_mm256_srli_epi32(v, 8), byte_mask));
+            s = _mm256_add_epi32(s, _mm256_and_si256(_mm256_srli_epi32(v, 16), byte_mask));
+        }
+        sample[i] = s;
+        total = _mm256_add_epi32(total, s);
+    }
+
+    /* integer division of the total, which is exact in single precision */
+    __m256i meanval = _mm256_cvttps_epi32(
+                          _mm256_div_ps(_mm256_cvtepi32_ps(total), _mm256_set1_ps((float)samples)));
+    _mm256_storeu_si256((__m256i*)mean, meanval);
+
+    for (w = 0; w < words; w++)
+    {
+        __m256i desc = _mm256_setzero_si256();
+        for (i = w*32; (i < samples) && (i < (w + 1)*32); i++)
+        {
+            __m256i bit = _mm256_set1_epi32((int)(1u << (i % 32)));
+            desc = _mm256_or_si256(desc, _mm256_and_si256(_mm256_cmpgt_epi32(sample[i], meanval), bit));
+        }
+        _mm256_storeu_si256((__m256i*)word, desc);
+        for (lane = 0; lane < 8; lane++)
+            descriptor[lane*words + w] = word[lane];
+    }
+}
+
+/* returns the number of bits set within the bitwise AND of two
+ * descriptors, using the POPCNT instruction */
+__attribute__((target("popcnt")))
+int svs_match_bits_popcnt(
+    const unsigned int* a,   /* first descriptor */
+    const unsigned int* b,   /* second descriptor */
+    int words)               /* length of the descriptors in 32 bit words */
+{
+    int i = 0, bits = 0;
+#ifdef __x86_64__
+    for (; i + 2 <= words; i += 2)
+    {
+        unsigned long long va, vb;
+        memcpy(&va, &a[i], sizeof(va));
+        memcpy(&vb, &b[i], sizeof(vb));
+        bits += (int)_mm_popcnt_u64(va & vb);
+    }
+#endif
+    for (; i < words; i++)
+        bits += _mm_popcnt_u32(a[i] & b[i]);
+    return(bits);
+}
+
+/* AVX2 version of svs_match_bits_popcnt for descriptors which are a
+ * multiple of 256 bits long.  Bits are counted within each nibble
+ * using a lookup table held in a register */
+__attribute__((target("avx2")))
+int svs_match_bits_avx2(
+    const unsigned int* a,   /* first descriptor */
+    const unsigned int* b,   /* second descriptor */
+    int words)               /* length of the descriptors in 32 bit words */
+{
+    const __m256i lookup = _mm256_setr_epi8(
+                               0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                               0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+    __m256i total = _mm256_setzero_si256();
+
+    for (int i = 0; i < words; i += 8)
+    {
+        __m256i v = _mm256_and_si256(
+                        _mm256_loadu_si256((const __m256i*)&a[i]),
+                        _mm256_loadu_si256((const __m256i*)&b[i]));
+        __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low_nibble));
+        __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibble));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256()));
+    }
+
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+    return((int)_mm_cvtsi128_si32(sum));
+}
+
+/* returns the number of bits set within each 32 bit lane */
+__attribute__((target("avx2")))
+static inline __m256i svs_popcount_epi32(
+    __m256i v)
+{
+    const __m256i lookup = _mm256_setr_epi8(
+                               0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                               0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low_nibble));
+    __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibble));
+    __m256i bytes = _mm256_add_epi8(lo, hi);
+    return(_mm256_madd_epi16(_mm256_maddubs_epi16(bytes, _mm256_set1_epi8(1)), _mm256_set1_epi16(1)));
+}
+
+/* Scores one left camera feature against eight right camera features,
+ * returning the scores within an AVX2 register.  This is the same
+ * calculation as the scalar version within svs_match_scores */
+__attribute__((target("avx2")))
+static inline __m256i svs_match_scores8_avx2(
+    const struct svs_match_params* params,  /* left camera feature and weights */
+    const unsigned int* eigen,              /* eigendescriptors of the right features */
+    int words,                              /* descriptor length in 32 bit words */
+    __m128i feature_x,                      /* x coordinates of the right features */
+    __m128i mean)                           /* mean luminance of the right features */
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i max_disp = _mm256_set1_epi32(params->max_disp);
+    __m256i learnDisp = _mm256_set1_epi32(params->learnDisp);
+    __m256i penalty = _mm256_set1_epi32(params->penalty);
+    __m256i correlation = zero, anticorrelation = zero;
+    int w;
+
+    __m256i disp = _mm256_sub_epi32(_mm256_set1_epi32(params->xL), _mm256_cvtepi16_epi32(feature_x));
+    __m256i luma_diff = _mm256_abs_epi32(
+                            _mm256_sub_epi32(_mm256_cvtepu8_epi32(mean), _mm256_set1_epi32(params->meanL)));
+
+    /* descriptor correlation and anti-correlation */
+    if (words == 1)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)eigen);
+        correlation = svs_popcount_epi32(_mm256_and_si256(v, _mm256_set1_epi32((int)params->descL[0])));
+        anticorrelation = svs_popcount_epi32(_mm256_and_si256(v, _mm256_set1_epi32((int)params->descLanti[0])));
+    }
+    else
+    {
+        __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(words));
+        for (w = 0; w < words; w++)
+        {
+            __m256i v = _mm256_i32gather_epi32((const int*)&eigen[w], index, 4);
+            correlation = _mm256_add_epi32(correlation,
+                                           svs_popcount_epi32(_mm256_and_si256(v, _mm256_set1_epi32((int)params->descL[w]))));
+            anticorrelation = _mm256_add_epi32(anticorrelation,
+                                               svs_popcount_epi32(_mm256_and_si256(v, _mm256_set1_epi32((int)params->descLanti[w]))));
+        }
+    }
+
+    /* matching score within the disparity range, where enough bits match */
+    __m256i score = _mm256_add_epi32(
+                        _mm256_set1_epi32(10000 + params->max_disp * params->learnDisp),
+                        _mm256_mullo_epi32(
+                            _mm256_sub_epi32(_mm256_add_epi32(correlation, _mm256_set1_epi32(params->pixels)), anticorrelation),
+                            _mm256_set1_epi32(params->learnDesc)));
+    score = _mm256_sub_epi32(score, _mm256_mullo_epi32(luma_diff, _mm256_set1_epi32(params->learnLuma)));
+    score = _mm256_sub_epi32(score, _mm256_mullo_epi32(_mm256_max_epi32(disp, zero), learnDisp));
+    score = _mm256_max_epi32(_mm256_sub_epi32(score, penalty), zero);
+    __m256i in_range = _mm256_and_si256(
+                           _mm256_cmpgt_epi32(disp, _mm256_set1_epi32(-11)),
+                           _mm256_cmpgt_epi32(max_disp, disp));
+    score = _mm256_and_si256(score, _mm256_cmpgt_epi32(correlation, _mm256_set1_epi32(params->threshold)));
+
+    /* score for negative disparities beyond the range */
+    __m256i negative = _mm256_and_si256(
+                           _mm256_cmpgt_epi32(zero, disp),
+                           _mm256_cmpgt_epi32(disp, _mm256_sub_epi32(zero, max_disp)));
+    __m256i negative_score = _mm256_and_si256(
+                                 _mm256_max_epi32(
+                                     _mm256_sub_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(max_disp, disp), learnDisp), penalty),
+                                     zero),
+                                 negative);
+
+    return(_mm256_blendv_epi8(negative_score, score, in_range));
+}
+
+/* AVX2 version of svs_match_scores, scoring eight right camera
+ * features at a time.  Returns the total of the scores */
+__attribute__((target("avx2")))
+unsigned int svs_match_scores_avx2(
+    const struct svs_match_params* params,  /* left camera feature and weights */
+    const unsigned int* eigen,              /* eigendescriptors of the right features */
+    const short int* feature_x,             /* x coordinates of the right features */
+    const unsigned char* mean,              /* mean luminance of the right features */
+    int words,                              /* descriptor length in 32 bit words */
+    int features,                           /* number of right features */
+    unsigned int* score)                    /* returned scores */
+{
+    __m256i total = _mm256_setzero_si256();
+    __m256i s;
+    int i = 0;
+
+    for (; i + 8 <= features; i += 8)
+    {
+        s = svs_match_scores8_avx2(
+                params, &eigen[i*words], words,
+                _mm_loadu_si128((const __m128i*)&feature_x[i]),
+                _mm_loadl_epi64((const __m128i*)&mean[i]));
+        _mm256_storeu_si256((__m256i*)&score[i], s);
+        total = _mm256_add_epi32(total, s);
+    }
+
+    if (i < features)
+    {
+        /* the remaining features are copied into zero padded buffers */
+        unsigned int eigen_tail[8*256/32];
+        short int x_tail[8];
+        unsigned char mean_tail[8];
+        unsigned int score_tail[8];
+        int n = features - i;
+        memset(eigen_tail, 0, sizeof(eigen_tail));
+        memset(x_tail, 0, sizeof(x_tail));
+        memset(mean_tail, 0, sizeof(mean_tail));
+        memcpy(eigen_tail, &eigen[i*words], n * words * sizeof(unsigned int));
+        memcpy(x_tail, &feature_x[i], n * sizeof(short int));
+        memcpy(mean_tail, &mean[i], n * sizeof(unsigned char));
+
+        s = svs_match_scores8_avx2(
+                params, eigen_tail, words,
+                _mm_loadu_si128((const __m128i*)x_tail),
+                _mm_loadl_epi64((const __m128i*)mean_tail));
+        s = _mm256_and_si256(s, _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+        _mm256_storeu_si256((__m256i*)score_tail, s);
+        memcpy(&score[i], score_tail, n * sizeof(unsigned int));
+        total = _mm256_add_epi32(total, s);
+    }
+
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return((unsigned int)_mm_cvtsi128_si32(sum));
+}
+
+/* AVX2 version of svs_learn_scores, scoring eight possible matches at a
+ * time from their terms.  Returns the total of the scores and the
+ * highest score in best */
+__attribute__((target("avx2")))
+unsigned int svs_learn_scores_avx2(
+    const int* base,       /* part of each score independent of the weights */
+    const int* desc,       /* descriptor correlation terms */
+    const int* luma,       /* luminance differences */
+    const int* disp,       /* disparity terms */
+    int n,                 /* number of matches */
+    const int* weights,    /* learnDesc, learnLuma and learnDisp */
+    unsigned int* best)    /* returned highest score */
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i learnDesc = _mm256_set1_epi32(weights[0]);
+    __m256i learnLuma = _mm256_set1_epi32(weights[1]);
+    __m256i learnDisp = _mm256_set1_epi32(weights[2]);
+    __m256i total = zero, highest = zero, s;
+    unsigned int t, b;
+    int i = 0, v;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        s = _mm256_add_epi32(
+                _mm256_loadu_si256((const __m256i*)&base[i]),
+                _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*)&desc[i]), learnDesc));
+        s = _mm256_sub_epi32(s, _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*)&luma[i]), learnLuma));
+        s = _mm256_add_epi32(s, _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*)&disp[i]), learnDisp));
+        s = _mm256_max_epi32(s, zero);
+        total = _mm256_add_epi32(total, s);
+        highest = _mm256_max_epi32(highest, s);
+    }
+
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    __m128i high = _mm_max_epi32(_mm256_castsi256_si128(highest), _mm256_extracti128_si256(highest, 1));
+    high = _mm_max_epi32(high, _mm_shuffle_epi32(high, _MM_SHUFFLE(1, 0, 3, 2)));
+    high = _mm_max_epi32(high, _mm_shuffle_epi32(high, _MM_SHUFFLE(2, 3, 0, 1)));
+    t = (unsigned int)_mm_cvtsi128_si32(sum);
+    b = (unsigned int)_mm_cvtsi128_si32(high);
+
+    /* remaining matches */
+    for (; i < n; i++)
+    {
+        v = base[i] + desc[i] * weights[0] - luma[i] * weights[1] + disp[i] * weights[2];
+        if (v > 0)
+        {
+            t += (unsigned int)v;
+            if ((unsigned int)v > b)
+                b = (unsigned int)v;
+        }
+    }
+    *best = b;
+    return(t);
+}
+
+/* AVX2 version of svs_plane_inliers, testing eight points at a time */
+__attribute__((target("avx2")))
+int svs_plane_inliers_avx2(
+    const float* x,            /* x coordinates */
+    const float* y,            /* y coordinates */
+    const float* d,            /* disparities in pixels */
+    int n,                     /* number of points */
+    const float* plane,        /* plane coefficients */
+    float tolerance)           /* tolerance in pixels of disparity */
+{
+    __m256 a = _mm256_set1_ps(plane[0]);
+    __m256 b = _mm256_set1_ps(plane[1]);
+    __m256 c = _mm256_set1_ps(plane[2]);
+    __m256 tol = _mm256_set1_ps(tolerance);
+    __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256i count = _mm256_setzero_si256();
+    __m256 r;
+    float rs;
+    int i = 0, inliers;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        r = _mm256_add_ps(_mm256_mul_ps(a, _mm256_loadu_ps(&x[i])), _mm256_mul_ps(b, _mm256_loadu_ps(&y[i])));
+        r = _mm256_sub_ps(_mm256_add_ps(r, c), _mm256_loadu_ps(&d[i]));
+        r = _mm256_andnot_ps(sign, r);
+
+        /* each inlier gives a mask of -1 */
+        count = _mm256_sub_epi32(count, _mm256_castps_si256(_mm256_cmp_ps(r, tol, _CMP_LE_OQ)));
+    }
+
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(count), _mm256_extracti128_si256(count, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    inliers = _mm_cvtsi128_si32(sum);
+
+    /* remaining points */
+    for (; i < n; i++)
+    {
+        rs = plane[0] * x[i] + plane[1] * y[i] + plane[2] - d[i];
+        if ((rs <= tolerance) && (rs >= -tolerance))
+            inliers++;
+    }
+    return(inliers);
+}
+
+/* stores eight rectified pixels, given as 32 bit values */
+__attribute__((target("avx2")))
+static inline void svs_rectify_store_avx2(
+    __m256i v,                    /* pixel values */
+    int bytes_per_sample,         /* 1 or 2 bytes per pixel */
+    unsigned char* rectified)     /* returned pixels */
+{
+    v = _mm256_packus_epi32(v, v);
+    if (bytes_per_sample == 1)
+    {
+        v = _mm256_packus_epi16(v, v);
+        v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+        _mm_storel_epi64((__m128i*)rectified, _mm256_castsi256_si128(v));
+    }
+    else
+    {
+        v = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i*)rectified, _mm256_castsi256_si128(v));
+    }
+}
+
+/* SSE2 version of the search for the nearest raw pixel to each pixel of
+ * one row within svs_rectify, four pixels at a time.  Raw rows are less
+ * than 32768, so they are multiplied by the width using madd */
+void svs_rectify_index_sse2(
+    const short int* map,         /* x and y offsets of each pixel of the row */
+    int bits,                     /* fractional bits of the offsets */
+    int width,                    /* image width */
+    int y,                        /* row of the rectified image */
+    int* index)                   /* returned index of the nearest raw pixel */
+{
+    int half = 1 << (bits - 1);
+    __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i vwidth = _mm_set1_epi32(width);
+    __m128i vhalf = _mm_set1_epi32(half);
+    __m128i vy = _mm_set1_epi32((y << bits) + half);
+    __m128i off, sx, sy;
+    int x = 0;
+
+    for (; x + 4 <= width; x += 4)
+    {
+        off = _mm_loadu_si128((const __m128i*)&map[x*2]);
+        sx = _mm_slli_epi32(_mm_add_epi32(_mm_set1_epi32(x), lanes), bits);
+        sx = _mm_add_epi32(_mm_add_epi32(sx, vhalf), _mm_srai_epi32(_mm_slli_epi32(off, 16), 16));
+        sy = _mm_srai_epi32(_mm_add_epi32(vy, _mm_srai_epi32(off, 16)), bits);
+        _mm_storeu_si128((__m128i*)&index[x],
+                         _mm_add_epi32(_mm_madd_epi16(sy, vwidth), _mm_srai_epi32(sx, bits)));
+    }
+
+    /* remaining pixels */
+    for (; x < width; x++)
+        index[x] = (((y << bits) + map[x*2 + 1] + half) >> bits) * width + (((x << bits) + map[x*2] + half) >> bits);
+}
+
+/* AVX2 version of the search for the nearest raw pixel to each pixel
+ * of one row within svs_rectify, eight pixels at a time */
+__attribute__((target("avx2")))
+void svs_rectify_index_avx2(
+    const short int* map,         /* x and y offsets of each pixel of the row */
+    int bits,                     /* fractional bits of the offsets */
+    int width,                    /* image width */
+    int y,                        /* row of the rectified image */
+    int* index)                   /* returned index of the nearest raw pixel */
+{
+    int half = 1 << (bits - 1);
+    __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i vwidth = _mm256_set1_epi32(width);
+    __m256i vhalf = _mm256_set1_epi32(half);
+    __m256i vy = _mm256_set1_epi32((y << bits) + half);
+    __m256i off, sx, sy;
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8)
+    {
+        off = _mm256_loadu_si256((const __m256i*)&map[x*2]);
+        sx = _mm256_slli_epi32(_mm256_add_epi32(_mm256_set1_epi32(x), lanes), bits);
+        sx = _mm256_add_epi32(_mm256_add_epi32(sx, vhalf), _mm256_srai_epi32(_mm256_slli_epi32(off, 16), 16));
+        sy = _mm256_add_epi32(vy, _mm256_srai_epi32(off, 16));
+        _mm256_storeu_si256((__m256i*)&index[x],
+                            _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srai_epi32(sy, bits), vwidth),
+                                             _mm256_srai_epi32(sx, bits)));
+    }
+
+    /* remaining pixels */
+    for (; x < width; x++)
+        index[x] = (((y << bits) + map[x*2 + 1] + half) >> bits) * width + (((x << bits) + map[x*2] + half) >> bits);
+}
+
+/* AVX2 version of the bilinear interpolation of one row within svs_rectify,
+ * eight pixels at a time.  Only the luma formats are handled, and RGB
+ * images are always interpolated by the scalar code, since each of their
+ * channels would need gathers of its own.  For 8 bit images a gather
+ * of four bytes at each raw position gives the upper pair of pixels, and a
+ * gather ending at the lower right pixel gives the lower pair, so that no
+ * gather reads beyond the end of the image */
+__attribute__((target("avx2")))
+void svs_rectify_bilinear_avx2(
+    const unsigned char* raw,     /* raw luma image */
+    int bytes_per_sample,         /* 1 for SVS_FORMAT_LUMA8 or 2 for SVS_FORMAT_LUMA16 */
+    int width,                    /* image width */
+    int height,                   /* image height */
+    const short int* map,         /* x and y offsets of each pixel of the row */
+    int bits,                     /* fractional bits of the offsets */
+    int y,                        /* row of the rectified image */
+    unsigned char* rectified)     /* returned rectified row */
+{
+    int scale = 1 << bits;
+    __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i vwidth = _mm256_set1_epi32(width);
+    __m256i vy = _mm256_set1_epi32(y << bits);
+    __m256i max_x = _mm256_set1_epi32(width - 2);
+    __m256i max_y = _mm256_set1_epi32(height - 2);
+    __m256i vscale = _mm256_set1_epi32(scale);
+    __m256i round = _mm256_set1_epi32(1 << (bits*2 - 1));
+    __m256i low8 = _mm256_set1_epi32(0xff);
+    __m256i low16 = _mm256_set1_epi32(0xffff);
+    __m256i off, sx, sy, ix, iy, p, top, bottom, a, b, c, d, v;
+    int x = 0, fx, fy, ixs, iys, pos, ta, tb, tc, td;
+
+    for (; x + 8 <= width; x += 8)
+    {
+        off = _mm256_loadu_si256((const __m256i*)&map[x*2]);
+        sx = _mm256_slli_epi32(_mm256_add_epi32(_mm256_set1_epi32(x), lanes), bits);
+        sx = _mm256_add_epi32(sx, _mm256_srai_epi32(_mm256_slli_epi32(off, 16), 16));
+        sy = _mm256_add_epi32(vy, _mm256_srai_epi32(off, 16));
+
+        /* the upper left of the four raw pixels, which lie within the image */
+        ix = _mm256_min_epi32(_mm256_srai_epi32(sx, bits), max_x);
+        iy = _mm256_min_epi32(_mm256_srai_epi32(sy, bits), max_y);
+        sx = _mm256_sub_epi32(sx, _mm256_slli_epi32(ix, bits));
+        sy = _mm256_sub_epi32(sy, _mm256_slli_epi32(iy, bits));
+        p = _mm256_add_epi32(_mm256_mullo_epi32(iy, vwidth), ix);
+
+        if (bytes_per_sample == 1)
+        {
+            top = _mm256_i32gather_epi32((const int*)raw, p, 1);
+            bottom = _mm256_i32gather_epi32((const int*)raw, _mm256_add_epi32(p, _mm256_sub_epi32(vwidth, _mm256_set1_epi32(2))), 1);
+            a = _mm256_and_si256(top, low8);
+            b = _mm256_and_si256(_mm256_srli_epi32(top, 8), low8);
+            c = _mm256_and_si256(_mm256_srli_epi32(bottom, 16), low8);
+            d = _mm256_srli_epi32(bottom, 24);
+        }
+        else
+        {
+            top = _mm256_i32gather_epi32((const int*)raw, p, 2);
+            bottom = _mm256_i32gather_epi32((const int*)raw, _mm256_add_epi32(p, vwidth), 2);
+            a = _mm256_and_si256(top, low16);
+            b = _mm256_srli_epi32(top, 16);
+            c = _mm256_and_si256(bottom, low16);
+            d = _mm256_srli_epi32(bottom, 16);
+        }
+
+        /* interpolate horizontally, then vertically */
+        top = _mm256_add_epi32(_mm256_mullo_epi32(a, _mm256_sub_epi32(vscale, sx)), _mm256_mullo_epi32(b, sx));
+        bottom = _mm256_add_epi32(_mm256_mullo_epi32(c, _mm256_sub_epi32(vscale, sx)), _mm256_mullo_epi32(d, sx));
+        v = _mm256_add_epi32(_mm256_mullo_epi32(top, _mm256_sub_epi32(vscale, sy)), _mm256_mullo_epi32(bottom, sy));
+        v = _mm256_srli_epi32(_mm256_add_epi32(v, round), bits*2);
+        svs_rectify_store_avx2(v, bytes_per_sample, &rectified[x * bytes_per_sample]);
+    }
+
+    /* remaining pixels */
+    for (; x < width; x++)
+    {
+        fx = (x << bits) + map[x*2];
+        fy = (y << bits) + map[x*2 + 1];
+        ixs = fx >> bits;
+        if (ixs > width - 2) ixs = width - 2;
+        iys = fy >> bits;
+        if (iys > height - 2) iys = height - 2;
+        fx -= ixs << bits;
+        fy -= iys << bits;
+        pos = iys * width + ixs;
+        if (bytes_per_sample == 1)
+        {
+            ta = raw[pos];
+            tb = raw[pos + 1];
+            tc = raw[pos + width];
+            td = raw[pos + width + 1];
+        }
+        else
+        {
+            const unsigned short* raw16 = (const unsigned short*)raw;
+            ta = raw16[pos];
+            tb = raw16[pos + 1];
+            tc = raw16[pos + width];
+            td = raw16[pos + width + 1];
+        }
+        ta = ta * (scale - fx) + tb * fx;
+        tc = tc * (scale - fx) + td * fx;
+        ta = (ta * (scale - fy) + tc * fy + (1 << (bits*2 - 1))) >> (bits*2);
+        if (bytes_per_sample == 1)
+            rectified[x] = (unsigned char)ta;
+        else
+            ((unsigned short*)rectified)[x] = (unsigned short)ta;
+    }
+}
+
+#endif
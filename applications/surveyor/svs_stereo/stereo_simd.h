@@ -0,0 +1,73 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *  stereo_simd.h - SIMD kernels for the SVS stereo functions
+ *    Copyright (C) 2009  Surveyor Corporation
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details (www.gnu.org/licenses)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef STEREO_SIMD_H_
+#define STEREO_SIMD_H_
+
+/* instruction set extensions which the kernels may use */
+#define SVS_SIMD_NONE            0
+#define SVS_SIMD_SSE2            1
+#define SVS_SIMD_AVX2            2
+
+/* SIMD kernels are only available on x86 PCs */
+#if !defined(SVS_EMBEDDED) && defined(__GNUC__) && defined(__SSE2__)
+#define SVS_SIMD_X86
+#endif
+
+/* a left camera feature to be scored against features from the right
+ * camera within svs_match, together with the matching weights */
+struct svs_match_params
+{
+    const unsigned int* descL;       /* eigendescriptor */
+    const unsigned int* descLanti;   /* eigendescriptor with its bits reversed */
+    int xL, meanL;                   /* x coordinate and mean luminance */
+    int max_disp;                    /* maximum disparity in pixels */
+    int threshold;                   /* minimum number of correlated bits */
+    int pixels;                      /* number of bits within each descriptor */
+    int learnDesc, learnLuma, learnDisp;
+    int penalty;                     /* subtracted from every score */
+};
+
+extern int svs_simd_detect();
+
+#ifdef SVS_SIMD_X86
+extern void svs_row_sum_sse2(const unsigned char* rgb, int width, int* row_sum);
+extern void svs_row_sum_luma8_sse2(const unsigned char* luma, int width, int* row_sum);
+extern void svs_row_sum_luma16_sse2(const unsigned short* luma, int width, int* row_sum);
+extern void svs_rgb_to_luma8_sse2(const unsigned char* rgb, int pixels, unsigned char* luma);
+extern void svs_rgb_to_luma16_sse2(const unsigned char* rgb, int pixels, unsigned short* luma);
+extern void svs_row_peaks_sse2(const int* row_sum, int width, unsigned int* row_peaks);
+extern unsigned int svs_row_total_sse2(const unsigned int* row_peaks, int length);
+extern void svs_row_peaks_avx2(const int* row_sum, int width, unsigned int* row_peaks);
+extern void svs_non_max_window_avx2(unsigned int* peaks, int length, int k, unsigned int threshold,
+                                    unsigned int* t, unsigned int* fwd, unsigned int* bwd);
+extern void svs_descriptors_avx2(const unsigned char* image, int bytes_per_sample, const int* pixel_index,
+                                 const int* offsets, int samples, unsigned int* descriptor, int* mean);
+extern int svs_match_bits_popcnt(const unsigned int* a, const unsigned int* b, int words);
+extern int svs_match_bits_avx2(const unsigned int* a, const unsigned int* b, int words);
+extern unsigned int svs_match_scores_avx2(const struct svs_match_params* params, const unsigned int* eigen,
+                                          const short int* feature_x, const unsigned char* mean,
+                                          int words, int features, unsigned int* score);
+extern unsigned int svs_learn_scores_avx2(const int* base, const int* desc, const int* luma, const int* disp,
+                                          int n, const int* weights, unsigned int* best);
+extern int svs_plane_inliers_avx2(const float* x, const float* y, const float* d, int n,
+                                  const float* plane, float tolerance);
+extern void svs_rectify_index_sse2(const short int* map, int bits, int width, int y, int* index);
+extern void svs_rectify_index_avx2(const short int* map, int bits, int width, int y, int* index);
+extern void svs_rectify_bilinear_avx2(const unsigned char* raw, int bytes_per_sample, int width, int height,
+                                      const short int* map, int bits, int y, unsigned char* rectified);
+#endif
+
+#endif
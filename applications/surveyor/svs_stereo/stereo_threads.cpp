@@ -0,0 +1,204 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *  stereo_threads.c - worker threads for the SVS stereo functions
+ *    Copyright (C) 2009  Surveyor Corporation
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details (www.gnu.org/licenses)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdlib.h>
+#include "stereo_threads.h"
+
+#ifdef SVS_THREADS
+#include <pthread.h>
+#endif
+
+/* A fixed set of worker threads which sleep until a batch of tasks
+ * is submitted with svs_pool_run.  The calling thread takes part in
+ * each batch, so a pool of n threads starts n-1 workers */
+struct svs_pool
+{
+    /* total number of threads, including the caller */
+    int threads;
+
+#ifdef SVS_THREADS
+    pthread_t* workers;
+    pthread_mutex_t lock;
+
+    /* signalled when a new batch is submitted */
+    pthread_cond_t start;
+
+    /* signalled when the last task of a batch completes */
+    pthread_cond_t done;
+
+    /* the current batch */
+    svs_task task;
+    void* arg;
+    int tasks;
+
+    /* index of the next task to be claimed */
+    int next_task;
+
+    /* number of tasks not yet completed */
+    int remaining;
+
+    /* incremented for each batch, so that workers can tell a new
+     * batch from a spurious wakeup */
+    unsigned int batch;
+
+    int shutdown;
+#endif
+};
+
+#ifdef SVS_THREADS
+
+/* claims and runs tasks from the current batch until none remain.
+ * Called with the lock held, and returns with it held */
+static void svs_pool_work(
+    struct svs_pool* pool)
+{
+    while (pool->next_task < pool->tasks)
+    {
+        int index = pool->next_task++;
+        pthread_mutex_unlock(&pool->lock);
+        pool->task(pool->arg, index);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->remaining == 0)
+            pthread_cond_broadcast(&pool->done);
+    }
+}
+
+static void* svs_pool_worker(
+    void* arg)
+{
+    struct svs_pool* pool = (struct svs_pool*)arg;
+    unsigned int batch = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->shutdown)
+    {
+        if (pool->batch != batch)
+        {
+            batch = pool->batch;
+            svs_pool_work(pool);
+        }
+        else
+        {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return(NULL);
+}
+
+#endif
+
+/* creates a pool with the given total number of threads */
+struct svs_pool* svs_pool_create(
+    int threads)   /* number of threads, including the calling thread */
+{
+    struct svs_pool* pool = (struct svs_pool*)calloc(1, sizeof(struct svs_pool));
+    if (pool == NULL)
+        return(NULL);
+
+    if (threads < 1)
+        threads = 1;
+    pool->threads = 1;
+
+#ifdef SVS_THREADS
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    if (threads > 1)
+        pool->workers = (pthread_t*)malloc((threads - 1) * sizeof(pthread_t));
+    if (pool->workers != NULL)
+    {
+        for (int i = 0; i < threads - 1; i++)
+        {
+            if (pthread_create(&pool->workers[i], NULL, svs_pool_worker, pool) != 0)
+                break;
+            pool->threads++;
+        }
+    }
+#endif
+
+    return(pool);
+}
+
+/* stops the worker threads and releases the pool */
+void svs_pool_free(
+    struct svs_pool* pool)
+{
+    if (pool == NULL)
+        return;
+
+#ifdef SVS_THREADS
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->threads - 1; i++)
+        pthread_join(pool->workers[i], NULL);
+
+    free(pool->workers);
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+#endif
+
+    free(pool);
+}
+
+/* returns the number of threads which run tasks, including the caller */
+int svs_pool_threads(
+    struct svs_pool* pool)
+{
+    if (pool == NULL)
+        return(1);
+    return(pool->threads);
+}
+
+/* Runs task(arg, index) for every index in the range 0 - tasks-1,
+ * returning once all of them have completed.  Tasks may run in any
+ * order and on any thread, so each one should only write to data
+ * belonging to its own index */
+void svs_pool_run(
+    struct svs_pool* pool,   /* pool, or NULL to run on the calling thread */
+    svs_task task,           /* function to be called */
+    void* arg,               /* argument passed to each task */
+    int tasks)               /* number of tasks */
+{
+    int index;
+
+#ifdef SVS_THREADS
+    if ((pool != NULL) && (pool->threads > 1) && (tasks > 1))
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->task = task;
+        pool->arg = arg;
+        pool->tasks = tasks;
+        pool->next_task = 0;
+        pool->remaining = tasks;
+        pool->batch++;
+        pthread_cond_broadcast(&pool->start);
+
+        svs_pool_work(pool);
+        while (pool->remaining > 0)
+            pthread_cond_wait(&pool->done, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+#endif
+
+    for (index = 0; index < tasks; index++)
+        task(arg, index);
+}
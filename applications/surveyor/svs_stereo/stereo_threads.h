@@ -0,0 +1,35 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *  stereo_threads.h - worker threads for the SVS stereo functions
+ *    Copyright (C) 2009  Surveyor Corporation
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details (www.gnu.org/licenses)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef STEREO_THREADS_H_
+#define STEREO_THREADS_H_
+
+/* threads are only available on PCs.  Elsewhere the
+ * pool runs every task on the calling thread */
+#if !defined(SVS_EMBEDDED) && !defined(_WIN32)
+#define SVS_THREADS
+#endif
+
+/* a task is called once for each index in the range 0 - tasks-1 */
+typedef void (*svs_task)(void* arg, int index);
+
+struct svs_pool;
+
+extern struct svs_pool* svs_pool_create(int threads);
+extern void svs_pool_free(struct svs_pool* pool);
+extern int svs_pool_threads(struct svs_pool* pool);
+extern void svs_pool_run(struct svs_pool* pool, svs_task task, void* arg, int tasks);
+
+#endif